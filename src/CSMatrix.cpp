@@ -1,8 +1,30 @@
 #include "CSMatrix.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #define ENTRY_A		1
 #define ENTRY_B		0
 
+// bump whenever the CS matrix cache layout changes
+#define CS_CACHE_VERSION	1
+
+// columns per task when populating and checking the columns of a new CS matrix
+#define BUILD_CHUNK_COLS	256
+
+// columns with at most this fraction of rows ENTRY_A also list their ENTRY_A rows
+#define SPARSE_MAX_DENSITY	0.25
+
+// tasks per thread the parallel checker splits the path tree into (for load balancing)
+#define PATH_TASKS_PER_THREAD	16
+
 #ifdef __MACH__
 #include <mach/clock.h>
 #include <mach/mach.h>
@@ -24,16 +46,25 @@ void current_utc_time(struct timespec *ts) {
 
 
 
-CSMatrix::CSMatrix(LocatingArray *locatingArray) {
+CSMatrix::CSMatrix(LocatingArray *locatingArray, bool packed, string cacheFile, bool virtualCols, int buildThreads) {
 
 	this->locatingArray = locatingArray;
+	this->packed = packed || virtualCols;
+	this->virtualCols = virtualCols;
+	this->threads = 1;
+	this->starts = 1;
+	this->source = NULL;
+	this->startIndex = 0;
+	this->cancel = NULL;
+	this->verbose = true;
+	this->rowIndexValid = false;
+	this->colPositions = NULL;
 
 	// assign factor data variable for use with grabbing column names
 	this->factorData = locatingArray->getFactorData();
 
 	// to be used when populating CSMatrix
 	CSCol *csCol;
-	int sum;
 
 	// get number of factors in locating array
 	int factors = locatingArray->getFactors();
@@ -41,8 +72,10 @@ CSMatrix::CSMatrix(LocatingArray *locatingArray) {
 	// get level counts (how many levels for each factor)
 	groupingInfo = locatingArray->getGroupingInfo();
 
-	// get the level matrix from locating array (this is the main data)
-	char **levelMatrix = locatingArray->getLevelMatrix();
+	// the level matrix of the locating array is the main data, and every kernel
+	// below reads or resamples it a whole factor column at a time (a binary array is
+	// stored column-major, so it stays in its mapping)
+	locatingArray->setColumnMajor(true);
 
 	// a row for every test
 	rows = locatingArray->getTests();
@@ -50,40 +83,30 @@ CSMatrix::CSMatrix(LocatingArray *locatingArray) {
 	// initialize the data column vector
 	data = new vector<CSCol*>;
 
+	cout << "Estimated CS Matrix: " << (long long int)countColumns(locatingArray) << " columns, " <<
+		(long long int)(estimateBytes(locatingArray, this->packed, virtualCols) / 1048576) << " MB" << endl;
+
 	// initialize (factor + level)-to-index map
 	factorLevelMap = new int*[factors];
 	for (int factor_i = 0; factor_i < factors; factor_i++) {
 		factorLevelMap[factor_i] = new int[groupingInfo[factor_i]->levels];
 	}
 
-	// initialize index-to-column map (to be populated later)
-	mapping = new Mapping;
-	mapping->mappedTo = 0;
-	mapping->mapping = NULL;
-
-	// sum of squares of each column for normalization
-	vector <float>sumOfSquares;
+	/* The columns (their settings) are enumerated first without
+	any data. The data and coverability are then either loaded from the cache file
+	or computed column by column (and written to the cache file if there is one). */
 
 	// populate compressive sensing matrix column by column
 	int col_i = 0;
 
 	// Add the INTERCEPT
 	csCol = new CSCol;
-	sum = 0;
 
 	csCol->factors = 0;
 	csCol->setting = new FactorSetting[0];
 
-	// populate the intercept
-	for (int row_i = 0; row_i < rows; row_i++) {
-		addRow(csCol);
-		csCol->dataP[row_i] = ENTRY_A;
-		sum += 1;
-	}
-
 	// push into vector
 	data->push_back(csCol);
-	sumOfSquares.push_back(sum);
 	col_i++;
 
 	// go over all 1-way interactions
@@ -91,7 +114,7 @@ CSMatrix::CSMatrix(LocatingArray *locatingArray) {
 
 		for (char level_i = 0; level_i < groupingInfo[factor_i]->levels; level_i++) {
 
-			addOneWayInteraction(factor_i, level_i, levelMatrix, sumOfSquares);
+			addOneWayInteraction(factor_i, level_i);
 
 			// set factor level map
 			factorLevelMap[factor_i][level_i] = col_i - 1; // subtract 1 for INTERCEPT
@@ -103,81 +126,521 @@ CSMatrix::CSMatrix(LocatingArray *locatingArray) {
 
 	}
 
-	int lastOneWay_i = col_i;
-
-	// initialize 1st level mapping
-	mapping->mapping = new Mapping*[col_i - 1];
+	// number the interactions (in the order they are added)
+	buildColumnNumbering();
 
 	cout << "Adding t-way interactions" << endl;
-	addTWayInteractions(csCol, col_i - 1, col_i, locatingArray->getT(),
-		mapping->mapping, sumOfSquares, groupingInfo, levelMatrix);
+	addTWayInteractions(csCol, col_i - 1, col_i, locatingArray->getT(), groupingInfo);
 
 	cout << "Went over " << col_i << " columns" << endl;
 
-	// check coverability
-	for (int col_i = 0; col_i < getCols(); col_i++) {
-		csCol = data->at(col_i);
-		csCol->coverable = checkColumnCoverability(csCol);
+	/* Every column is now enumerated (so its index is fixed) and the rest is done for chunks of
+	BUILD_CHUNK_COLS columns on buildThreads threads. Each column only reads the level matrix and
+	writes itself, and the messages are printed afterwards in column order. */
+	int chunks = (getCols() + BUILD_CHUNK_COLS - 1) / BUILD_CHUNK_COLS;
 
-		if (!csCol->coverable) {
-			cout << "Not coverable: " << getColName(csCol) << endl;
+	parallelFor(chunks, buildThreads, [&](int chunk_i, int thread_i) {
+		for (int col_i = chunk_i * BUILD_CHUNK_COLS; col_i < getCols() && col_i < (chunk_i + 1) * BUILD_CHUNK_COLS; col_i++) {
+			allocateRows(data->at(col_i));
 		}
-	}
+	});
 
-	// perform sqaure roots on sum of squares
-	for (int col_i = 0; col_i < getCols(); col_i++) {
-		sumOfSquares[col_i] = sqrt(sumOfSquares[col_i]);
+	if (cacheFile != "" && loadCache(cacheFile)) {
+		cout << "Loaded CS Matrix from cache " << cacheFile << endl;
+	} else {
+
+		// populate the intercept
+		for (int row_i = 0; row_i < rows; row_i++) {
+			setEntry(data->at(0), row_i, true);
+		}
+
+		// populate the actual column data of CS matrix and check coverability
+		rowIndexValid = false;
+		GroupScratch *threadScratch = new GroupScratch[resolveThreads(buildThreads)];
+		parallelFor(chunks, buildThreads, [&](int chunk_i, int thread_i) {
+			for (int col_i = chunk_i * BUILD_CHUNK_COLS; col_i < getCols() && col_i < (chunk_i + 1) * BUILD_CHUNK_COLS; col_i++) {
+				if (col_i > 0) populateColumnData(data->at(col_i), 0, rows);
+				data->at(col_i)->coverable = checkColumnCoverability(data->at(col_i), &threadScratch[thread_i]);
+			}
+		});
+		delete[] threadScratch;
+
+		if (cacheFile != "") writeCache(cacheFile);
 	}
 
-	// normalize all columns
 	for (int col_i = 0; col_i < getCols(); col_i++) {
-		csCol = data->at(col_i);
-		for (int row_i = 0; row_i < getRows(); row_i++) {
-		//	csCol->data[row_i] = csCol->data[row_i] / sumOfSquares[col_i];
+		if (!data->at(col_i)->coverable) {
+			cout << "Not coverable: " << getColName(data->at(col_i)) << endl;
 		}
-		data->at(col_i) = csCol;
 	}
 
+	buildIndistinguishable(buildThreads);
+
 	cout << "Finished constructing CS Matrix" << endl;
 
 }
 
+double CSMatrix::countColumns(LocatingArray *locatingArray) {
+	int factors = locatingArray->getFactors();
+	int t = locatingArray->getT();
+	GroupingInfo **groupingInfo = locatingArray->getGroupingInfo();
+
+	/* an interaction of 2 or more factors takes a level group (a level if ungrouped) of each,
+	so there are e_k(groups of each factor) k-way interactions (elementary symmetric sums,
+	added up a factor at a time) */
+	double *interactions = new double[t + 1];
+	interactions[0] = 1;
+	for (int t_i = 1; t_i <= t; t_i++) {
+		interactions[t_i] = 0;
+	}
+
+	double mainEffects = 0;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		int levels = groupingInfo[factor_i]->levels;
+		mainEffects += levels;
+
+		int groups = levels;
+		if (groupingInfo[factor_i]->grouped) {
+			groups = 1;
+			for (int level_i = 1; level_i < levels; level_i++) {
+				if (groupingInfo[factor_i]->levelGroups[level_i] != groupingInfo[factor_i]->levelGroups[level_i - 1]) groups++;
+			}
+		}
+
+		for (int t_i = t; t_i >= 1; t_i--) {
+			interactions[t_i] += interactions[t_i - 1] * groups;
+		}
+	}
+
+	// the INTERCEPT and main effects (never grouped)
+	double cols = 1 + (t >= 1 ? mainEffects : 0);
+	for (int t_i = 2; t_i <= t; t_i++) {
+		cols += interactions[t_i];
+	}
+
+	delete[] interactions;
+	return cols;
+}
+
+double CSMatrix::estimateBytes(LocatingArray *locatingArray, bool packed, bool virtualCols) {
+	int rows = locatingArray->getTests();
+	double cols = countColumns(locatingArray);
+
+	double mainEffects = 0;
+	for (int factor_i = 0; factor_i < locatingArray->getFactors(); factor_i++) {
+		mainEffects += locatingArray->getGroupingInfo()[factor_i]->levels;
+	}
+
+	// headers and settings of every column
+	double bytes = cols * (sizeof(CSCol) + sizeof(CSCol*) + locatingArray->getT() * sizeof(FactorSetting));
+
+	// rows of the stored columns
+	double storedCols = (virtualCols ? 1 + mainEffects : cols);
+	bytes += storedCols * rows * sizeof(float);
+	if (packed || virtualCols) bytes += storedCols * ((rows + 63) / 64) * sizeof(uint64_t);
+
+	return bytes;
+}
+
+bool CSMatrix::fitMemory(LocatingArray *locatingArray, bool packed, double memLimit, bool *virtualCols) {
+	if (memLimit <= 0 || estimateBytes(locatingArray, packed, *virtualCols) <= memLimit) return true;
+
+	double virtualBytes = estimateBytes(locatingArray, packed, true);
+	if (*virtualCols) {
+		cout << "CS Matrix would exceed the memory limit (" << virtualBytes / 1048576 <<
+			" MB with virtual columns)" << endl;
+		return false;
+	}
+
+	if (virtualBytes <= memLimit) {
+		cout << "CS Matrix would exceed the memory limit, using virtual columns" << endl;
+		*virtualCols = true;
+		return true;
+	}
+
+	cout << "CS Matrix would exceed the memory limit (" << estimateBytes(locatingArray, packed, false) / 1048576 <<
+		" MB, or " << virtualBytes / 1048576 << " MB with virtual columns)" << endl;
+	return false;
+}
+
+CSMatrix::CSMatrix(CSMatrix *source, int startIndex, Random &random) {
+
+	this->source = source;
+	this->locatingArray = new LocatingArray(source->locatingArray);
+	this->packed = source->packed;
+	this->virtualCols = source->virtualCols;
+	this->threads = 1;
+	this->starts = 1;
+	this->random = random;
+	this->startIndex = startIndex;
+	this->scheduler = source->scheduler;
+	this->cancel = NULL;
+	this->verbose = false;
+	this->rowIndexValid = false;
+	this->colPositions = NULL;
+
+	factorData = source->factorData;
+	groupingInfo = source->groupingInfo;
+	factorLevelMap = source->factorLevelMap;
+	groupCounts = source->groupCounts;
+	groupLevelMap = source->groupLevelMap;
+	groupFirstLevel = source->groupFirstLevel;
+	subtreeCols = source->subtreeCols;
+	interactionStart = source->interactionStart;
+	firstInteraction = source->firstInteraction;
+	indistinguishable = source->indistinguishable;
+
+	rows = source->rows;
+
+	// copy the column data (the settings are shared)
+	data = new vector<CSCol*>;
+	for (int col_i = 0; col_i < source->getCols(); col_i++) {
+		CSCol *csCol = new CSCol(*source->data->at(col_i));
+		if (!isVirtual(csCol)) {
+			csCol->dataP = &csCol->dataVector[0];
+			if (packed) csCol->bitP = &csCol->bitVector[0];
+		}
+		data->push_back(csCol);
+	}
+
+}
+
+/*
+	CS matrix cache file (all integers in native byte order):
+		CSCacheHeader
+		factors of each column (cols bytes)
+		settings of all columns, in column order (FactorSetting each)
+		factor level map (int per factor level, factor by factor)
+		coverable flag of each column (cols bytes)
+		zero padding to a multiple of 8 bytes
+		column data (words 64 bit words per column, row_i in bit (row_i % 64) of word (row_i / 64))
+	The settings and factor level map are compared against the freshly enumerated
+	columns, so a cache that does not belong to this locating array is never used.
+*/
+struct CSCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t rows;
+	uint32_t cols;
+	uint32_t words;
+	uint32_t settings;	// total settings over all columns
+	uint32_t levels;	// entries in the factor level map
+	uint64_t hash;		// LocatingArray::getHash()
+};
+
+static const char csCacheMagic[8] = {'L', 'A', 'C', 'S', 'M', 'A', 'T', '\0'};
+
+bool CSMatrix::loadCache(string cacheFile) {
+	int cols = getCols();
+	int words = (rows + 63) / 64;
+	int factors = locatingArray->getFactors();
+
+	int fd = open(cacheFile.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(CSCacheHeader)) {
+		close(fd);
+		return false;
+	}
+	size_t fileSize = fileStat.st_size;
+
+#ifdef _WIN32
+	char *file = new char[fileSize];
+	bool readOk = (read(fd, file, fileSize) == (ssize_t)fileSize);
+	close(fd);
+	if (!readOk) {
+		delete[] file;
+		return false;
+	}
+#else
+	char *file = (char *)mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) return false;
+#endif
+
+	// count settings and factor levels to check the sizes
+	int settings = 0;
+	for (int col_i = 0; col_i < cols; col_i++) {
+		settings += data->at(col_i)->factors;
+	}
+	int levels = 0;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		levels += groupingInfo[factor_i]->levels;
+	}
+
+	size_t settingsOffset = sizeof(CSCacheHeader) + cols;
+	size_t mapOffset = settingsOffset + settings * sizeof(FactorSetting);
+	size_t coverableOffset = mapOffset + levels * sizeof(int);
+	size_t dataOffset = (coverableOffset + cols + 7) / 8 * 8;
+	size_t expectedSize = dataOffset + (size_t)cols * words * sizeof(uint64_t);
+
+	CSCacheHeader *header = (CSCacheHeader *)file;
+	bool valid = memcmp(header->magic, csCacheMagic, 8) == 0 && header->version == CS_CACHE_VERSION &&
+		header->rows == (uint32_t)rows && header->cols == (uint32_t)cols && header->words == (uint32_t)words &&
+		header->settings == (uint32_t)settings && header->levels == (uint32_t)levels &&
+		header->hash == locatingArray->getHash() && fileSize == expectedSize;
+
+	// verify the column headers and factor level map
+	unsigned char *colFactors = (unsigned char *)(file + sizeof(CSCacheHeader));
+	FactorSetting *setting = (FactorSetting *)(file + settingsOffset);
+	for (int col_i = 0; valid && col_i < cols; col_i++) {
+		CSCol *csCol = data->at(col_i);
+		if (colFactors[col_i] != csCol->factors) valid = false;
+
+		for (int setting_i = 0; valid && setting_i < csCol->factors; setting_i++, setting++) {
+			if (setting->grouped != csCol->setting[setting_i].grouped ||
+				setting->factor_i != csCol->setting[setting_i].factor_i ||
+				setting->index != csCol->setting[setting_i].index ||
+				setting->levelsInGroup != csCol->setting[setting_i].levelsInGroup) valid = false;
+		}
+	}
+	int *levelMap = (int *)(file + mapOffset);
+	for (int factor_i = 0; valid && factor_i < factors; factor_i++) {
+		if (memcmp(levelMap, factorLevelMap[factor_i], sizeof(int) * groupingInfo[factor_i]->levels) != 0) valid = false;
+		levelMap += groupingInfo[factor_i]->levels;
+	}
+
+	if (valid) {
+		unsigned char *coverable = (unsigned char *)(file + coverableOffset);
+		uint64_t *colWords = (uint64_t *)(file + dataOffset);
+
+		rowIndexValid = false;
+		for (int col_i = 0; col_i < cols; col_i++) {
+			CSCol *csCol = data->at(col_i);
+			csCol->coverable = coverable[col_i];
+
+			if (isVirtual(csCol)) {
+				colWords += words;
+				continue;
+			}
+
+			for (int row_i = 0; row_i < rows; row_i++) {
+				csCol->dataP[row_i] = ((colWords[row_i / 64] >> (row_i % 64)) & 1 ? ENTRY_A : ENTRY_B);
+			}
+			if (packed) {
+				memcpy(csCol->bitP, colWords, sizeof(uint64_t) * words);
+			}
+
+			colWords += words;
+		}
+	} else {
+		cout << "CS Matrix cache " << cacheFile << " does not match, rebuilding" << endl;
+	}
+
+#ifdef _WIN32
+	delete[] file;
+#else
+	munmap(file, fileSize);
+#endif
+
+	return valid;
+}
+
+void CSMatrix::writeCache(string cacheFile) {
+	int cols = getCols();
+	int words = (rows + 63) / 64;
+	int factors = locatingArray->getFactors();
+
+	CSCacheHeader header;
+	memcpy(header.magic, csCacheMagic, 8);
+	header.version = CS_CACHE_VERSION;
+	header.rows = rows;
+	header.cols = cols;
+	header.words = words;
+	header.settings = 0;
+	for (int col_i = 0; col_i < cols; col_i++) {
+		header.settings += data->at(col_i)->factors;
+	}
+	header.levels = 0;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		header.levels += groupingInfo[factor_i]->levels;
+	}
+	header.hash = locatingArray->getHash();
+
+	// write to a temporary file and move it into place so readers never see a partial cache
+	string tempFile = cacheFile + ".tmp";
+	ofstream ofs(tempFile.c_str(), ofstream::binary);
+	ofs.write((char *)&header, sizeof(CSCacheHeader));
+
+	for (int col_i = 0; col_i < cols; col_i++) {
+		unsigned char colFactors = data->at(col_i)->factors;
+		ofs.write((char *)&colFactors, 1);
+	}
+	for (int col_i = 0; col_i < cols; col_i++) {
+		ofs.write((char *)data->at(col_i)->setting, sizeof(FactorSetting) * data->at(col_i)->factors);
+	}
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		ofs.write((char *)factorLevelMap[factor_i], sizeof(int) * groupingInfo[factor_i]->levels);
+	}
+	for (int col_i = 0; col_i < cols; col_i++) {
+		unsigned char coverable = data->at(col_i)->coverable;
+		ofs.write((char *)&coverable, 1);
+	}
+	size_t written = sizeof(CSCacheHeader) + cols + header.settings * sizeof(FactorSetting) + header.levels * sizeof(int) + cols;
+	for (; written % 8 != 0; written++) {
+		ofs.put(0);
+	}
+
+	uint64_t *colWords = new uint64_t[words];
+	for (int col_i = 0; col_i < cols; col_i++) {
+		CSCol *csCol = data->at(col_i);
+		for (int word_i = 0; word_i < words; word_i++) {
+			colWords[word_i] = 0;
+		}
+		for (int row_i = 0; row_i < rows; row_i++) {
+			if (getEntry(csCol, row_i)) colWords[row_i / 64] |= ((uint64_t)1 << (row_i % 64));
+		}
+		ofs.write((char *)colWords, sizeof(uint64_t) * words);
+	}
+	delete[] colWords;
+
+	ofs.close();
+	if (!ofs || rename(tempFile.c_str(), cacheFile.c_str()) != 0) {
+		cout << "Could not write CS Matrix cache " << cacheFile << endl;
+		remove(tempFile.c_str());
+	} else {
+		cout << "Wrote CS Matrix cache " << cacheFile << endl;
+	}
+}
+
 void CSMatrix::addRow(CSCol *csCol) {
-	csCol->dataVector.push_back(0);
+	if (isVirtual(csCol)) return;
+
+	csCol->dataVector.push_back(ENTRY_B);
+	csCol->dataP = &csCol->dataVector[0];
+
+	if (packed) {
+		// add a word if the new row does not fit (new rows are always ENTRY_B)
+		if (csCol->dataVector.size() > csCol->bitVector.size() * 64) {
+			csCol->bitVector.push_back(0);
+		}
+		csCol->bitP = &csCol->bitVector[0];
+	}
+}
+
+void CSMatrix::allocateRows(CSCol *csCol) {
+	if (isVirtual(csCol)) return;
+
+	csCol->dataVector.assign(rows, ENTRY_B);
 	csCol->dataP = &csCol->dataVector[0];
+
+	if (packed) {
+		csCol->bitVector.assign((rows + 63) / 64, 0);
+		csCol->bitP = &csCol->bitVector[0];
+	}
 }
 
 void CSMatrix::remRow(CSCol *csCol) {
+	if (isVirtual(csCol)) return;
+
+	int row_i = csCol->dataVector.size() - 1;
+
 	csCol->dataVector.pop_back();
 	csCol->dataP = &csCol->dataVector[0];
+
+	if (packed) {
+		// clear the removed row so that unused bits stay 0, then drop the word if unused
+		csCol->bitP[row_i / 64] &= ~((uint64_t)1 << (row_i % 64));
+		if (csCol->dataVector.size() <= (csCol->bitVector.size() - 1) * 64) {
+			csCol->bitVector.pop_back();
+		}
+		csCol->bitP = &csCol->bitVector[0];
+	}
+}
+
+bool CSMatrix::getEntry(CSCol *csCol, int row_i) {
+	if (packed) {
+		return (getWord(csCol, row_i / 64) >> (row_i % 64)) & 1;
+	} else {
+		return csCol->dataP[row_i] == ENTRY_A;
+	}
+}
+
+void CSMatrix::setEntry(CSCol *csCol, int row_i, bool entryA) {
+	// a virtual column follows its main effects
+	if (isVirtual(csCol)) return;
+
+	csCol->dataP[row_i] = (entryA ? ENTRY_A : ENTRY_B);
+
+	if (packed) {
+		if (entryA) {
+			csCol->bitP[row_i / 64] |= ((uint64_t)1 << (row_i % 64));
+		} else {
+			csCol->bitP[row_i / 64] &= ~((uint64_t)1 << (row_i % 64));
+		}
+	}
+}
+
+// count the rows in which two columns differ
+int CSMatrix::countDifferences(CSCol *csCol1, CSCol *csCol2) {
+	int differences = 0;
+
+	if (packed) {
+		for (int word_i = 0; word_i < getWords(csCol1); word_i++) {
+			differences += __builtin_popcountll(getWord(csCol1, word_i) ^ getWord(csCol2, word_i));
+		}
+	} else {
+		for (int row_i = 0; row_i < rows; row_i++) {
+			if (csCol1->dataP[row_i] != csCol2->dataP[row_i]) differences++;
+		}
+	}
+
+	return differences;
 }
 
+// a level of the interaction enumeration: the loop over the main effects colB_i combined with csColA
+struct InteractionFrame {
+	CSCol *csColA;
+	int colBMax_i;
+	int t;
+	int colB_i;
+	int colCMax_i;
+	CSCol *csCol;			// the column combined in the current iteration (NULL before the 1st)
+	bool colAddedToMatrix;
+};
+
 void CSMatrix::addTWayInteractions(CSCol *csColA, int colBMax_i, int &col_i, int t,
-		Mapping **mapping, vector <float>&sumOfSquares, GroupingInfo **groupingInfo, char **levelMatrix) {
+		GroupingInfo **groupingInfo) {
 
 	CSCol *csCol, *csColB, *csColC;
-	int sum;
 
 	// the offset is 1 for the INTERCEPT
 	int colBOffset = 1;
 
-	int colCMax_i = 0;
+	/* The levels are kept on an explicit stack (at most t deep) instead of recursing. A level
+	combines csColA with each main effect of a lower factor, and the level pushed for each
+	combination does the same for the combined column, t - 1 more times. */
+	vector <InteractionFrame>stack;
+	InteractionFrame first = {csColA, colBMax_i, t, 0, 0, NULL, false};
+	stack.push_back(first);
+
+	while (!stack.empty()) {
+		InteractionFrame &frame = stack.back();
+
+		// finish the combination of the last iteration
+		if (frame.csCol != NULL) {
+			// deallocate the column if not added to CS matrix
+			if (!frame.colAddedToMatrix) {
+				delete[] frame.csCol->setting;
+				delete frame.csCol;
+			}
+			frame.csCol = NULL;
+			frame.colB_i++;
+		}
 
-	// start after INTERCEPT, iterate over all main effects until colBMax_i
-	for (int colB_i = 0; colB_i < colBMax_i; colB_i++) {
+		// iterate over all main effects until colBMax_i
+		if (frame.colB_i >= frame.colBMax_i) {
+			stack.pop_back();
+			continue;
+		}
 
 		// grab pointer to column
-		csColB = data->at(colB_i + colBOffset);
+		csColB = data->at(frame.colB_i + colBOffset);
 
 		// the next 2 lines move colCMax_i to the 1st column with the same factor as csColB
-		csColC = data->at(colCMax_i + colBOffset);
-		if (csColB->setting[0].factor_i > csColC->setting[0].factor_i) colCMax_i = colB_i;
-
-		// set mapping for this column
-		mapping[colB_i] = new Mapping;
-		mapping[colB_i]->mapping = (t > 1 ? new Mapping*[colCMax_i] : NULL);
-		mapping[colB_i]->mappedTo = (csColA->factors > 0 ? col_i : colB_i + colBOffset);
-		Mapping *groupMapping = mapping[colB_i];
+		csColC = data->at(frame.colCMax_i + colBOffset);
+		if (csColB->setting[0].factor_i > csColC->setting[0].factor_i) frame.colCMax_i = frame.colB_i;
 
 		int colsInGroupB = 1;
 		char groupIndexB = -1;
@@ -192,75 +655,59 @@ void CSMatrix::addTWayInteractions(CSCol *csColA, int colBMax_i, int &col_i, int
 				groupingInfo[csColB->setting[0].factor_i]->levelGroups[level_i] == groupIndexB; level_i++) {
 
 				colsInGroupB++;
-				colB_i++;
-
-				// set to group mapping unless main effect (no grouping on main effects)
-				if (csColA->factors > 0) {
-					mapping[colB_i] = groupMapping;
-				} else {
-					mapping[colB_i] = new Mapping;
-					mapping[colB_i]->mapping = groupMapping->mapping;
-					mapping[colB_i]->mappedTo = colB_i + colBOffset;
-				}
+				frame.colB_i++;
 			}
 
-			csColB = data->at(colB_i + colBOffset);
+			csColB = data->at(frame.colB_i + colBOffset);
 		}
 
 		// create new column for CS Matrix
 		csCol = new CSCol;
-		for (int row_i = 0; row_i < rows; row_i++) {
-			addRow(csCol);
-		}
 
 		// set the headers from the combining columns
-		csCol->factors = csColA->factors + 1;
+		csCol->factors = frame.csColA->factors + 1;
 		csCol->setting = new FactorSetting[csCol->factors];
 
 		// copy previous factors
-		for (int setting_i = 0; setting_i < csColA->factors; setting_i++) {
-			csCol->setting[setting_i] = csColA->setting[setting_i];
+		for (int setting_i = 0; setting_i < frame.csColA->factors; setting_i++) {
+			csCol->setting[setting_i] = frame.csColA->setting[setting_i];
 		}
 
 		// assign new setting
-		csCol->setting[csColA->factors].grouped = (groupIndexB != -1);			// is 1st factor grouped
-		csCol->setting[csColA->factors].factor_i = csColB->setting[0].factor_i;	// 1st factor
-		csCol->setting[csColA->factors].index = levelIndexB;					// set level of 1st factor
-		csCol->setting[csColA->factors].levelsInGroup = colsInGroupB;			// set last level if group
-
-		// populate the actual column data of CS matrix
-		sum = populateColumnData(csCol, levelMatrix, 0, rows);
+		csCol->setting[frame.csColA->factors].grouped = (groupIndexB != -1);			// is 1st factor grouped
+		csCol->setting[frame.csColA->factors].factor_i = csColB->setting[0].factor_i;	// 1st factor
+		csCol->setting[frame.csColA->factors].index = levelIndexB;					// set level of 1st factor
+		csCol->setting[frame.csColA->factors].levelsInGroup = colsInGroupB;			// set last level if group
 
-		// add new CS column to matrix if needed
+		// add new CS column to matrix if needed (rows are allocated and populated later)
 		bool colAddedToMatrix = false;
 		if (csCol->factors > 1) {
 			// push into vector
 			data->push_back(csCol);
-			sumOfSquares.push_back(sum);
 
 			col_i++;
 
 			colAddedToMatrix = true;
 		}
 
-		if (t > 1) {
-			// recursive call
-			addTWayInteractions(csCol, colCMax_i, col_i, t - 1,
-				mapping[colB_i]->mapping, sumOfSquares, groupingInfo, levelMatrix);
-		}
+		frame.csCol = csCol;
+		frame.colAddedToMatrix = colAddedToMatrix;
 
-		// deallocate the column if not added to CS matrix
-		if (!colAddedToMatrix) {
-			delete[] csCol->setting;
-			delete csCol;
+		if (frame.t > 1) {
+			// combine the new column with the main effects below colCMax_i (frame is invalid after the push)
+			InteractionFrame next = {csCol, frame.colCMax_i, frame.t - 1, 0, 0, NULL, false};
+			stack.push_back(next);
 		}
 	}
 
 }
 
-int CSMatrix::populateColumnData(CSCol *csCol, char **levelMatrix, int row_top, int row_len) {
+int CSMatrix::populateColumnData(CSCol *csCol, int row_top, int row_len) {
 	int sum = 0;
 
+	// (the callers invalidate the row index, so the columns can be populated on several threads)
+	if (isVirtual(csCol)) return 0;
+
 	// populate every row
 	bool rowData; // start with true, perform AND operation
 	for (int row_i = row_top; row_i < row_top + row_len; row_i++) {
@@ -269,16 +716,16 @@ int CSMatrix::populateColumnData(CSCol *csCol, char **levelMatrix, int row_top,
 
 		for (int setting_i = 0; setting_i < csCol->factors; setting_i++) {
 
-			rowData &= levelMatrix[row_i][csCol->setting[setting_i].factor_i] >=
-				csCol->setting[setting_i].index;
+			char level = locatingArray->getLevel(row_i, csCol->setting[setting_i].factor_i);
 
-			rowData &= levelMatrix[row_i][csCol->setting[setting_i].factor_i] <
-				csCol->setting[setting_i].index + csCol->setting[setting_i].levelsInGroup;
+			rowData &= level >= csCol->setting[setting_i].index;
+
+			rowData &= level < csCol->setting[setting_i].index + csCol->setting[setting_i].levelsInGroup;
 
 		}
 
 		// AND operation
-		csCol->dataP[row_i] = (rowData ? ENTRY_A : ENTRY_B);
+		setEntry(csCol, row_i, rowData);
 
 		// add to sum of squares
 		sum += csCol->dataP[row_i] * csCol->dataP[row_i];
@@ -307,11 +754,7 @@ void CSMatrix::reorderRows(int k, int c) {
 
 	long long int *rowContributions = new long long int[rows];
 
-	Path *path = new Path;
-	path->entryA = NULL;
-	path->entryB = NULL;
-	path->min = coverableMin;
-	path->max = getCols() - 1;
+	Path *path = newPath(coverableMin, getCols() - 1);
 
 	while (true) {
 		nPaths = 0;
@@ -320,7 +763,7 @@ void CSMatrix::reorderRows(int k, int c) {
 
 		score = 0;
 		settingToResample = NULL;
-		pathLAChecker(array, path, path, 0, k, score, settingToResample, rowContributions);
+		parallelPathLAChecker(array, path, k, score, settingToResample, rowContributions);
 		minCountCheck(array, c, score, settingToResample, rowContributions);
 
 		cout << "Score: " << score;
@@ -398,11 +841,7 @@ void CSMatrix::reorderRows(int k, int c, VectorXf ** response) {
 
 	long long int *rowContributions = new long long int[rows];
 
-	Path *path = new Path;
-	path->entryA = NULL;
-	path->entryB = NULL;
-	path->min = coverableMin;
-	path->max = getCols() - 1;
+	Path *path = newPath(coverableMin, getCols() - 1);
 
 	while (true) {
 		nPaths = 0;
@@ -411,7 +850,7 @@ void CSMatrix::reorderRows(int k, int c, VectorXf ** response) {
 
 		score = 0;
 		settingToResample = NULL;
-		pathLAChecker(array, path, path, 0, k, score, settingToResample, rowContributions);
+		parallelPathLAChecker(array, path, k, score, settingToResample, rowContributions);
 		minCountCheck(array, c, score, settingToResample, rowContributions);
 
 		cout << "Score: " << score;
@@ -480,15 +919,36 @@ void CSMatrix::minCountCheck(CSCol **array, int c,
 	for (int col_i = 0; col_i < cols; col_i++) {
 		count[col_i] = 0;
 
-		for (int row_i = 0; row_i < rows && count[col_i] < c; row_i++) {
-			if (array[col_i]->coverable && array[col_i]->dataP[row_i] == ENTRY_A) {
-				count[col_i]++;
-
-				// add row contributions
-				if (rowContributions != NULL) {
+		if (!array[col_i]->coverable) {
+			continue;
+		} else if (packed && rowContributions == NULL) {
+			// only the count is needed
+			count[col_i] = countEntries(array[col_i], c);
+		} else if (packed) {
+			// visit the set bits in row order until c is reached
+			for (int word_i = 0; word_i < getWords(array[col_i]) && count[col_i] < c; word_i++) {
+				uint64_t word = getWord(array[col_i], word_i);
+				while (word != 0 && count[col_i] < c) {
+					int row_i = word_i * 64 + __builtin_ctzll(word);
+					word &= word - 1;
+
+					count[col_i]++;
+
+					// add row contributions
 					rowContributions[row_i]++;
 				}
 			}
+		} else {
+			for (int row_i = 0; row_i < rows && count[col_i] < c; row_i++) {
+				if (array[col_i]->dataP[row_i] == ENTRY_A) {
+					count[col_i]++;
+
+					// add row contributions
+					if (rowContributions != NULL) {
+						rowContributions[row_i]++;
+					}
+				}
+			}
 		}
 	}
 
@@ -498,7 +958,7 @@ void CSMatrix::minCountCheck(CSCol **array, int c,
 			score += c - count[col_i];
 			if (settingToResample == NULL) {
 				// randomly choose a setting in the column to resample
-				settingToResample = &array[col_i]->setting[rand() % array[col_i]->factors];
+				settingToResample = &array[col_i]->setting[random.nextInt(array[col_i]->factors)];
 			}
 		}
 	}
@@ -506,6 +966,93 @@ void CSMatrix::minCountCheck(CSCol **array, int c,
 	delete[] count;
 }
 
+// count the ENTRY_A rows of the column, stopping at c
+int CSMatrix::countEntries(CSCol *csCol, int c) {
+	int count = 0;
+
+	if (packed) {
+		// popcount the words until c is reached
+		for (int word_i = 0; word_i < getWords(csCol) && count < c; word_i++) {
+			count += __builtin_popcountll(getWord(csCol, word_i));
+		}
+		if (count > c) count = c;
+	} else {
+		for (int row_i = 0; row_i < rows && count < c; row_i++) {
+			if (csCol->dataP[row_i] == ENTRY_A) count++;
+		}
+	}
+
+	return count;
+}
+
+// choose a setting to resample the way minCountCheck does, at the 1st column below c in colPositions
+void CSMatrix::chooseMinCountSetting(CSCol **array, FactorSetting *&settingToResample) {
+	if (settingToResample == NULL && !colPositions->belowCPositions.empty()) {
+		CSCol *csCol = array[*colPositions->belowCPositions.begin()];
+
+		// randomly choose a setting in the column to resample
+		settingToResample = &csCol->setting[random.nextInt(csCol->factors)];
+	}
+}
+
+// add the index of every column with a setting of setFactor_i (main effects and interactions) to cols
+void CSMatrix::getFactorColumns(int setFactor_i, vector <int>&cols) {
+	for (int level_i = 0; level_i < groupingInfo[setFactor_i]->levels; level_i++) {
+		cols.push_back(factorLevelMap[setFactor_i][level_i] + 1);
+	}
+
+	int t = locatingArray->getT();
+	if (t < 2) return;
+
+	// the interactions with a 1st factor of setFactor_i are one block
+	for (int col_i = firstInteraction + interactionStart[setFactor_i];
+			col_i < firstInteraction + interactionStart[setFactor_i + 1]; col_i++) {
+		cols.push_back(col_i);
+	}
+
+	// those with a later 1st factor have setFactor_i further on
+	for (int factor_i = setFactor_i + 1; factor_i < locatingArray->getFactors(); factor_i++) {
+		for (int group_i = 0; group_i < groupCounts[factor_i]; group_i++) {
+			getFactorColumns(setFactor_i, factor_i - 1, t - 1,
+				firstInteraction + interactionStart[factor_i] + group_i * subtreeCols[t - 1][factor_i], cols);
+		}
+	}
+}
+
+// the interactions from start that add depth more settings below maxFactor_i, as repopulateColumns visits them
+void CSMatrix::getFactorColumns(int setFactor_i, int maxFactor_i, int depth, int start, vector <int>&cols) {
+	// the ones continuing with setFactor_i (with those extending them) are one block
+	for (int col_i = start + subtreeCols[depth][setFactor_i]; col_i < start + subtreeCols[depth][setFactor_i + 1]; col_i++) {
+		cols.push_back(col_i);
+	}
+	if (depth == 1) return;
+
+	for (int factor_i = setFactor_i + 1; factor_i <= maxFactor_i; factor_i++) {
+		for (int group_i = 0; group_i < groupCounts[factor_i]; group_i++) {
+			int col_i = start + subtreeCols[depth][factor_i] + group_i * (1 + subtreeCols[depth - 1][factor_i]);
+			getFactorColumns(setFactor_i, factor_i - 1, depth - 1, col_i + 1, cols);
+		}
+	}
+}
+
+// add the columns of factor_i to changedCols unless it is already changed
+void CSMatrix::markChangedFactor(int factor_i, bool *factorChanged, bool *colChanged, vector <int>&changedCols) {
+	if (factorChanged[factor_i]) return;
+	factorChanged[factor_i] = true;
+
+	// an interaction of 2 changed factors is kept once
+	size_t listed = changedCols.size();
+	size_t kept = listed;
+	getFactorColumns(factor_i, changedCols);
+	for (size_t changed_i = listed; changed_i < changedCols.size(); changed_i++) {
+		if (!colChanged[changedCols[changed_i]]) {
+			colChanged[changedCols[changed_i]] = true;
+			changedCols[kept++] = changedCols[changed_i];
+		}
+	}
+	changedCols.resize(kept);
+}
+
 void CSMatrix::exactFix() {
 
 	// create a work array
@@ -557,11 +1104,7 @@ void CSMatrix::performCheck(int k, int c) {
 	int tWayMin = sortByTWayInteraction(array, coverableMin, getCols() - 1);
 	cout << "t-way interactions begin at: " << tWayMin << endl;
 
-	Path *path = new Path;
-	path->entryA = NULL;
-	path->entryB = NULL;
-	path->min = coverableMin;
-	path->max = getCols() - 1;
+	Path *path = newPath(coverableMin, getCols() - 1);
 
 	list <Path*>pathList;
 
@@ -584,7 +1127,7 @@ void CSMatrix::performCheck(int k, int c) {
 	// grab initial time
 	current_utc_time( &start);
 	FactorSetting *settingToResample = NULL;
-	pathLAChecker(array, path, path, 0, k, score, settingToResample, NULL);
+	parallelPathLAChecker(array, path, k, score, settingToResample, NULL);
 	minCountCheck(array, c, score, settingToResample, NULL);
 	// check current time
 	current_utc_time( &finish);
@@ -641,14 +1184,23 @@ void CSMatrix::performCheck(int k, int c) {
 	cout << "Elapsed for brute force check: " << elapsedTime << endl;
 
 	cout << "Checking for constraint violations..." << endl;
+	bool **satisfied = new bool*[nConGroups];
+	for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
+		satisfied[conGroup_i] = new bool[rows];
+		conGroups[conGroup_i]->getResults(locatingArray, 0, rows, satisfied[conGroup_i]);
+	}
 	for (int row_i = 0; row_i < rows; row_i++) {
 		for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
-			if (!conGroups[conGroup_i]->getResult(row_i)) {
+			if (!satisfied[conGroup_i][row_i]) {
 				cout << "Constraint group " << conGroup_i << " violated in row " << row_i << endl;
 			}
 		}
 
 	}
+	for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
+		delete[] satisfied[conGroup_i];
+	}
+	delete[] satisfied;
 	cout << "Done!" << endl;
 
 	delete[] array;
@@ -680,12 +1232,8 @@ void CSMatrix::autoFindRows(int k, int c, int startRows) {
 	long long int score;
 	FactorSetting *settingToResample = NULL;
 
-	Path *path = new Path;
-	path->entryA = NULL;
-	path->entryB = NULL;
 //	path->min = twoWayMin;
-	path->min = 0;
-	path->max = getCols() - 1;
+	Path *path = newPath(0, getCols() - 1);
 
 	// add more rows to reach total count
 	resizeArray(array, startRows);
@@ -693,26 +1241,32 @@ void CSMatrix::autoFindRows(int k, int c, int startRows) {
 	// use a binary search to find the correct value
 	while (true) {
 
-		// check if it finds a proper array once in 5 times
 		bool testPassed = false;
-		for (int i = 0; i < 5; i++) {
+		if (starts > 1) {
+			// check if one of the starts finds a proper array
+			testPassed = multiStart(k, c, rows, true, score);
+			cout << "Score: " << score << endl;
+		} else {
+			// check if it finds a proper array once in 5 times
+			for (int i = 0; i < 5; i++) {
 
-			randomizeArray(array);
+				randomizeArray(array);
 
-			list <Path*>pathList;
-			pathList.push_front(path);
+				list <Path*>pathList;
+				pathList.push_front(path);
 
-			score = 0;
-			randomizePaths(array, settingToResample, path, 0, k, c, score, &pathList, iters);
+				score = 0;
+				randomizePaths(array, settingToResample, path, 0, k, c, score, &pathList, iters);
 
-			cout << "Score: " << score << endl;
+				cout << "Score: " << score << endl;
 
-			if (settingToResample == NULL) {
-				testPassed = true;
-				break;
-			} else if (score > 100) {
-				// do not try 5 times because the score is greater than 100
-				break;
+				if (settingToResample == NULL) {
+					testPassed = true;
+					break;
+				} else if (score > 100) {
+					// do not try 5 times because the score is greater than 100
+					break;
+				}
 			}
 		}
 
@@ -745,6 +1299,13 @@ void CSMatrix::autoFindRows(int k, int c, int startRows) {
 
 void CSMatrix::randomFix(int k, int c, int totalRows) {
 
+	if (starts > 1) {
+		long long int score;
+		multiStart(k, c, totalRows, false, score);
+		cout << "Score: " << score << endl;
+		return;
+	}
+
 	int iters = 1000;
 	int cols = getCols();
 
@@ -765,11 +1326,7 @@ void CSMatrix::randomFix(int k, int c, int totalRows) {
 	long long int score;
 	FactorSetting *settingToResample = NULL;
 
-	Path *path = new Path;
-	path->entryA = NULL;
-	path->entryB = NULL;
-	path->min = coverableMin;
-	path->max = getCols() - 1;
+	Path *path = newPath(coverableMin, getCols() - 1);
 
 	// add more rows to reach total count
 	resizeArray(array, totalRows);
@@ -806,11 +1363,7 @@ void CSMatrix::systematicRandomFix(int k, int c, int initialRows, int minChunk)
 	int tWayMin = sortByTWayInteraction(array, coverableMin, cols - 1);
 	cout << "t-way interactions begin at: " << tWayMin << endl;
 
-	Path *path = new Path;
-	path->entryA = NULL;
-	path->entryB = NULL;
-	path->min = coverableMin;
-	path->max = getCols() - 1;
+	Path *path = newPath(coverableMin, getCols() - 1);
 
 	list <Path*>pathList;
 
@@ -828,7 +1381,7 @@ void CSMatrix::systematicRandomFix(int k, int c, int initialRows, int minChunk)
 	current_utc_time( &start);
 
 	FactorSetting *settingToResample = NULL;
-	pathLAChecker(array, path, path, 0, k, score, settingToResample, NULL);
+	parallelPathLAChecker(array, path, k, score, settingToResample, NULL);
 	minCountCheck(array, c, score, settingToResample, NULL);
 
 	// check current time
@@ -855,78 +1408,321 @@ void CSMatrix::systematicRandomFix(int k, int c, int initialRows, int minChunk)
 
 }
 
-void CSMatrix::randomizePaths(CSCol **array, FactorSetting *&settingToResample, Path *path, int row_top, int k, int c, long long int &score, list <Path*>*pathList, int iters) {
+// one randomFix (or autoFindRows, if randomize) restart, returns true if it reached a score of 0
+bool CSMatrix::runStart(int k, int c, int totalRows, bool randomize, long long int &score) {
 
 	int cols = getCols();
-	long long int newScore;
-	int factor_i, nPaths;
-	ConstraintGroup *conGroup;
-	char **levelMatrix = locatingArray->getLevelMatrix();
-	int factors = locatingArray->getFactors();
 
-	// custom factors to resample
-	int nCustomFactors = 0;
-	int *customFactorIndeces = new int[nCustomFactors];
-//	customFactorIndeces[0] = 16;
-//	customFactorIndeces[1] = 17;
+	CSCol **array = new CSCol*[cols];
+	for (int col_i = 0; col_i < cols; col_i++) {
+		array[col_i] = data->at(col_i);
+	}
 
-	// allocate memory for saving old levels of locating array
-	char **oldLevels = new char*[rows];
-	for (int row_i = 0; row_i < rows; row_i++) {
-		oldLevels[row_i] = new char[factors];
+	// autoFindRows checks every column, randomFix only the coverable ones
+	int pathMin = 0;
+	if (!randomize) {
+		pathMin = sortByCoverable(array, 0, cols - 1);
+		sortByTWayInteraction(array, pathMin, cols - 1);
 	}
 
-	// sort paths
+	Path *path = newPath(pathMin, cols - 1);
+
+	resizeArray(array, totalRows);
+	if (randomize) randomizeArray(array);
+
+	list <Path*>pathList;
+	pathList.push_front(path);
+
+	FactorSetting *settingToResample = NULL;
+	score = 0;
+	randomizePaths(array, settingToResample, path, 0, k, c, score, &pathList, 1000);
+
+	deletePath(path);
+	delete[] array;
+
+	return score == 0;
+}
+
+/*
+	Runs starts restarts at once, each on a worker copy of this matrix with its own
+	random stream split off this matrix's generator. A worker that reaches a score of 0
+	cancels the workers with higher start indeces only, so the winner is always the
+	lowest successful start (or the lowest score of all starts if none succeeds) and a
+	run is reproducible from its seed whatever the thread count. The winner is copied
+	back into this matrix. Only the best worker so far is kept, so at most threads + 1
+	copies of the column data exist at a time.
+*/
+bool CSMatrix::multiStart(int k, int c, int totalRows, bool randomize, long long int &score) {
+
+	Random *streams = new Random[starts];
+	random.streams(streams, starts);
+
+	long long int *scores = new long long int[starts];
+	atomic<int> cancelAbove(INT_MAX);
+	mutex bestMutex;
+	CSMatrix *best = NULL;
+	int best_i = -1;
+
+	parallelFor(starts, threads, [&](int start_i, int thread_i) {
+		scores[start_i] = -1;
+		if (cancelAbove.load() < start_i) return;
+
+		CSMatrix *worker = new CSMatrix(this, start_i, streams[start_i]);
+		worker->cancel = &cancelAbove;
+		if (worker->runStart(k, c, totalRows, randomize, scores[start_i])) {
+			int lowest = cancelAbove.load();
+			while (start_i < lowest && !cancelAbove.compare_exchange_weak(lowest, start_i));
+		}
+
+		lock_guard <mutex>lock(bestMutex);
+		if (cancelAbove.load() < start_i) {
+			// cancelled, so its score is not final
+		} else if (best == NULL || scores[start_i] < scores[best_i] ||
+				(scores[start_i] == scores[best_i] && start_i < best_i)) {
+			swap(best, worker);
+			best_i = start_i;
+		}
+		delete worker;
+	});
+
+	// the starts after a successful one may or may not have run
+	for (int start_i = 0; start_i < starts; start_i++) {
+		if (start_i > cancelAbove.load()) {
+			cout << "Start " << start_i << ": cancelled" << endl;
+		} else {
+			cout << "Start " << start_i << ": " << scores[start_i] << endl;
+		}
+	}
+
+	adoptWorker(best);
+	score = scores[best_i];
+	cout << "Best start: " << best_i << endl;
+
+	delete best;
+	delete[] scores;
+	delete[] streams;
+
+	return score == 0;
+}
+
+// take the level matrix and column data of a worker copy of this matrix
+void CSMatrix::adoptWorker(CSMatrix *worker) {
+	locatingArray->copyLevels(worker->locatingArray);
+	rows = worker->rows;
+	rowIndexValid = false;
+
+	for (int col_i = 0; col_i < getCols(); col_i++) {
+		CSCol *csCol = data->at(col_i);
+		CSCol *workerCol = worker->data->at(col_i);
+
+		if (isVirtual(csCol)) continue;
+
+		csCol->dataVector.swap(workerCol->dataVector);
+		csCol->dataP = &csCol->dataVector[0];
+		if (packed) {
+			csCol->bitVector.swap(workerCol->bitVector);
+			csCol->bitP = &csCol->bitVector[0];
+		}
+	}
+}
+
+void CSMatrix::randomizePaths(CSCol **array, FactorSetting *&settingToResample, Path *path, int row_top, int k, int c, long long int &score, list <Path*>*pathList, int iters) {
+
+	int cols = getCols();
+	long long int newScore;
+	int factor_i, nPaths;
+	ConstraintGroup *conGroup;
+	int factors = locatingArray->getFactors();
+	size_t stride = locatingArray->getTestStride();
+	char *levelColumn;
+
+	// custom factors to resample
+	int nCustomFactors = 0;
+	int *customFactorIndeces = new int[nCustomFactors];
+//	customFactorIndeces[0] = 16;
+//	customFactorIndeces[1] = 17;
+
+	// allocate memory for saving old levels of locating array (a column per factor)
+	char *oldLevels = new char[(size_t)factors * rows];
+	char *levelRow = new char[factors];
+
+	// sort paths
 	for (std::list<Path*>::iterator it = pathList->begin(); it != pathList->end(); it++) {
 		nPaths = 0;
 		pathSort(array, *it, row_top, nPaths, NULL);
 	}
 
+	/*
+		A move only changes the columns of the resampled factors, and only in rows row_top
+		on, so the path tree above row_top never changes. The checker is split into the
+		checks that start at row_top, and a move only sorts the paths and rescores the
+		checks (and min counts) that contain a changed column. A rejected move restores
+		their old scores, and its paths are sorted again with the next move.
+	*/
+	PathCheck rootCheck = {path, path, 0, k};
+	vector <PathCheck>checks(1, rootCheck);
+	splitPathChecks(array, checks, row_top, INT_MAX, NULL);
+	int checks_n = checks.size();
+	long long int *checkScores = new long long int[checks_n];
+	long long int *oldCheckScores = new long long int[checks_n];
+	PathCheck *firstLeaves = new PathCheck[checks_n];
+	set <int>scoredChecks;
+
+	// checks rescored by a move
+	vector <PathCheck>changedChecks;
+	vector <int>changedCheckIndeces;
+	long long int *changedScores = new long long int[checks_n];
+	PathCheck *changedLeaves = new PathCheck[checks_n];
+
+	// ENTRY_A count (up to c) of every column by column index
+	int *minCounts = new int[cols];
+	int *oldMinCounts = new int[cols];
+
+	// factors changed since their paths were sorted, and their columns by column index
+	bool *factorChanged = new bool[factors];
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		factorChanged[factor_i] = false;
+	}
+	bool *colChanged = new bool[cols];
+	for (int col_i = 0; col_i < cols; col_i++) {
+		colChanged[col_i] = false;
+	}
+	vector <int>changedCols;
+
+	// pathSort moves the columns from here on
+	ColumnPositions positions(cols);
+	for (int col_i = 0; col_i < cols; col_i++) {
+		positions.indexAt[col_i] = getColIndex(array[col_i]);
+		positions.position[positions.indexAt[col_i]] = col_i;
+	}
+	colPositions = &positions;
+
+	/*
+		Sorting keeps a column within its path at row_top, so the path of pathList
+		and the checks a column is in are found once (the paths at row_top by their
+		first position).
+	*/
+	vector <Path*>listPaths(pathList->begin(), pathList->end());
+	int *listPathOf = new int[cols];
+	int *rangeOf = new int[cols];
+	for (int col_i = 0; col_i < cols; col_i++) {
+		listPathOf[col_i] = -1;
+		rangeOf[col_i] = -1;
+	}
+	for (size_t path_i = 0; path_i < listPaths.size(); path_i++) {
+		for (int col_i = listPaths[path_i]->min; col_i <= listPaths[path_i]->max; col_i++) {
+			listPathOf[positions.indexAt[col_i]] = path_i;
+		}
+	}
+	vector <vector<int> >rangeChecks(cols);
+	for (int check_i = 0; check_i < checks_n; check_i++) {
+		for (int path_i = 0; path_i < 2; path_i++) {
+			Path *checkPath = (path_i == 0 ? checks[check_i].pathA : checks[check_i].pathB);
+			if (path_i == 1 && checkPath == checks[check_i].pathA) continue;
+
+			if (rangeChecks[checkPath->min].empty()) {
+				for (int col_i = checkPath->min; col_i <= checkPath->max; col_i++) {
+					rangeOf[positions.indexAt[col_i]] = checkPath->min;
+				}
+			}
+			rangeChecks[checkPath->min].push_back(check_i);
+		}
+	}
+
+	// marks for collecting the paths, ranges and checks of a move once
+	vector <int>sortPaths;
+	vector <int>changedRanges;
+	bool *pathMarked = new bool[listPaths.size()];
+	for (size_t path_i = 0; path_i < listPaths.size(); path_i++) {
+		pathMarked[path_i] = false;
+	}
+	bool *rangeMarked = new bool[cols];
+	for (int col_i = 0; col_i < cols; col_i++) {
+		rangeMarked[col_i] = false;
+	}
+	bool *checkMarked = new bool[checks_n];
+	for (int check_i = 0; check_i < checks_n; check_i++) {
+		checkMarked[check_i] = false;
+	}
+
 	// run initial checker
 	score = 0;
 	settingToResample = NULL;
-	pathLAChecker(array, path, path, 0, k, score, settingToResample, NULL);
-	minCountCheck(array, c, score, settingToResample, NULL);
-	cout << "Score: " << score << endl;
+	scorePathChecks(array, checks, checkScores, firstLeaves, NULL);
+	for (int check_i = 0; check_i < checks_n; check_i++) {
+		score += checkScores[check_i];
+		if (checkScores[check_i] != 0) scoredChecks.insert(check_i);
+	}
+	chooseSettingFromChecks(array, checks, scoredChecks, firstLeaves, settingToResample);
+	for (int col_i = 0; col_i < cols; col_i++) {
+		minCounts[col_i] = countEntries(data->at(col_i), c);
+		if (data->at(col_i)->coverable) score += c - minCounts[col_i];
+		positions.setBelowC(col_i, data->at(col_i)->coverable && minCounts[col_i] < c);
+	}
+	chooseMinCountSetting(array, settingToResample);
+	if (verbose) cout << "Score: " << score << endl;
+
+	// annealing can end on a worse array than the best one it passed, so keep the best levels
+	char *bestLevels = NULL;
+	long long int bestScore = score;
+	if (scheduler.isAnnealing()) {
+		bestLevels = new char[(size_t)factors * rows];
+		saveLevels(bestLevels, row_top);
+	}
+
+	struct timespec movesStart;
+	struct timespec movesFinish;
+	current_utc_time( &movesStart);
+	scheduler.start(factors, score);
 
 	for (int iter = 0; iter < iters && score > 0; iter++) {
 
+		// a worker with a lower start index already succeeded
+		if (cancel != NULL && cancel->load() < startIndex) break;
+
 		struct timespec start;
 		struct timespec finish;
 		float elapsedTime;
 
 		// ensure we recieved an actual setting
 		if (settingToResample == NULL) {
-			cout << "No resampleable setting was found" << endl;
+			if (verbose) cout << "No resampleable setting was found" << endl;
 			break;
 		}
 
+		// get the factor and rows to resample
+		int moveFactor_i = scheduler.chooseFactor(settingToResample->factor_i, iter, random);
+		int move_top, move_end;
+		int moveType = scheduler.chooseRows(row_top, rows, move_top, move_end, random);
+
 		// get factors to resample (all factors in constraint group if one exists)
-		conGroup = groupingInfo[settingToResample->factor_i]->conGroup;
+		conGroup = groupingInfo[moveFactor_i]->conGroup;
 		if (conGroup == NULL) {
 			// get factor to resample
-			factor_i = settingToResample->factor_i;
+			factor_i = moveFactor_i;
 
 			// resample locating array
-			for (int row_i = row_top; row_i < rows; row_i++) {
-				oldLevels[row_i][factor_i] = levelMatrix[row_i][factor_i];
-				if (rand() % 100 < 100) {
-					levelMatrix[row_i][factor_i] = rand() % groupingInfo[factor_i]->levels;
+			levelColumn = locatingArray->getFactorColumn(factor_i);
+			for (int row_i = move_top; row_i < move_end; row_i++) {
+				oldLevels[factor_i * rows + row_i] = levelColumn[row_i * stride];
+				if (random.nextInt(100) < 100) {
+					levelColumn[row_i * stride] = random.nextInt(groupingInfo[factor_i]->levels);
 				}
 			}
 
 			// repopulate columns of CS matrix
 			for (int level_i = 0; level_i < groupingInfo[factor_i]->levels; level_i++) {
-				repopulateColumns(factor_i, level_i, row_top, rows - row_top);
+				repopulateColumns(factor_i, level_i, move_top, move_end - move_top);
 			}
+			markChangedFactor(factor_i, factorChanged, colChanged, changedCols);
 		} else if (nCustomFactors > 0) {
-			for (int row_i = row_top; row_i < rows; row_i++) {
+			for (int row_i = move_top; row_i < move_end; row_i++) {
 				for (int factor_i = 0; factor_i < nCustomFactors; factor_i++) {
-					oldLevels[row_i][customFactorIndeces[factor_i]] = levelMatrix[row_i][customFactorIndeces[factor_i]];
+					oldLevels[customFactorIndeces[factor_i] * rows + row_i] = locatingArray->getLevel(row_i, customFactorIndeces[factor_i]);
 				}
-				if (rand() % 100 < 100) {
+				if (random.nextInt(100) < 100) {
 					for (int factor_i = 0; factor_i < nCustomFactors; factor_i++) {
-						levelMatrix[row_i][customFactorIndeces[factor_i]] = rand() % groupingInfo[customFactorIndeces[factor_i]]->levels;
+						locatingArray->setLevel(row_i, customFactorIndeces[factor_i], random.nextInt(groupingInfo[customFactorIndeces[factor_i]]->levels));
 					}
 				}
 			}
@@ -934,34 +1730,49 @@ void CSMatrix::randomizePaths(CSCol **array, FactorSetting *&settingToResample,
 			// repopulate columns of CS matrix for every factor in constraint group and for each level
 			for (int factor_i = 0; factor_i < nCustomFactors; factor_i++) {
 				for (int level_i = 0; level_i < groupingInfo[customFactorIndeces[factor_i]]->levels; level_i++) {
-					repopulateColumns(customFactorIndeces[factor_i], level_i, row_top, rows - row_top);
+					repopulateColumns(customFactorIndeces[factor_i], level_i, move_top, move_end - move_top);
 				}
+				markChangedFactor(customFactorIndeces[factor_i], factorChanged, colChanged, changedCols);
 			}
 		} else {
-			for (int row_i = row_top; row_i < rows; row_i++) {
+			for (int row_i = move_top; row_i < move_end; row_i++) {
 				for (int factor_i = 0; factor_i < conGroup->factors; factor_i++) {
-					oldLevels[row_i][conGroup->factorIndeces[factor_i]] = levelMatrix[row_i][conGroup->factorIndeces[factor_i]];
+					oldLevels[conGroup->factorIndeces[factor_i] * rows + row_i] = locatingArray->getLevel(row_i, conGroup->factorIndeces[factor_i]);
 				}
-				if (rand() % 100 < 100) {
-					conGroup->randPopulateLevelRow(levelMatrix[row_i]);
+				if (random.nextInt(100) < 100) {
+					conGroup->randPopulateLevelRow(levelRow, random, &groupScratch);
+					for (int factor_i = 0; factor_i < conGroup->factors; factor_i++) {
+						locatingArray->setLevel(row_i, conGroup->factorIndeces[factor_i], levelRow[conGroup->factorIndeces[factor_i]]);
+					}
 				}
 			}
 
 			// repopulate columns of CS matrix for every factor in constraint group and for each level
 			for (int factor_i = 0; factor_i < conGroup->factors; factor_i++) {
 				for (int level_i = 0; level_i < groupingInfo[conGroup->factorIndeces[factor_i]]->levels; level_i++) {
-					repopulateColumns(conGroup->factorIndeces[factor_i], level_i, row_top, rows - row_top);
+					repopulateColumns(conGroup->factorIndeces[factor_i], level_i, move_top, move_end - move_top);
 				}
+				markChangedFactor(conGroup->factorIndeces[factor_i], factorChanged, colChanged, changedCols);
 			}
 		}
 
 
 		// grab initial time
 		current_utc_time( &start);
-		// sort paths and recheck score
-		for (std::list<Path*>::iterator it = pathList->begin(); it != pathList->end(); it++) {
+		// sort the paths with columns changed since they were sorted (in list order)
+		sortPaths.clear();
+		for (size_t changed_i = 0; changed_i < changedCols.size(); changed_i++) {
+			int path_i = listPathOf[changedCols[changed_i]];
+			if (path_i != -1 && !pathMarked[path_i]) {
+				pathMarked[path_i] = true;
+				sortPaths.push_back(path_i);
+			}
+		}
+		sort(sortPaths.begin(), sortPaths.end());
+		for (size_t sort_i = 0; sort_i < sortPaths.size(); sort_i++) {
+			pathMarked[sortPaths[sort_i]] = false;
 			nPaths = 0;
-			pathSort(array, *it, row_top, nPaths, NULL);
+			pathSort(array, listPaths[sortPaths[sort_i]], row_top, nPaths, NULL);
 		}
 		// check current time
 		current_utc_time( &finish);
@@ -971,13 +1782,61 @@ void CSMatrix::randomizePaths(CSCol **array, FactorSetting *&settingToResample,
 		elapsedTime += (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
 //		cout << "Elapsed After Sort: " << elapsedTime << endl;
 
-		newScore = 0;
+		newScore = score;
 		FactorSetting *newSettingToResample = NULL;
 
 		// grab initial time
 		current_utc_time( &start);
-		pathLAChecker(array, path, path, 0, k, newScore, newSettingToResample, NULL);
-		minCountCheck(array, c, newScore, newSettingToResample, NULL);
+		// rescore the checks with changed columns (in order)
+		changedRanges.clear();
+		changedCheckIndeces.clear();
+		for (size_t changed_i = 0; changed_i < changedCols.size(); changed_i++) {
+			int range = rangeOf[changedCols[changed_i]];
+			if (range == -1 || rangeMarked[range]) continue;
+			rangeMarked[range] = true;
+			changedRanges.push_back(range);
+
+			for (size_t range_i = 0; range_i < rangeChecks[range].size(); range_i++) {
+				int check_i = rangeChecks[range][range_i];
+				if (!checkMarked[check_i]) {
+					checkMarked[check_i] = true;
+					changedCheckIndeces.push_back(check_i);
+				}
+			}
+		}
+		for (size_t range_i = 0; range_i < changedRanges.size(); range_i++) {
+			rangeMarked[changedRanges[range_i]] = false;
+		}
+		sort(changedCheckIndeces.begin(), changedCheckIndeces.end());
+		changedChecks.clear();
+		for (size_t changed_i = 0; changed_i < changedCheckIndeces.size(); changed_i++) {
+			checkMarked[changedCheckIndeces[changed_i]] = false;
+			changedChecks.push_back(checks[changedCheckIndeces[changed_i]]);
+		}
+		scorePathChecks(array, changedChecks, changedScores, changedLeaves, NULL);
+		for (size_t changed_i = 0; changed_i < changedChecks.size(); changed_i++) {
+			int check_i = changedCheckIndeces[changed_i];
+			oldCheckScores[check_i] = checkScores[check_i];
+			newScore += changedScores[changed_i] - checkScores[check_i];
+			checkScores[check_i] = changedScores[changed_i];
+			firstLeaves[check_i] = changedLeaves[changed_i];
+			if (checkScores[check_i] != 0) {
+				scoredChecks.insert(check_i);
+			} else {
+				scoredChecks.erase(check_i);
+			}
+		}
+		chooseSettingFromChecks(array, checks, scoredChecks, firstLeaves, newSettingToResample);
+
+		// recount the changed columns
+		for (size_t changed_i = 0; changed_i < changedCols.size(); changed_i++) {
+			int index = changedCols[changed_i];
+			oldMinCounts[index] = minCounts[index];
+			minCounts[index] = countEntries(data->at(index), c);
+			if (data->at(index)->coverable) newScore += oldMinCounts[index] - minCounts[index];
+			positions.setBelowC(index, data->at(index)->coverable && minCounts[index] < c);
+		}
+		chooseMinCountSetting(array, newSettingToResample);
 		// check current time
 		current_utc_time( &finish);
 		// get elapsed seconds
@@ -986,66 +1845,131 @@ void CSMatrix::randomizePaths(CSCol **array, FactorSetting *&settingToResample,
 		elapsedTime += (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
 //		cout << "Elapsed After Checker: " << elapsedTime << endl;
 
-		if (newScore <= score) { // add "|| true" to cause every change to be implemented, not just improving changes
-			cout << "Rows: " << rows << " Iter: " << iter << ": ";
-			cout << newScore << ": \t" << score << " \tAccepted " << endl;
+		bool accepted = scheduler.accept(newScore, score, random);
+		scheduler.record(iter, moveType, moveFactor_i, accepted, newScore > score, accepted ? newScore : score);
+		if (accepted) {
+			if (verbose) {
+				cout << "Rows: " << rows << " Iter: " << iter << ": ";
+				cout << newScore << ": \t" << score << " \tAccepted " << endl;
+			}
 			settingToResample = newSettingToResample;
 			score = newScore;
+
+			if (bestLevels != NULL && score < bestScore) {
+				bestScore = score;
+				saveLevels(bestLevels, row_top);
+			}
+
+			// the changed paths are sorted for the new levels
+			for (int factor_i = 0; factor_i < factors; factor_i++) {
+				factorChanged[factor_i] = false;
+			}
+			for (size_t changed_i = 0; changed_i < changedCols.size(); changed_i++) {
+				colChanged[changedCols[changed_i]] = false;
+			}
+			changedCols.clear();
 		} else {
-			cout << "Rows: " << rows << " Iter: " << iter << ": ";
-			cout << score << " \tMaintained " << endl;
+			if (verbose) {
+				cout << "Rows: " << rows << " Iter: " << iter << ": ";
+				cout << score << " \tMaintained " << endl;
+			}
 
 			if (conGroup == NULL) {
 				// get factor to resample
-				factor_i = settingToResample->factor_i;
+				factor_i = moveFactor_i;
 
 				// rollback the change
-				for (int row_i = row_top; row_i < rows; row_i++) {
-					levelMatrix[row_i][factor_i] = oldLevels[row_i][factor_i];
+				levelColumn = locatingArray->getFactorColumn(factor_i);
+				for (int row_i = move_top; row_i < move_end; row_i++) {
+					levelColumn[row_i * stride] = oldLevels[factor_i * rows + row_i];
 				}
 
 				// repopulate columns of CS matrix
 				for (int level_i = 0; level_i < groupingInfo[factor_i]->levels; level_i++) {
-					repopulateColumns(factor_i, level_i, row_top, rows - row_top);
+					repopulateColumns(factor_i, level_i, move_top, move_end - move_top);
 				}
 			} else if (nCustomFactors > 0) {
-				for (int row_i = row_top; row_i < rows; row_i++) {
+				for (int row_i = move_top; row_i < move_end; row_i++) {
 					for (int factor_i = 0; factor_i < nCustomFactors; factor_i++) {
-						levelMatrix[row_i][customFactorIndeces[factor_i]] = oldLevels[row_i][customFactorIndeces[factor_i]];
+						locatingArray->setLevel(row_i, customFactorIndeces[factor_i], oldLevels[customFactorIndeces[factor_i] * rows + row_i]);
 					}
 				}
 
 				// repopulate columns of CS matrix for every factor in constraint group and for each level
 				for (int factor_i = 0; factor_i < nCustomFactors; factor_i++) {
 					for (int level_i = 0; level_i < groupingInfo[customFactorIndeces[factor_i]]->levels; level_i++) {
-						repopulateColumns(customFactorIndeces[factor_i], level_i, row_top, rows - row_top);
+						repopulateColumns(customFactorIndeces[factor_i], level_i, move_top, move_end - move_top);
 					}
 				}
 			} else {
 				// rollback the change
-				for (int row_i = row_top; row_i < rows; row_i++) {
+				for (int row_i = move_top; row_i < move_end; row_i++) {
 					for (int factor_i = 0; factor_i < conGroup->factors; factor_i++) {
-						levelMatrix[row_i][conGroup->factorIndeces[factor_i]] = oldLevels[row_i][conGroup->factorIndeces[factor_i]];
+						locatingArray->setLevel(row_i, conGroup->factorIndeces[factor_i], oldLevels[conGroup->factorIndeces[factor_i] * rows + row_i]);
 					}
 				}
 
 				// repopulate columns of CS matrix for every factor in constraint group and for each level
 				for (int factor_i = 0; factor_i < conGroup->factors; factor_i++) {
 					for (int level_i = 0; level_i < groupingInfo[conGroup->factorIndeces[factor_i]]->levels; level_i++) {
-						repopulateColumns(conGroup->factorIndeces[factor_i], level_i, row_top, rows - row_top);
+						repopulateColumns(conGroup->factorIndeces[factor_i], level_i, move_top, move_end - move_top);
 					}
 				}
 			}
+
+			// rollback the score (the changed paths stay marked and are sorted with the next move)
+			for (size_t changed_i = 0; changed_i < changedChecks.size(); changed_i++) {
+				int check_i = changedCheckIndeces[changed_i];
+				checkScores[check_i] = oldCheckScores[check_i];
+				if (checkScores[check_i] != 0) {
+					scoredChecks.insert(check_i);
+				} else {
+					scoredChecks.erase(check_i);
+				}
+			}
+			for (size_t changed_i = 0; changed_i < changedCols.size(); changed_i++) {
+				int index = changedCols[changed_i];
+				minCounts[index] = oldMinCounts[index];
+				positions.setBelowC(index, data->at(index)->coverable && minCounts[index] < c);
+			}
 //			cout << score << ": \t" << newScore << " \tRejected" << endl;
 		}
 	}
 
-	// deallocate all memory
-	for (int row_i = 0; row_i < rows; row_i++) {
-		delete[] oldLevels[row_i];
+	current_utc_time( &movesFinish);
+	scheduler.finish((movesFinish.tv_sec - movesStart.tv_sec) + (movesFinish.tv_nsec - movesStart.tv_nsec) / 1000000000.0);
+	if (verbose) scheduler.printStatistics();
+
+	if (bestLevels != NULL) {
+		if (bestScore < score) {
+			restoreLevels(bestLevels, row_top);
+			rowIndexValid = false;
+			for (int col_i = 0; col_i < cols; col_i++) {
+				populateColumnData(data->at(col_i), row_top, rows - row_top);
+			}
+		}
+		delete[] bestLevels;
 	}
+
+	// deallocate all memory
 	delete[] oldLevels;
+	delete[] levelRow;
 	delete[] customFactorIndeces;
+	delete[] checkScores;
+	delete[] oldCheckScores;
+	delete[] firstLeaves;
+	delete[] changedScores;
+	delete[] changedLeaves;
+	delete[] minCounts;
+	delete[] oldMinCounts;
+	delete[] factorChanged;
+	delete[] colChanged;
+	delete[] listPathOf;
+	delete[] rangeOf;
+	delete[] pathMarked;
+	delete[] rangeMarked;
+	delete[] checkMarked;
+	colPositions = NULL;
 
 	// perform one last sort and save final unfinished paths to list
 	list <Path*>newPathList(*pathList);
@@ -1058,11 +1982,32 @@ void CSMatrix::randomizePaths(CSCol **array, FactorSetting *&settingToResample,
 	}
 	score = 0;
 	settingToResample = NULL;
-	pathLAChecker(array, path, path, 0, k, score, settingToResample, NULL);
+	parallelPathLAChecker(array, path, k, score, settingToResample, NULL);
 	minCountCheck(array, c, score, settingToResample, NULL);
 
 }
 
+// copy the levels of rows row_top on into levels (rows levels per factor)
+void CSMatrix::saveLevels(char *levels, int row_top) {
+	size_t stride = locatingArray->getTestStride();
+	for (int factor_i = 0; factor_i < locatingArray->getFactors(); factor_i++) {
+		char *levelColumn = locatingArray->getFactorColumn(factor_i);
+		for (int row_i = row_top; row_i < rows; row_i++) {
+			levels[(size_t)factor_i * rows + row_i] = levelColumn[row_i * stride];
+		}
+	}
+}
+
+void CSMatrix::restoreLevels(char *levels, int row_top) {
+	size_t stride = locatingArray->getTestStride();
+	for (int factor_i = 0; factor_i < locatingArray->getFactors(); factor_i++) {
+		char *levelColumn = locatingArray->getFactorColumn(factor_i);
+		for (int row_i = row_top; row_i < rows; row_i++) {
+			levelColumn[row_i * stride] = levels[(size_t)factor_i * rows + row_i];
+		}
+	}
+}
+
 // LEGACY
 void CSMatrix::randomizeRows(CSCol **backupArray, CSCol **array, long long int &csScore, int row_top, int row_len) {
 	int cols = getCols();
@@ -1071,7 +2016,8 @@ void CSMatrix::randomizeRows(CSCol **backupArray, CSCol **array, long long int &
 
 	FactorSetting *settingToResample = NULL;
 
-	char **levelMatrix = locatingArray->getLevelMatrix();
+	size_t stride = locatingArray->getTestStride();
+	char *levelColumn;
 
 	char *oldLevels = new char[rows];
 
@@ -1095,7 +2041,7 @@ void CSMatrix::randomizeRows(CSCol **backupArray, CSCol **array, long long int &
 				while (iter < 1000) {
 					iter++;
 
-					resampleFactor = rand() % (array[col_i]->factors + array[col_i + 1]->factors);
+					resampleFactor = random.nextInt(array[col_i]->factors + array[col_i + 1]->factors);
 
 					if (resampleFactor < array[col_i]->factors) {
 						factor_i = array[col_i]->setting[resampleFactor].factor_i;
@@ -1103,10 +2049,11 @@ void CSMatrix::randomizeRows(CSCol **backupArray, CSCol **array, long long int &
 						factor_i = array[col_i + 1]->setting[resampleFactor - array[col_i]->factors].factor_i;
 					}
 
+					levelColumn = locatingArray->getFactorColumn(factor_i);
 					for (int row_i = row_top; row_i < row_top + row_len; row_i++) {
-						oldLevels[row_i] = levelMatrix[row_i][factor_i];
-						if (rand() % 100 < 100) {
-							levelMatrix[row_i][factor_i] = rand() % groupingInfo[factor_i]->levels;
+						oldLevels[row_i] = levelColumn[row_i * stride];
+						if (random.nextInt(100) < 100) {
+							levelColumn[row_i * stride] = random.nextInt(groupingInfo[factor_i]->levels);
 						}
 					}
 
@@ -1119,14 +2066,14 @@ void CSMatrix::randomizeRows(CSCol **backupArray, CSCol **array, long long int &
 
 					float likelihood = 10 / pow((double)newCsScore / (double)csScore, 10);
 					cout << "Rows: " << rows << " Iter: " << iter << ": ";
-					if (newCsScore <= csScore) {// || rand() % 100 < likelihood) {
+					if (newCsScore <= csScore) {// || random.nextInt(100) < likelihood) {
 						cout << newCsScore << ": \t" << csScore << " \tAccepted " << likelihood << "%" << endl;
 						csScore = newCsScore;
 						break;
 					} else {
 						// rollback the change
 						for (int row_i = row_top; row_i < row_top + row_len; row_i++) {
-							levelMatrix[row_i][factor_i] = oldLevels[row_i];
+							levelColumn[row_i * stride] = oldLevels[row_i];
 						}
 
 						for (int level_i = 0; level_i < groupingInfo[factor_i]->levels; level_i++) {
@@ -1154,46 +2101,54 @@ void CSMatrix::randomizeRows(CSCol **backupArray, CSCol **array, long long int &
 
 void CSMatrix::repopulateColumns(int setFactor_i, int setLevel_i, int row_top, int row_len) {
 
-	int lastCol_i = -1;
-	repopulateColumns(setFactor_i, setLevel_i, locatingArray->getFactors() - 1, locatingArray->getT(),
-		mapping, locatingArray->getLevelMatrix(), lastCol_i, row_top, row_len);
-}
+	// column data changes so the row index must be rebuilt
+	rowIndexValid = false;
+
+	// the main effect
+	populateColumnData(data->at(factorLevelMap[setFactor_i][setLevel_i] + 1), row_top, row_len);
 
-void CSMatrix::repopulateColumns(int setFactor_i, int setLevel_i, int maxFactor_i, int t,
-		Mapping *mapping, char **levelMatrix, int &lastCol_i, int row_top, int row_len) {
+	// virtual columns follow the main effects
+	int t = (virtualCols ? 1 : locatingArray->getT());
+	if (t < 2) return;
 
-	if (setFactor_i > maxFactor_i && mapping->mappedTo != lastCol_i) {
-		populateColumnData(data->at(mapping->mappedTo), levelMatrix, row_top, row_len);
+	// the interactions with the group of setLevel_i, by their 1st factor
+	int setGroup_i = groupLevelMap[setFactor_i][setLevel_i];
+	for (int factor_i = setFactor_i; factor_i < locatingArray->getFactors(); factor_i++) {
+		int minGroup_i = (factor_i == setFactor_i ? setGroup_i : 0);
+		int maxGroup_i = (factor_i == setFactor_i ? setGroup_i : groupCounts[factor_i] - 1);
 
-		lastCol_i = mapping->mappedTo;
+		for (int group_i = minGroup_i; group_i <= maxGroup_i; group_i++) {
+			repopulateColumns(setFactor_i, setGroup_i, factor_i - 1, t - 1,
+				firstInteraction + interactionStart[factor_i] + group_i * subtreeCols[t - 1][factor_i],
+				factor_i == setFactor_i, row_top, row_len);
+		}
 	}
+}
 
-	if (t == 0) return;
+void CSMatrix::repopulateColumns(int setFactor_i, int setGroup_i, int maxFactor_i, int depth, int start, bool set,
+		int row_top, int row_len) {
 
-	int minFactor_i;
-	int minLevel_i, maxLevel_i;
+	// until setFactor_i is in the interaction, only factors that leave room for it
+	int minFactor_i = (set ? 0 : setFactor_i);
+	if (!set && depth == 1) maxFactor_i = setFactor_i;
 
-	if (setFactor_i > maxFactor_i) {
-		minFactor_i = t - 1;
-	} else {
-		minFactor_i = setFactor_i;
+	for (int factor_i = minFactor_i; factor_i <= maxFactor_i; factor_i++) {
+		int minGroup_i = (factor_i == setFactor_i ? setGroup_i : 0);
+		int maxGroup_i = (factor_i == setFactor_i ? setGroup_i : groupCounts[factor_i] - 1);
 
-		// if this is the last interaction, make sure setFactor shows up
-		if (t == 1) maxFactor_i = minFactor_i;
-	}
+		for (int group_i = minGroup_i; group_i <= maxGroup_i; group_i++) {
+			int col_i = start + subtreeCols[depth][factor_i] + group_i * (1 + subtreeCols[depth - 1][factor_i]);
 
-	for (int factor_i = minFactor_i; factor_i <= maxFactor_i; factor_i++) {
+			if (set || factor_i == setFactor_i) {
+				populateColumnData(data->at(col_i), row_top, row_len);
+			}
 
-		if (factor_i == setFactor_i) {
-			repopulateColumns(setFactor_i, setLevel_i, factor_i - 1, t - 1,
-				mapping->mapping[factorLevelMap[factor_i][setLevel_i]], levelMatrix, lastCol_i, row_top, row_len);
-		} else {
-			for (int level_i = 0; level_i < groupingInfo[factor_i]->levels; level_i++) {
-				repopulateColumns(setFactor_i, setLevel_i, factor_i - 1, t - 1,
-					mapping->mapping[factorLevelMap[factor_i][level_i]], levelMatrix, lastCol_i, row_top, row_len);
+			// the interactions that extend this one begin right after it
+			if (depth > 1) {
+				repopulateColumns(setFactor_i, setGroup_i, factor_i - 1, depth - 1, col_i + 1,
+					set || factor_i == setFactor_i, row_top, row_len);
 			}
 		}
-
 	}
 }
 
@@ -1205,19 +2160,47 @@ int CSMatrix::getCols() {
 	return data->size();
 }
 
+void CSMatrix::setThreads(int threads) {
+	this->threads = threads;
+}
+
+void CSMatrix::setStarts(int starts) {
+	this->starts = starts;
+}
+
+void CSMatrix::setSeed(uint64_t seed) {
+	random.seed(seed);
+}
+
+MoveScheduler *CSMatrix::getMoveScheduler() {
+	return &scheduler;
+}
+
 CSCol *CSMatrix::getCol(int col_i) {
 	return data->at(col_i);
 }
 
+float *CSMatrix::getColData(int col_i, float *scratch) {
+	CSCol *csCol = data->at(col_i);
+	if (!isVirtual(csCol)) return csCol->dataP;
+
+	for (int row_i = 0; row_i < rows; row_i++) {
+		scratch[row_i] = (getEntry(csCol, row_i) ? ENTRY_A : ENTRY_B);
+	}
+	return scratch;
+}
+
 float CSMatrix::getDistanceToCol(int col_i, float *residuals) {
 	float distanceSum = 0, subtractionResult = 0;
-	CSCol *csCol = data->at(col_i);
+	float *scratch = (isVirtual(data->at(col_i)) ? new float[rows] : NULL);
+	float *colData = getColData(col_i, scratch);
 
 	for (int row_i = 0; row_i < rows; row_i++) {
-		subtractionResult = csCol->dataP[row_i] - residuals[row_i];
+		subtractionResult = colData[row_i] - residuals[row_i];
 		distanceSum += subtractionResult * subtractionResult;
 	}
 
+	delete[] scratch;
 	return distanceSum;
 }
 
@@ -1225,13 +2208,154 @@ float CSMatrix::getProductWithCol(int col_i, float *residuals) {
 	float dotSum = 0;
 	CSCol *csCol = data->at(col_i);
 
-	for (int row_i = 0; row_i < rows; row_i++) {
-		dotSum += csCol->dataP[row_i] * residuals[row_i];
+	int rows_n;
+	int *colRows = getColRows(col_i, rows_n);
+
+	if (colRows != NULL) {
+		// gather the residuals of the ENTRY_A rows
+		for (int entry_i = 0; entry_i < rows_n; entry_i++) {
+			dotSum += residuals[colRows[entry_i]];
+		}
+	} else if (packed) {
+		// entries are 0 or 1, so only add the residuals of ENTRY_A rows (in row order)
+		for (int word_i = 0; word_i < getWords(csCol); word_i++) {
+			uint64_t word = getWord(csCol, word_i);
+			while (word != 0) {
+				dotSum += residuals[word_i * 64 + __builtin_ctzll(word)];
+				word &= word - 1;
+			}
+		}
+	} else {
+		for (int row_i = 0; row_i < rows; row_i++) {
+			dotSum += csCol->dataP[row_i] * residuals[row_i];
+		}
 	}
 
 	return abs(dotSum);
 }
 
+void CSMatrix::buildRowIndex() {
+	int cols = getCols();
+
+	// count the ENTRY_A entries of every row and column
+	rowIndexStart.assign(rows + 1, 0);
+	colIndexStart.assign(cols + 1, 0);
+	colSparse.assign(cols, false);
+	for (int col_i = 0; col_i < cols; col_i++) {
+		CSCol *csCol = data->at(col_i);
+		int entries = 0;
+		for (int row_i = 0; row_i < rows; row_i++) {
+			if (getEntry(csCol, row_i)) {
+				rowIndexStart[row_i + 1]++;
+				entries++;
+			}
+		}
+
+		// only the sparse columns list their rows
+		colSparse[col_i] = (entries <= SPARSE_MAX_DENSITY * rows);
+		colIndexStart[col_i + 1] = colIndexStart[col_i] + (colSparse[col_i] ? entries : 0);
+	}
+	for (int row_i = 0; row_i < rows; row_i++) {
+		rowIndexStart[row_i + 1] += rowIndexStart[row_i];
+	}
+
+	// fill in the column and row indices (columns are visited in order so each row is sorted)
+	vector <int>rowFill(rowIndexStart.begin(), rowIndexStart.end() - 1);
+	rowIndexCols.resize(rowIndexStart[rows]);
+	colIndexRows.resize(colIndexStart[cols]);
+	for (int col_i = 0; col_i < cols; col_i++) {
+		CSCol *csCol = data->at(col_i);
+		int colFill = colIndexStart[col_i];
+		for (int row_i = 0; row_i < rows; row_i++) {
+			if (getEntry(csCol, row_i)) {
+				rowIndexCols[rowFill[row_i]++] = col_i;
+				if (colSparse[col_i]) colIndexRows[colFill++] = row_i;
+			}
+		}
+	}
+
+	rowIndexValid = true;
+}
+
+void CSMatrix::buildIndex() {
+	if (!rowIndexValid) buildRowIndex();
+}
+
+int *CSMatrix::getColRows(int col_i, int &rows_n) {
+	if (!rowIndexValid || !colSparse[col_i]) return NULL;
+
+	rows_n = colIndexStart[col_i + 1] - colIndexStart[col_i];
+	return colIndexRows.data() + colIndexStart[col_i];
+}
+
+/* Computes the absolute dot product of every column with every residual vector,
+so products[res_i][col_i] = getProductWithCol(col_i, residuals[res_i]). Instead of
+walking the columns once per residual vector, the row index is streamed once
+for all residual vectors, one block of columns at a time so the accumulators stay
+in cache. Every row adds its residuals (contiguous across residual vectors) to the
+accumulators of its ENTRY_A columns. Rows are added in order so the sums match
+getProductWithCol exactly.
+*/
+void CSMatrix::getProductsWithCols(int residuals_n, float **residuals, float **products) {
+	int cols = getCols();
+
+	if (residuals_n <= 0) return;
+
+	if (!rowIndexValid) buildRowIndex();
+
+	// transpose the residuals so each row holds the residuals of all vectors
+	float *rowResiduals = new float[rows * residuals_n];
+	for (int row_i = 0; row_i < rows; row_i++) {
+		for (int res_i = 0; res_i < residuals_n; res_i++) {
+			rowResiduals[row_i * residuals_n + res_i] = residuals[res_i][row_i];
+		}
+	}
+
+	// columns per block so the block accumulators use about 64KB
+	int blockCols = 16384 / residuals_n;
+	if (blockCols < 1) blockCols = 1;
+
+	float *sums = new float[blockCols * residuals_n];
+	int *rowCursor = new int[rows];
+	for (int row_i = 0; row_i < rows; row_i++) {
+		rowCursor[row_i] = rowIndexStart[row_i];
+	}
+
+	for (int colMin = 0; colMin < cols; colMin += blockCols) {
+		int colMax = (colMin + blockCols < cols ? colMin + blockCols : cols);
+
+		for (int sum_i = 0; sum_i < (colMax - colMin) * residuals_n; sum_i++) {
+			sums[sum_i] = 0;
+		}
+
+		// add each row to the columns of this block (the cursor continues where the last block stopped)
+		for (int row_i = 0; row_i < rows; row_i++) {
+			float *rowResidual = &rowResiduals[row_i * residuals_n];
+			int entry_i = rowCursor[row_i];
+			int entryMax = rowIndexStart[row_i + 1];
+
+			for (; entry_i < entryMax && rowIndexCols[entry_i] < colMax; entry_i++) {
+				float *colSums = &sums[(rowIndexCols[entry_i] - colMin) * residuals_n];
+				for (int res_i = 0; res_i < residuals_n; res_i++) {
+					colSums[res_i] += rowResidual[res_i];
+				}
+			}
+
+			rowCursor[row_i] = entry_i;
+		}
+
+		for (int col_i = colMin; col_i < colMax; col_i++) {
+			for (int res_i = 0; res_i < residuals_n; res_i++) {
+				products[res_i][col_i] = abs(sums[(col_i - colMin) * residuals_n + res_i]);
+			}
+		}
+	}
+
+	delete[] rowCursor;
+	delete[] sums;
+	delete[] rowResiduals;
+}
+
 string CSMatrix::getColName(CSCol *csCol) {
 
 	ostringstream colName;
@@ -1272,11 +2396,10 @@ string CSMatrix::getFactorLevelName(int factor_i, int level_i) {
 	return factorData->getFactorLevelName(factor_i, level_i);
 }
 
-void CSMatrix::addOneWayInteraction(int factor_i, char level_i, char **levelMatrix, vector <float>&sumOfSquares) {
+void CSMatrix::addOneWayInteraction(int factor_i, char level_i) {
 
 	// create new column for CS Matrix
 	CSCol *csCol = new CSCol;
-	int sum = 0;
 
 	// assign the headers
 	csCol->factors = 1; // 1 contributing factor (1-way interaction)
@@ -1286,24 +2409,8 @@ void CSMatrix::addOneWayInteraction(int factor_i, char level_i, char **levelMatr
 	csCol->setting[0].index = level_i;		// level of single factor
 	csCol->setting[0].levelsInGroup = 1;
 
-	// populate every row
-	for (int row_i = 0; row_i < rows; row_i++) {
-		addRow(csCol);
-
-		// 1 or -1 depending on if the factor levels matched
-		if (level_i == levelMatrix[row_i][factor_i])
-			csCol->dataP[row_i] = ENTRY_A;
-		else
-			csCol->dataP[row_i] = ENTRY_B;
-
-		// add to sum of squares
-		sum += csCol->dataP[row_i] * csCol->dataP[row_i];
-
-	}
-
-	// push into vector
+	// push into vector (the rows are allocated later)
 	data->push_back(csCol);
-	sumOfSquares.push_back(sum);
 
 }
 
@@ -1317,19 +2424,12 @@ void CSMatrix::print() {
 	for (int row_i = 0; row_i < rows; row_i++) {
 
 		for (int col_i = 0; col_i < getCols(); col_i++) {
-			cout << data->at(col_i)->dataP[row_i] << "\t";
+			cout << (getEntry(data->at(col_i), row_i) ? ENTRY_A : ENTRY_B) << "\t";
 		}
 
 		cout << endl;
 	}
 
-	// verify that the column mappings are correct
-	for (int col_i = 0; col_i < getCols(); col_i++) {
-		if (col_i != getColIndex(data->at(col_i))) {
-			cout << "Invalid Mapping!!" << endl;
-		}
-	}
-
 }
 
 void CSMatrix::countOccurrences(CSCol *csCol, Occurrence *occurrence, int minSetting_i, float magnitude, float rSquared) {
@@ -1346,15 +2446,143 @@ void CSMatrix::countOccurrences(CSCol *csCol, Occurrence *occurrence, int minSet
 	}
 }
 
+void CSMatrix::buildColumnNumbering() {
+	int factors = locatingArray->getFactors();
+	int t = locatingArray->getT();
+
+	// number the level groups of each factor (each level is its own group if the factor is not grouped)
+	groupCounts = new int[factors];
+	groupLevelMap = new int*[factors];
+	groupFirstLevel = new int*[factors];
+	firstInteraction = 1;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		int levels = groupingInfo[factor_i]->levels;
+		groupLevelMap[factor_i] = new int[levels];
+		groupFirstLevel[factor_i] = new int[levels + 1];
+
+		int groups = 0;
+		for (int level_i = 0; level_i < levels; level_i++) {
+			if (level_i == 0 || !groupingInfo[factor_i]->grouped ||
+					groupingInfo[factor_i]->levelGroups[level_i] != groupingInfo[factor_i]->levelGroups[level_i - 1]) {
+				groupFirstLevel[factor_i][groups++] = level_i;
+			}
+			groupLevelMap[factor_i][level_i] = groups - 1;
+		}
+		groupFirstLevel[factor_i][groups] = levels;
+		groupCounts[factor_i] = groups;
+
+		firstInteraction += levels;
+	}
+
+	/* An interaction that can add up to depth more settings below factor_i has, for each group of
+	each lower factor, the interaction with that group and all the interactions extending it */
+	subtreeCols = new int*[t + 1];
+	for (int depth = 0; depth <= t; depth++) {
+		subtreeCols[depth] = new int[factors + 1];
+		subtreeCols[depth][0] = 0;
+		for (int factor_i = 0; factor_i < factors; factor_i++) {
+			subtreeCols[depth][factor_i + 1] = subtreeCols[depth][factor_i] +
+				(depth > 0 ? groupCounts[factor_i] * (1 + subtreeCols[depth - 1][factor_i]) : 0);
+		}
+	}
+
+	// a group of a 1st factor begins the interactions extending its main effects
+	interactionStart = new int[factors + 1];
+	interactionStart[0] = 0;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		interactionStart[factor_i + 1] = interactionStart[factor_i] +
+			(t > 0 ? groupCounts[factor_i] * subtreeCols[t - 1][factor_i] : 0);
+	}
+
+#ifdef CHECK_COLUMN_NUMBERING
+	// check that getColIndex inverts getColSettings for every column
+	CSCol csCol;
+	csCol.setting = new FactorSetting[t + 1];
+	int cols = (int)countColumns(locatingArray);
+	for (int col_i = 0; col_i < cols; col_i++) {
+		csCol.factors = getColSettings(col_i, csCol.setting);
+		if (getColIndex(&csCol) != col_i) {
+			cout << "Invalid column numbering at column " << col_i << endl;
+		}
+	}
+	delete[] csCol.setting;
+#endif
+}
+
 int CSMatrix::getColIndex(CSCol *csCol) {
+	FactorSetting *setting = csCol->setting;
+	int t = locatingArray->getT();
 
-	Mapping *m = mapping;
-	for (int setting_i = 0; setting_i < csCol->factors; setting_i++) {
-		if (m == NULL) return -1;
-		m = m->mapping[factorLevelMap[csCol->setting[setting_i].factor_i][csCol->setting[setting_i].index]];
+	if (csCol->factors == 0) return 0;
+	if (csCol->factors == 1) return factorLevelMap[(int)setting[0].factor_i][(int)setting[0].index] + 1;
+	if (csCol->factors > t) return -1;
+
+	// where the interactions extending the 1st setting begin
+	int factor_i = setting[0].factor_i;
+	int col_i = firstInteraction + interactionStart[factor_i] +
+		groupLevelMap[factor_i][(int)setting[0].index] * subtreeCols[t - 1][factor_i];
+
+	// skip the interactions before each further setting
+	for (int setting_i = 1; setting_i < csCol->factors; setting_i++) {
+		int depth = t - setting_i;
+		factor_i = setting[setting_i].factor_i;
+
+		col_i += subtreeCols[depth][factor_i] +
+			groupLevelMap[factor_i][(int)setting[setting_i].index] * (1 + subtreeCols[depth - 1][factor_i]);
+
+		// the interaction so far comes before those extending it
+		if (setting_i < csCol->factors - 1) col_i++;
 	}
-	return m->mappedTo;
 
+	return col_i;
+}
+
+int CSMatrix::getColSettings(int col_i, FactorSetting *setting) {
+	int factors = locatingArray->getFactors();
+	int t = locatingArray->getT();
+
+	if (col_i == 0) return 0;
+
+	// main effects
+	if (col_i < firstInteraction) {
+		int factor_i = factors - 1;
+		while (factorLevelMap[factor_i][0] + 1 > col_i) factor_i--;
+
+		setting[0].grouped = false;
+		setting[0].factor_i = factor_i;
+		setting[0].index = col_i - 1 - factorLevelMap[factor_i][0];
+		setting[0].levelsInGroup = 1;
+		return 1;
+	}
+
+	// the 1st setting
+	int rest = col_i - firstInteraction;
+	int factor_i = 0;
+	while (rest >= interactionStart[factor_i + 1]) factor_i++;
+	rest -= interactionStart[factor_i];
+	int group_i = rest / subtreeCols[t - 1][factor_i];
+	rest -= group_i * subtreeCols[t - 1][factor_i];
+
+	int setting_i = 0;
+	for (int depth = t - 1; ; depth--) {
+		setting[setting_i].grouped = groupingInfo[factor_i]->grouped;
+		setting[setting_i].factor_i = factor_i;
+		setting[setting_i].index = groupFirstLevel[factor_i][group_i];
+		setting[setting_i].levelsInGroup = groupFirstLevel[factor_i][group_i + 1] - groupFirstLevel[factor_i][group_i];
+		setting_i++;
+
+		// rest counts the interactions before col_i that extend the settings so far
+		if (setting_i > 1 && rest == 0) break;
+		if (setting_i > 1) rest--;
+
+		factor_i = 0;
+		while (rest >= subtreeCols[depth][factor_i + 1]) factor_i++;
+		rest -= subtreeCols[depth][factor_i];
+		group_i = rest / (1 + subtreeCols[depth - 1][factor_i]);
+		rest -= group_i * (1 + subtreeCols[depth - 1][factor_i]);
+	}
+
+	return setting_i;
 }
 
 void CSMatrix::swapColumns(CSCol **array, int col_i1, int col_i2) {
@@ -1364,17 +2592,15 @@ void CSMatrix::swapColumns(CSCol **array, int col_i1, int col_i2) {
 }
 
 void CSMatrix::swapRows(CSCol **array, int row_i1, int row_i2) {
-	float tempData;
+	bool tempEntry;
+	rowIndexValid = false;
 	for (int col_i = 0; col_i < getCols(); col_i++) {
-		tempData = array[col_i]->dataP[row_i1];
-		array[col_i]->dataP[row_i1] = array[col_i]->dataP[row_i2];
-		array[col_i]->dataP[row_i2] = tempData;
+		tempEntry = getEntry(array[col_i], row_i1);
+		setEntry(array[col_i], row_i1, getEntry(array[col_i], row_i2));
+		setEntry(array[col_i], row_i2, tempEntry);
 	}
 
-	char **levelMatrix = locatingArray->getLevelMatrix();
-	char *tempLevel = levelMatrix[row_i1];
-	levelMatrix[row_i1] = levelMatrix[row_i2];
-	levelMatrix[row_i2] = tempLevel;
+	locatingArray->swapLevelRows(row_i1, row_i2);
 }
 
 // sort the array, given that some rows are already sorted
@@ -1410,8 +2636,8 @@ void CSMatrix::rowSort(CSCol **array, int min, int max, int row_i, int row_len)
 	int tempMax = max + 1;
 
 	while (true) {
-		while (tempMin < max && array[tempMin + 1]->dataP[row_i] == ENTRY_A) tempMin++;
-		while (tempMax > min && array[tempMax - 1]->dataP[row_i] == ENTRY_B) tempMax--;
+		while (tempMin < max && getEntry(array[tempMin + 1], row_i)) tempMin++;
+		while (tempMax > min && !getEntry(array[tempMax - 1], row_i)) tempMax--;
 
 		if (tempMax - 1 > tempMin + 1) {
 			swapColumns(array, tempMin + 1, tempMax - 1);
@@ -1452,124 +2678,229 @@ int CSMatrix::sortByCoverable(CSCol **array, int min, int max) {
 
 }
 
-int CSMatrix::sortByTWayInteraction(CSCol **array, int min, int max) {
+int CSMatrix::sortByTWayInteraction(CSCol **array, int min, int max) {
+
+	if (min >= max) return min;
+
+	int t = locatingArray->getT();
+	int tempMin = min - 1;
+	int tempMax = max + 1;
+
+	while (true) {
+		while (tempMin < max && array[tempMin + 1]->factors < t) tempMin++;
+		while (tempMax > min && array[tempMax - 1]->factors == t) tempMax--;
+
+		if (tempMax - 1 > tempMin + 1) {
+			swapColumns(array, tempMin + 1, tempMax - 1);
+		} else {
+			break;
+		}
+	}
+
+	// verification
+	for (int col_i = min; col_i <= tempMin; col_i++) {
+		if (array[col_i]->factors == t) cout << "mistake" << endl;
+	}
+
+	return tempMin + 1;
+
+}
+
+void CSMatrix::pathSort(CSCol **array, Path *path, int row_i, int &nPaths, list <Path*>*pathList) {
+	// paths still to sort (with the row to sort them on), kept on an explicit stack so
+	// the depth of the tree (one level per row) does not recurse
+	pathSortStack.clear();
+	pathSortStack.push_back(make_pair(path, row_i));
+
+	while (!pathSortStack.empty()) {
+		path = pathSortStack.back().first;
+		row_i = pathSortStack.back().second;
+		pathSortStack.pop_back();
+
+		if (path->min == path->max) {
+			deletePath(path->entryA);
+			deletePath(path->entryB);
+			path->entryA = NULL;
+			path->entryB = NULL;
+			continue;
+		} else if (row_i >= rows) {
+			// add to list
+			if (pathList != NULL) pathList->push_front(path);
+
+			continue;
+		}
+
+		int tempMin = path->min - 1;
+		int tempMax = path->max + 1;
+
+		while (true) {
+			while (tempMin < path->max && getEntry(array[tempMin + 1], row_i)) tempMin++;
+			while (tempMax > path->min && !getEntry(array[tempMax - 1], row_i)) tempMax--;
+
+			if (tempMax - 1 > tempMin + 1) {
+				swapColumns(array, tempMin + 1, tempMax - 1);
+				if (colPositions != NULL) colPositions->swap(tempMin + 1, tempMax - 1);
+			} else {
+				break;
+			}
+		}
+
+		// verification
+		for (int col_i = path->min; col_i <= tempMin; col_i++) {
+			if (!getEntry(array[col_i], row_i)) cout << "mistake" << endl;
+		}
+		for (int col_i = tempMax; col_i <= path->max; col_i++) {
+			if (getEntry(array[col_i], row_i)) cout << "mistake" << endl;
+		}
+		if (tempMin != tempMax - 1) cout << "mistake" << endl;
+
+		// entryB is pushed first so entryA is sorted first (the same order as a recursive sort)
+		if (tempMax <= path->max) {
+			nPaths++;
+			// allocate memory if none exists
+			if (path->entryB == NULL) {
+				path->entryB = newPath(tempMax, path->max);
+			}
+
+			// populate path for entryB
+			path->entryB->min = tempMax;
+			path->entryB->max = path->max;
 
-	if (min >= max) return min;
+			// sort path for entryB
+			pathSortStack.push_back(make_pair(path->entryB, row_i + 1));
+		} else {
+			deletePath(path->entryB);
+			path->entryB = NULL;
+		}
 
-	int t = locatingArray->getT();
-	int tempMin = min - 1;
-	int tempMax = max + 1;
+		if (path->min <= tempMin) {
+			nPaths++;
+			// allocate memory if none exists
+			if (path->entryA == NULL) {
+				path->entryA = newPath(path->min, tempMin);
+			}
 
-	while (true) {
-		while (tempMin < max && array[tempMin + 1]->factors < t) tempMin++;
-		while (tempMax > min && array[tempMax - 1]->factors == t) tempMax--;
+			// populate path for entryA
+			path->entryA->min = path->min;
+			path->entryA->max = tempMin;
 
-		if (tempMax - 1 > tempMin + 1) {
-			swapColumns(array, tempMin + 1, tempMax - 1);
+			// sort path for entryA
+			pathSortStack.push_back(make_pair(path->entryA, row_i + 1));
 		} else {
-			break;
+			// delete unnecessary path for entryA
+			deletePath(path->entryA);
+			path->entryA = NULL;
 		}
 	}
+}
 
-	// verification
-	for (int col_i = min; col_i <= tempMin; col_i++) {
-		if (array[col_i]->factors == t) cout << "mistake" << endl;
-	}
+Path *CSMatrix::newPath(int min, int max) {
+	return pathArena.newPath(min, max);
+}
 
-	return tempMin + 1;
+void CSMatrix::deletePath(Path *path) {
+	pathArena.deletePath(path);
+}
+
+// Path nodes are handed out in blocks of this many
+#define PATH_BLOCK_SIZE	4096
 
+PathArena::PathArena() {
+	blockUsed = PATH_BLOCK_SIZE;
+	freeList = NULL;
 }
 
-void CSMatrix::pathSort(CSCol **array, Path *path, int row_i, int &nPaths, list <Path*>*pathList) {
-	if (path->min == path->max) {
-		deletePath(path->entryA);
-		deletePath(path->entryB);
-		path->entryA = NULL;
-		path->entryB = NULL;
-		return;
-	} else if (row_i >= rows) {
-		// add to list
-		if (pathList != NULL) pathList->push_front(path);
+Path *PathArena::newPath(int min, int max) {
+	Path *path;
 
-		return;
+	if (freeList != NULL) {
+		// reuse a deleted node
+		path = freeList;
+		freeList = freeList->entryA;
+	} else {
+		if (blockUsed == PATH_BLOCK_SIZE) {
+			blocks.push_back(new Path[PATH_BLOCK_SIZE]);
+			blockUsed = 0;
+		}
+		path = &blocks.back()[blockUsed++];
 	}
 
-	int tempMin = path->min - 1;
-	int tempMax = path->max + 1;
+	path->min = min;
+	path->max = max;
+	path->entryA = NULL;
+	path->entryB = NULL;
 
-	while (true) {
-		while (tempMin < path->max && array[tempMin + 1]->dataP[row_i] == ENTRY_A) tempMin++;
-		while (tempMax > path->min && array[tempMax - 1]->dataP[row_i] == ENTRY_B) tempMax--;
+	return path;
+}
 
-		if (tempMax - 1 > tempMin + 1) {
-			swapColumns(array, tempMin + 1, tempMax - 1);
+// delete the subtree without recursion by rotating entryA children up until there are none
+void PathArena::deletePath(Path *path) {
+	while (path != NULL) {
+		if (path->entryA != NULL) {
+			Path *entryA = path->entryA;
+			path->entryA = entryA->entryB;
+			entryA->entryB = path;
+			path = entryA;
 		} else {
-			break;
+			Path *next = path->entryB;
+			path->entryA = freeList;
+			freeList = path;
+			path = next;
 		}
 	}
+}
 
-	// verification
-	for (int col_i = path->min; col_i <= tempMin; col_i++) {
-		if (array[col_i]->dataP[row_i] != ENTRY_A) cout << "mistake" << endl;
-	}
-	for (int col_i = tempMax; col_i <= path->max; col_i++) {
-		if (array[col_i]->dataP[row_i] != ENTRY_B) cout << "mistake" << endl;
+PathArena::~PathArena() {
+	for (size_t block_i = 0; block_i < blocks.size(); block_i++) {
+		delete[] blocks[block_i];
 	}
-	if (tempMin != tempMax - 1) cout << "mistake" << endl;
-
-	if (path->min <= tempMin) {
-		nPaths++;
-		// allocate memory if none exists
-		if (path->entryA == NULL) {
-			path->entryA = new Path;
-			path->entryA->entryA = NULL;
-			path->entryA->entryB = NULL;
-		}
-
-		// populate path for entryA
-		path->entryA->min = path->min;
-		path->entryA->max = tempMin;
+}
 
-		// sort path for entryA
-		pathSort(array, path->entryA, row_i + 1, nPaths, pathList);
-	} else {
-		// delete unnecessary path for entryA
-		deletePath(path->entryA);
-		path->entryA = NULL;
+ColumnPositions::ColumnPositions(int cols) {
+	position = new int[cols];
+	indexAt = new int[cols];
+	belowC = new bool[cols];
+	for (int col_i = 0; col_i < cols; col_i++) {
+		belowC[col_i] = false;
 	}
+}
 
-	if (tempMax <= path->max) {
-		nPaths++;
-		// allocate memory if none exists
-		if (path->entryB == NULL) {
-			path->entryB = new Path;
-			path->entryB->entryA = NULL;
-			path->entryB->entryB = NULL;
-		}
+// follow a swap of the columns at pos1 and pos2
+void ColumnPositions::swap(int pos1, int pos2) {
+	int index1 = indexAt[pos1];
+	int index2 = indexAt[pos2];
+	indexAt[pos1] = index2;
+	indexAt[pos2] = index1;
+	position[index1] = pos2;
+	position[index2] = pos1;
 
-		// populate path for entryB
-		path->entryB->min = tempMax;
-		path->entryB->max = path->max;
+	// a column below c moved to the other position
+	if (belowC[index1] != belowC[index2]) {
+		belowCPositions.erase(belowC[index1] ? pos1 : pos2);
+		belowCPositions.insert(belowC[index1] ? pos2 : pos1);
+	}
+}
 
-		// sort path for entryB
-		pathSort(array, path->entryB, row_i + 1, nPaths, pathList);
+void ColumnPositions::setBelowC(int index, bool below) {
+	if (belowC[index] == below) return;
+	belowC[index] = below;
+	if (below) {
+		belowCPositions.insert(position[index]);
 	} else {
-		deletePath(path->entryB);
-		path->entryB = NULL;
+		belowCPositions.erase(position[index]);
 	}
 }
 
-void CSMatrix::deletePath(Path *path) {
-	if (path != NULL) {
-		deletePath(path->entryA);
-		deletePath(path->entryB);
-		delete path;
-	}
+ColumnPositions::~ColumnPositions() {
+	delete[] position;
+	delete[] indexAt;
+	delete[] belowC;
 }
 
 // Locating Array Checker
 void CSMatrix::pathLAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i, int k,
-		long long int &score, FactorSetting *&settingToResample, long long int *rowContributions) {
+		long long int &score, FactorSetting *&settingToResample, long long int *rowContributions,
+		PathCheck *firstLeaf) {
 	if (k == 0 || pathA == NULL || pathB == NULL || pathA->min == pathB->max) {
 		return;
 	} else if (row_i == rows) {
@@ -1580,71 +2911,28 @@ void CSMatrix::pathLAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i,
 			score += (long long int)k * (long long int)(pathA->max - pathA->min + 1) * (long long int)(pathB->max - pathB->min + 1);
 		}
 
-		// set a setting to resample
-		if (settingToResample == NULL) {
-			int columnToResample = -1;
-
-			/*
-			int offset;
-			do {
-				offset = rand() % (pathA->max - pathA->min + 1 + pathB->max - pathB->min + 1);
-				if (offset <= pathA->max - pathA->min) {
-					columnToResample = pathA->min + offset;
-				} else {
-					offset -= (pathA->max - pathA->min + 1);
-					columnToResample = pathB->min + offset;
-				}
-			} while (array[columnToResample]->factors <= 0);
-			*/
-
-			// find a pair of columns that is distinguishable
-			for (int i_a = pathA->min;
-					i_a <= pathA->max && columnToResample == -1; i_a++) {
-				for (int i_b = (pathA == pathB ? i_a + 1 : 0);
-						i_b <= pathB->max && columnToResample == -1; i_b++) {
-					if (checkDistinguishable(array[i_a], array[i_b])) {
-						if (rand() % 2 && array[i_a]->factors > 0) {
-							columnToResample = i_a;
-						} else if (array[i_b]->factors > 0) {
-							columnToResample = i_b;
-						}
-					} else {
-//						score--;
-//						cout << "Not distinguishable: " << getColName(array[i_a]) << " vs " << getColName(array[i_b]) << endl;
-					}
-				}
-			}
-
-			// randomly choose a setting in the column to resample
-			if (columnToResample != -1) {
-				settingToResample = &array[columnToResample]->setting[rand() % array[columnToResample]->factors];
+		// set a setting to resample (or just remember the first leaf for the caller to choose at)
+		if (firstLeaf != NULL) {
+			if (firstLeaf->pathA == NULL) {
+				firstLeaf->pathA = pathA;
+				firstLeaf->pathB = pathB;
+				firstLeaf->row_i = row_i;
+				firstLeaf->k = k;
 			}
+		} else if (settingToResample == NULL) {
+			settingToResample = chooseSettingToResample(array, pathA, pathB);
 		}
 
 		return;
 	}
 
 	Path *pathAentryA, *pathAentryB, *pathBentryA, *pathBentryB;
+	getPathEntries(array, pathA, row_i, pathAentryA, pathAentryB);
+	getPathEntries(array, pathB, row_i, pathBentryA, pathBentryB);
 
-	if (pathA->min == pathA->max) {
-		pathAentryA = (array[pathA->min]->dataP[row_i] == ENTRY_A ? pathA : NULL);
-		pathAentryB = (array[pathA->min]->dataP[row_i] == ENTRY_B ? pathA : NULL);
-	} else {
-		pathAentryA = pathA->entryA;
-		pathAentryB = pathA->entryB;
-	}
-
-	if (pathB->min == pathB->max) {
-		pathBentryA = (array[pathB->min]->dataP[row_i] == ENTRY_A ? pathB : NULL);
-		pathBentryB = (array[pathB->min]->dataP[row_i] == ENTRY_B ? pathB : NULL);
-	} else {
-		pathBentryA = pathB->entryA;
-		pathBentryB = pathB->entryB;
-	}
-
-	pathLAChecker(array, pathAentryA, pathBentryA, row_i + 1, k, score, settingToResample, rowContributions);
-	pathLAChecker(array, pathAentryB, pathBentryB, row_i + 1, k, score, settingToResample, rowContributions);
-	pathLAChecker(array, pathAentryA, pathBentryB, row_i + 1, k - 1, score, settingToResample, rowContributions);
+	pathLAChecker(array, pathAentryA, pathBentryA, row_i + 1, k, score, settingToResample, rowContributions, firstLeaf);
+	pathLAChecker(array, pathAentryB, pathBentryB, row_i + 1, k, score, settingToResample, rowContributions, firstLeaf);
+	pathLAChecker(array, pathAentryA, pathBentryB, row_i + 1, k - 1, score, settingToResample, rowContributions, firstLeaf);
 
 	// add row contributions
 	if (rowContributions != NULL && pathAentryA != NULL && pathBentryB != NULL) {
@@ -1652,7 +2940,7 @@ void CSMatrix::pathLAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i,
 	}
 
 	if (pathA != pathB) {
-		pathLAChecker(array, pathAentryB, pathBentryA, row_i + 1, k - 1, score, settingToResample, rowContributions);
+		pathLAChecker(array, pathAentryB, pathBentryA, row_i + 1, k - 1, score, settingToResample, rowContributions, firstLeaf);
 
 		// add row contributions
 		if (rowContributions != NULL && pathAentryB != NULL && pathBentryA != NULL) {
@@ -1661,6 +2949,276 @@ void CSMatrix::pathLAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i,
 	}
 }
 
+/*
+	Runs pathLAChecker(array, path, path, 0, k, ...) on the checker threads (see
+	scorePathChecks). The setting to resample is chosen afterwards on the calling
+	thread at the first leaf in serial order, so it (and the random numbers drawn for
+	it) is the same as a serial check for any thread count.
+*/
+void CSMatrix::parallelPathLAChecker(CSCol **array, Path *path, int k,
+		long long int &score, FactorSetting *&settingToResample, long long int *rowContributions) {
+	if (resolveThreads(threads) <= 1) {
+		pathLAChecker(array, path, path, 0, k, score, settingToResample, rowContributions);
+		return;
+	}
+
+	PathCheck check = {path, path, 0, k};
+	vector <PathCheck>checks(1, check);
+	long long int checkScore;
+	PathCheck firstLeaf;
+
+	scorePathChecks(array, checks, &checkScore, &firstLeaf, rowContributions);
+	score += checkScore;
+
+	if (settingToResample == NULL) {
+		chooseSettingFromChecks(array, checks, &checkScore, &firstLeaf, settingToResample);
+	}
+}
+
+/*
+	Replaces each check (above row_end) by the checks pathLAChecker would recurse into,
+	level by level so the checks stay in the order the serial checker visits them, until
+	there are at least maxChecks. Checks that cannot score are dropped, and the row
+	contributions of the rows split on are added.
+*/
+void CSMatrix::splitPathChecks(CSCol **array, vector <PathCheck>&checks, int row_end, int maxChecks,
+		long long int *rowContributions) {
+	vector <PathCheck>nextChecks;
+	PathCheck check;
+
+	bool split = true;
+	while (split && checks.size() < (size_t)maxChecks) {
+		split = false;
+		nextChecks.clear();
+
+		for (size_t check_i = 0; check_i < checks.size(); check_i++) {
+			check = checks[check_i];
+			if (check.k == 0 || check.pathA == NULL || check.pathB == NULL || check.pathA->min == check.pathB->max) {
+				continue;
+			} else if (check.row_i >= row_end) {
+				nextChecks.push_back(check);
+				continue;
+			}
+			split = true;
+
+			Path *pathAentryA, *pathAentryB, *pathBentryA, *pathBentryB;
+			getPathEntries(array, check.pathA, check.row_i, pathAentryA, pathAentryB);
+			getPathEntries(array, check.pathB, check.row_i, pathBentryA, pathBentryB);
+
+			PathCheck checkAA = {pathAentryA, pathBentryA, check.row_i + 1, check.k};
+			PathCheck checkBB = {pathAentryB, pathBentryB, check.row_i + 1, check.k};
+			PathCheck checkAB = {pathAentryA, pathBentryB, check.row_i + 1, check.k - 1};
+			nextChecks.push_back(checkAA);
+			nextChecks.push_back(checkBB);
+			nextChecks.push_back(checkAB);
+
+			// add row contributions
+			if (rowContributions != NULL && pathAentryA != NULL && pathBentryB != NULL) {
+				rowContributions[check.row_i] += (pathAentryA->max - pathAentryA->min + 1) * (pathBentryB->max - pathBentryB->min + 1);
+			}
+
+			if (check.pathA != check.pathB) {
+				PathCheck checkBA = {pathAentryB, pathBentryA, check.row_i + 1, check.k - 1};
+				nextChecks.push_back(checkBA);
+
+				// add row contributions
+				if (rowContributions != NULL && pathAentryB != NULL && pathBentryA != NULL) {
+					rowContributions[check.row_i] += (pathAentryB->max - pathAentryB->min + 1) * (pathBentryA->max - pathBentryA->min + 1);
+				}
+			}
+		}
+
+		checks.swap(nextChecks);
+	}
+}
+
+/*
+	Scores every check into scores and records its first leaf in firstLeaves (pathA is
+	NULL if it has none). When there are too few checks for the checker threads, each
+	one is split into pieces first. The threads take the pieces from a shared queue,
+	each adding to its own score and row contributions.
+*/
+void CSMatrix::scorePathChecks(CSCol **array, vector <PathCheck>&checks, long long int *scores,
+		PathCheck *firstLeaves, long long int *rowContributions) {
+	int threads = resolveThreads(this->threads);
+	int checks_n = checks.size();
+
+	// pieces of the checks (in order) and the check each one came from
+	vector <PathCheck>pieces;
+	vector <int>pieceChecks;
+	for (int check_i = 0; check_i < checks_n; check_i++) {
+		vector <PathCheck>split(1, checks[check_i]);
+		if (threads > 1 && checks_n < threads * PATH_TASKS_PER_THREAD) {
+			splitPathChecks(array, split, rows, threads * PATH_TASKS_PER_THREAD / checks_n + 1, rowContributions);
+		}
+		pieces.insert(pieces.end(), split.begin(), split.end());
+		pieceChecks.insert(pieceChecks.end(), split.size(), check_i);
+
+		scores[check_i] = 0;
+		firstLeaves[check_i].pathA = NULL;
+	}
+
+	int pieces_n = pieces.size();
+	long long int *pieceScores = new long long int[pieces_n];
+	PathCheck *pieceLeaves = new PathCheck[pieces_n];
+
+	// each thread adds row contributions to its own rows
+	long long int **threadContributions = NULL;
+	if (rowContributions != NULL) {
+		threadContributions = new long long int*[threads];
+		for (int thread_i = 0; thread_i < threads; thread_i++) {
+			threadContributions[thread_i] = new long long int[rows];
+			for (int row_i = 0; row_i < rows; row_i++) {
+				threadContributions[thread_i][row_i] = 0;
+			}
+		}
+	}
+
+	parallelFor(pieces_n, threads, [&](int piece_i, int thread_i) {
+		FactorSetting *noSetting = NULL;
+		pieceScores[piece_i] = 0;
+		pieceLeaves[piece_i].pathA = NULL;
+		pathLAChecker(array, pieces[piece_i].pathA, pieces[piece_i].pathB, pieces[piece_i].row_i, pieces[piece_i].k,
+			pieceScores[piece_i], noSetting, threadContributions == NULL ? NULL : threadContributions[thread_i],
+			&pieceLeaves[piece_i]);
+	});
+
+	for (int piece_i = 0; piece_i < pieces_n; piece_i++) {
+		int check_i = pieceChecks[piece_i];
+		scores[check_i] += pieceScores[piece_i];
+		if (firstLeaves[check_i].pathA == NULL) {
+			firstLeaves[check_i] = pieceLeaves[piece_i];
+		}
+	}
+
+	if (rowContributions != NULL) {
+		for (int thread_i = 0; thread_i < threads; thread_i++) {
+			for (int row_i = 0; row_i < rows; row_i++) {
+				rowContributions[row_i] += threadContributions[thread_i][row_i];
+			}
+			delete[] threadContributions[thread_i];
+		}
+		delete[] threadContributions;
+	}
+
+	delete[] pieceScores;
+	delete[] pieceLeaves;
+}
+
+/*
+	Chooses the setting to resample from scored checks the way the serial checker would:
+	at the first leaf (in order) that gives one, drawing the same random numbers.
+*/
+void CSMatrix::chooseSettingFromChecks(CSCol **array, vector <PathCheck>&checks, long long int *scores,
+		PathCheck *firstLeaves, FactorSetting *&settingToResample) {
+	for (size_t check_i = 0; check_i < checks.size() && settingToResample == NULL; check_i++) {
+		// only checks that reached a leaf (scored) can give a setting to resample
+		if (scores[check_i] == 0) continue;
+
+		settingToResample = chooseSettingToResample(array, firstLeaves[check_i].pathA, firstLeaves[check_i].pathB);
+
+		// otherwise look through the rest of its leaves
+		if (settingToResample == NULL) {
+			int leavesToSkip = 1;
+			pathLAFindSetting(array, checks[check_i].pathA, checks[check_i].pathB, checks[check_i].row_i, checks[check_i].k,
+				leavesToSkip, settingToResample);
+		}
+	}
+}
+
+// as above, from the checks (by index) with a nonzero score
+void CSMatrix::chooseSettingFromChecks(CSCol **array, vector <PathCheck>&checks, set <int>&scoredChecks,
+		PathCheck *firstLeaves, FactorSetting *&settingToResample) {
+	for (set <int>::iterator it = scoredChecks.begin(); it != scoredChecks.end() && settingToResample == NULL; it++) {
+		settingToResample = chooseSettingToResample(array, firstLeaves[*it].pathA, firstLeaves[*it].pathB);
+
+		if (settingToResample == NULL) {
+			int leavesToSkip = 1;
+			pathLAFindSetting(array, checks[*it].pathA, checks[*it].pathB, checks[*it].row_i, checks[*it].k,
+				leavesToSkip, settingToResample);
+		}
+	}
+}
+
+// visit the leaves in the serial checker's order until a setting to resample is chosen
+void CSMatrix::pathLAFindSetting(CSCol **array, Path *pathA, Path *pathB, int row_i, int k,
+		int &leavesToSkip, FactorSetting *&settingToResample) {
+	if (settingToResample != NULL || k == 0 || pathA == NULL || pathB == NULL || pathA->min == pathB->max) {
+		return;
+	} else if (row_i == rows) {
+		if (leavesToSkip > 0) {
+			leavesToSkip--;
+		} else {
+			settingToResample = chooseSettingToResample(array, pathA, pathB);
+		}
+		return;
+	}
+
+	Path *pathAentryA, *pathAentryB, *pathBentryA, *pathBentryB;
+	getPathEntries(array, pathA, row_i, pathAentryA, pathAentryB);
+	getPathEntries(array, pathB, row_i, pathBentryA, pathBentryB);
+
+	pathLAFindSetting(array, pathAentryA, pathBentryA, row_i + 1, k, leavesToSkip, settingToResample);
+	pathLAFindSetting(array, pathAentryB, pathBentryB, row_i + 1, k, leavesToSkip, settingToResample);
+	pathLAFindSetting(array, pathAentryA, pathBentryB, row_i + 1, k - 1, leavesToSkip, settingToResample);
+	if (pathA != pathB) {
+		pathLAFindSetting(array, pathAentryB, pathBentryA, row_i + 1, k - 1, leavesToSkip, settingToResample);
+	}
+}
+
+// get the paths below path for the columns that are ENTRY_A and ENTRY_B in row_i
+void CSMatrix::getPathEntries(CSCol **array, Path *path, int row_i, Path *&entryA, Path *&entryB) {
+	if (path->min == path->max) {
+		entryA = (getEntry(array[path->min], row_i) ? path : NULL);
+		entryB = (!getEntry(array[path->min], row_i) ? path : NULL);
+	} else {
+		entryA = path->entryA;
+		entryB = path->entryB;
+	}
+}
+
+// choose a setting of a distinguishable pair of columns in the leaf (NULL if there is none)
+FactorSetting *CSMatrix::chooseSettingToResample(CSCol **array, Path *pathA, Path *pathB) {
+	int columnToResample = -1;
+
+	/*
+	int offset;
+	do {
+		offset = random.nextInt(pathA->max - pathA->min + 1 + pathB->max - pathB->min + 1);
+		if (offset <= pathA->max - pathA->min) {
+			columnToResample = pathA->min + offset;
+		} else {
+			offset -= (pathA->max - pathA->min + 1);
+			columnToResample = pathB->min + offset;
+		}
+	} while (array[columnToResample]->factors <= 0);
+	*/
+
+	// find a pair of columns that is distinguishable
+	for (int i_a = pathA->min;
+			i_a <= pathA->max && columnToResample == -1; i_a++) {
+		for (int i_b = (pathA == pathB ? i_a + 1 : 0);
+				i_b <= pathB->max && columnToResample == -1; i_b++) {
+			if (checkDistinguishable(array[i_a], array[i_b])) {
+				if (random.nextInt(2) && array[i_a]->factors > 0) {
+					columnToResample = i_a;
+				} else if (array[i_b]->factors > 0) {
+					columnToResample = i_b;
+				}
+			} else {
+//				score--;
+//				cout << "Not distinguishable: " << getColName(array[i_a]) << " vs " << getColName(array[i_b]) << endl;
+			}
+		}
+	}
+
+	// randomly choose a setting in the column to resample
+	if (columnToResample != -1) {
+		return &array[columnToResample]->setting[random.nextInt(array[columnToResample]->factors)];
+	}
+	return NULL;
+}
+
 // Detecting Array Checker
 void CSMatrix::pathDAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i, int k,
 		long long int &score, FactorSetting *&settingToResample, long long int *rowContributions) {
@@ -1679,7 +3237,7 @@ void CSMatrix::pathDAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i,
 			int columnToResample;
 			int offset;
 			do {
-				offset = rand() % (pathA->max - pathA->min + 1 + pathB->max - pathB->min + 1);
+				offset = random.nextInt(pathA->max - pathA->min + 1 + pathB->max - pathB->min + 1);
 				if (offset <= pathA->max - pathA->min) {
 					columnToResample = pathA->min + offset;
 				} else {
@@ -1688,7 +3246,7 @@ void CSMatrix::pathDAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i,
 				}
 			} while (array[columnToResample]->factors <= 0);
 
-			settingToResample = &array[columnToResample]->setting[rand() % array[columnToResample]->factors];
+			settingToResample = &array[columnToResample]->setting[random.nextInt(array[columnToResample]->factors)];
 		}
 
 		return;
@@ -1697,16 +3255,16 @@ void CSMatrix::pathDAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i,
 	Path *pathAentryA, *pathAentryB, *pathBentryA, *pathBentryB;
 
 	if (pathA->min == pathA->max) {
-		pathAentryA = (array[pathA->min]->dataP[row_i] == ENTRY_A ? pathA : NULL);
-		pathAentryB = (array[pathA->min]->dataP[row_i] == ENTRY_B ? pathA : NULL);
+		pathAentryA = (getEntry(array[pathA->min], row_i) ? pathA : NULL);
+		pathAentryB = (!getEntry(array[pathA->min], row_i) ? pathA : NULL);
 	} else {
 		pathAentryA = pathA->entryA;
 		pathAentryB = pathA->entryB;
 	}
 
 	if (pathB->min == pathB->max) {
-		pathBentryA = (array[pathB->min]->dataP[row_i] == ENTRY_A ? pathB : NULL);
-		pathBentryB = (array[pathB->min]->dataP[row_i] == ENTRY_B ? pathB : NULL);
+		pathBentryA = (getEntry(array[pathB->min], row_i) ? pathB : NULL);
+		pathBentryB = (!getEntry(array[pathB->min], row_i) ? pathB : NULL);
 	} else {
 		pathBentryA = pathB->entryA;
 		pathBentryB = pathB->entryB;
@@ -1760,8 +3318,30 @@ void CSMatrix::quickSort(CSCol **array, int min, int max, int row_top, int row_l
 }
 
 int CSMatrix::compare(CSCol *csCol1, CSCol *csCol2, int row_top, int row_len) {
-	int length = row_len * sizeof(float);
-	return memcmp(&csCol1->dataP[row_top], &csCol2->dataP[row_top], length);
+	if (!packed) {
+		int length = row_len * sizeof(float);
+		return memcmp(&csCol1->dataP[row_top], &csCol2->dataP[row_top], length);
+	}
+
+	if (row_len <= 0) return 0;
+
+	// find the 1st differing row with XOR (same sign as memcmp on the floats: ENTRY_A > ENTRY_B)
+	int row_end = row_top + row_len;
+	for (int word_i = row_top / 64; word_i * 64 < row_end; word_i++) {
+		uint64_t word1 = getWord(csCol1, word_i);
+		uint64_t diff = word1 ^ getWord(csCol2, word_i);
+
+		// mask out rows before row_top and from row_end on
+		if (word_i == row_top / 64) diff &= ~(uint64_t)0 << (row_top % 64);
+		if ((word_i + 1) * 64 > row_end) diff &= ~(~(uint64_t)0 << (row_end % 64));
+
+		if (diff != 0) {
+			int bit_i = __builtin_ctzll(diff);
+			return ((word1 >> bit_i) & 1 ? 1 : -1);
+		}
+	}
+
+	return 0;
 }
 
 // LEGACY (to be removed later)
@@ -1787,7 +3367,7 @@ long CSMatrix::checkAdvanced(CSCol **array, int k, int min, int max, int row_top
 
 			if (csCol1->factors != 0 && csCol2->factors != 0) {
 				// neither has 0 factors, choose randomly
-				if (rand() % 2) {
+				if (random.nextInt(2)) {
 					csColToResample = csCol1;
 				} else {
 					csColToResample = csCol2;
@@ -1802,7 +3382,7 @@ long CSMatrix::checkAdvanced(CSCol **array, int k, int min, int max, int row_top
 
 			// chose a random factor setting to resample
 			if (csColToResample != NULL) {
-				settingToResample = &csColToResample->setting[rand() % csColToResample->factors];
+				settingToResample = &csColToResample->setting[random.nextInt(csColToResample->factors)];
 			}
 		}
 
@@ -1841,21 +3421,22 @@ long CSMatrix::checkAdvanced(CSCol **array, int k, int min, int max, int row_top
 
 void CSMatrix::addRow(CSCol **array, char *levelRow) {
 	rows++;
+	rowIndexValid = false;
 
 	locatingArray->addLevelRow(levelRow);
 
 	// add a row to each column of the CS matrix and populate
 	for (int col_i = 0; col_i < getCols(); col_i++) {
 		addRow(array[col_i]);
-		populateColumnData(array[col_i], locatingArray->getLevelMatrix(), rows - 1, 1);
+		populateColumnData(array[col_i], rows - 1, 1);
 	}
 }
 
 void CSMatrix::remRow(CSCol **array) {
 	rows--;
+	rowIndexValid = false;
 
-	char *levelRow = locatingArray->remLevelRow();
-	delete levelRow;
+	locatingArray->remLevelRow();
 
 	// remove a row from each column of the CS matrix
 	for (int col_i = 0; col_i < getCols(); col_i++) {
@@ -1875,15 +3456,16 @@ void CSMatrix::resizeArray(CSCol **array, int newRows) {
 
 		// generate random row
 		for (int factor_i = 0; factor_i < factors; factor_i++) {
-			levelRow[factor_i] = rand() % groupingInfo[factor_i]->levels;
+			levelRow[factor_i] = random.nextInt(groupingInfo[factor_i]->levels);
 		}
 
 		// resample constraint groups
 		for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
-			conGroups[conGroup_i]->randPopulateLevelRow(levelRow);
+			conGroups[conGroup_i]->randPopulateLevelRow(levelRow, random, &groupScratch);
 		}
 
 		addRow(array, levelRow);
+		delete[] levelRow;
 	}
 
 	// decrease size as needed
@@ -1892,101 +3474,190 @@ void CSMatrix::resizeArray(CSCol **array, int newRows) {
 	}
 }
 
-bool CSMatrix::checkColumnCoverability(CSCol *csCol) {
+bool CSMatrix::checkColumnCoverability(CSCol *csCol, GroupScratch *scratch) {
+
+	int nConGroups = locatingArray->getNConGroups();
+	ConstraintGroup **conGroups = locatingArray->getConGroups();
+
+	// check if csCol settings are possible for every constraint group
+	for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
+		if (!conGroups[conGroup_i]->satisfiableInGroupLA(csCol->setting, csCol->factors, NULL, scratch)) {
+			return false;
+		}
+	}
+
+	/* for factors not in a constraint group, simply set their settings in csCol1 to be ENTRY_A,
+	 and the check passes because the interaction cannot be only */
+
+	return true;
+}
+
+void CSMatrix::buildIndistinguishable(int buildThreads) {
 
 	int factors = locatingArray->getFactors();
 	int nConGroups = locatingArray->getNConGroups();
 	ConstraintGroup **conGroups = locatingArray->getConGroups();
 
-	char *requireLevelRow = new char[factors];
-	char *avoidLevelRow = new char[factors];
+	indistinguishable = NULL;
+
+	// (factor + level) settings are numbered by factorLevelMap
+	int settings = 0;
 	for (int factor_i = 0; factor_i < factors; factor_i++) {
-		requireLevelRow[factor_i] = -1;
-		avoidLevelRow[factor_i] = -1;
+		settings += groupingInfo[factor_i]->levels;
 	}
 
-	// set to require csCol1 settings
-	for (int setting_i = 0; setting_i < csCol->factors; setting_i++) {
-		requireLevelRow[csCol->setting[setting_i].factor_i] = csCol->setting[setting_i].index;
+	// columns by their 1st setting
+	vector <int>*firstSettingCols = new vector <int>[settings];
+	for (int col_i = 0; col_i < getCols(); col_i++) {
+		CSCol *csCol = data->at(col_i);
+		if (csCol->factors > 0) {
+			firstSettingCols[factorLevelMap[(int)csCol->setting[0].factor_i][(int)csCol->setting[0].index]].push_back(col_i);
+		}
 	}
 
-	// check if possible for every constraint group
-	bool satisfiableInGroups = true;
-	for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
-		if (!conGroups[conGroup_i]->satisfiableInGroupLA(requireLevelRow, avoidLevelRow)) {
-			satisfiableInGroups = false;
-			break;
+	// the list of each column is built on its own, with forced settings for each thread
+	int threads = resolveThreads(buildThreads);
+	vector <int>*lists = new vector <int>[getCols()];
+	bool **threadForced = new bool*[threads];
+	vector <FactorSetting>*threadForcedSettings = new vector <FactorSetting>[threads];
+	GroupScratch *threadScratch = new GroupScratch[threads];
+	for (int thread_i = 0; thread_i < threads; thread_i++) {
+		threadForced[thread_i] = new bool[settings];
+		for (int setting_i = 0; setting_i < settings; setting_i++) {
+			threadForced[thread_i][setting_i] = false;
 		}
 	}
 
-	/* for factors not in a constraint group, simply set their settings in csCol1 to be ENTRY_A,
-	 and the check passes because the interaction cannot be only */
+	parallelFor(getCols(), threads, [&](int col_i, int thread_i) {
+		CSCol *csCol = data->at(col_i);
+		if (!csCol->coverable) return;
+
+		bool *forced = threadForced[thread_i];
+		vector <FactorSetting>&forcedSettings = threadForcedSettings[thread_i];
+		GroupScratch *scratch = &threadScratch[thread_i];
+
+		/* a column is distinguishable from csCol in one direction as soon as it has a setting
+		that some row covering csCol can avoid, so the columns to check are those with only
+		forced settings: the settings of csCol and those no row covering csCol avoids */
+		forcedSettings.clear();
+		for (int setting_i = 0; setting_i < csCol->factors; setting_i++) {
+			forcedSettings.push_back(csCol->setting[setting_i]);
+			forced[factorLevelMap[(int)csCol->setting[setting_i].factor_i][(int)csCol->setting[setting_i].index]] = true;
+		}
+		for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
+			ConstraintGroup *conGroup = conGroups[conGroup_i];
+			for (int factor_i = 0; factor_i < conGroup->factors; factor_i++) {
+				FactorSetting setting = FactorSetting();
+				setting.grouped = false;
+				setting.factor_i = conGroup->factorIndeces[factor_i];
+				setting.levelsInGroup = 1;
+				for (int level_i = 0; level_i < groupingInfo[(int)setting.factor_i]->levels; level_i++) {
+					setting.index = level_i;
+					int setting_i = factorLevelMap[(int)setting.factor_i][level_i];
+					if (!forced[setting_i] && !conGroup->satisfiableInGroupLA(csCol->setting, csCol->factors, &setting, scratch)) {
+						forcedSettings.push_back(setting);
+						forced[setting_i] = true;
+					}
+				}
+			}
+		}
+
+		// the INTERCEPT has no settings to avoid
+		if (!checkOneWayDistinguishable(data->at(0), csCol, scratch)) {
+			lists[col_i].push_back(0);
+		}
+
+		for (size_t forced_i = 0; forced_i < forcedSettings.size(); forced_i++) {
+			int setting_i = factorLevelMap[(int)forcedSettings[forced_i].factor_i][(int)forcedSettings[forced_i].index];
+			for (size_t first_i = 0; first_i < firstSettingCols[setting_i].size(); first_i++) {
+				CSCol *csCol2 = data->at(firstSettingCols[setting_i][first_i]);
+
+				bool candidate = true;
+				for (int setting2_i = 1; setting2_i < csCol2->factors && candidate; setting2_i++) {
+					candidate = forced[factorLevelMap[(int)csCol2->setting[setting2_i].factor_i][(int)csCol2->setting[setting2_i].index]];
+				}
+
+				if (candidate && !checkOneWayDistinguishable(csCol, csCol2, scratch) &&
+						!checkOneWayDistinguishable(csCol2, csCol, scratch)) {
+					lists[col_i].push_back(firstSettingCols[setting_i][first_i]);
+				}
+			}
+		}
 
-	// deallocate memory
-	delete[] requireLevelRow;
-	delete[] avoidLevelRow;
+		for (size_t forced_i = 0; forced_i < forcedSettings.size(); forced_i++) {
+			forced[factorLevelMap[(int)forcedSettings[forced_i].factor_i][(int)forcedSettings[forced_i].index]] = false;
+		}
+		sort(lists[col_i].begin(), lists[col_i].end());
+	});
+
+	delete[] firstSettingCols;
+	for (int thread_i = 0; thread_i < threads; thread_i++) {
+		delete[] threadForced[thread_i];
+	}
+	delete[] threadForced;
+	delete[] threadForcedSettings;
+	delete[] threadScratch;
 
-	return satisfiableInGroups;
+	indistinguishable = lists;
 }
 
 bool CSMatrix::checkDistinguishable(CSCol *csCol1, CSCol *csCol2) {
-	return checkOneWayDistinguishable(csCol1, csCol2) || checkOneWayDistinguishable(csCol2, csCol1);
+	// while the lists are built
+	if (indistinguishable == NULL) {
+		return checkOneWayDistinguishable(csCol1, csCol2, &groupScratch) ||
+			checkOneWayDistinguishable(csCol2, csCol1, &groupScratch);
+	}
+
+	if (!csCol1->coverable && !csCol2->coverable) return false;
+
+	// look up the other column in the list of a coverable one
+	if (!csCol1->coverable) {
+		CSCol *tempCol = csCol1;
+		csCol1 = csCol2;
+		csCol2 = tempCol;
+	}
+	vector <int>&list = indistinguishable[getColIndex(csCol1)];
+	return !binary_search(list.begin(), list.end(), getColIndex(csCol2));
 }
 
-bool CSMatrix::checkOneWayDistinguishable(CSCol *csCol1, CSCol *csCol2) {
+bool CSMatrix::checkOneWayDistinguishable(CSCol *csCol1, CSCol *csCol2, GroupScratch *scratch) {
 
-	int factors = locatingArray->getFactors();
 	int nConGroups = locatingArray->getNConGroups();
 	ConstraintGroup **conGroups = locatingArray->getConGroups();
 
-	char *requireLevelRow = new char[factors];
-	char *avoidLevelRow = new char[factors];
-	for (int factor_i = 0; factor_i < factors; factor_i++) {
-		requireLevelRow[factor_i] = -1;
-		avoidLevelRow[factor_i] = -1;
-	}
-
-	// set to require csCol1 settings
-	for (int setting_i = 0; setting_i < csCol1->factors; setting_i++) {
-		requireLevelRow[csCol1->setting[setting_i].factor_i] = csCol1->setting[setting_i].index;
-	}
-
 	// at least one satisfying setting in csCol2 must be avoidable for every constraint group
-	bool settingExists = false;
 
-	// try to avoid at least one csCol2 setting
+	// try to avoid at least one csCol2 setting while requiring csCol1 settings
 	for (int setting_i = 0; setting_i < csCol2->factors; setting_i++) {
-		// we are trying to avoid "csCol2->setting[setting_i].factor_i != csCol2->setting[setting_i].index" in this iteration
+		FactorSetting *avoid = &csCol2->setting[setting_i];
+
 		// we cannot require the setting we are trying to avoid
-		if (requireLevelRow[csCol2->setting[setting_i].factor_i] != csCol2->setting[setting_i].index) {
-			avoidLevelRow[csCol2->setting[setting_i].factor_i] = csCol2->setting[setting_i].index;
-
-			// check if possible for every constraint group
-			bool satisfiableInGroups = true;
-			for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
-				if (!conGroups[conGroup_i]->satisfiableInGroupLA(requireLevelRow, avoidLevelRow)) {
-					satisfiableInGroups = false;
-					break;
-				}
+		bool required = false;
+		for (int require_i = 0; require_i < csCol1->factors; require_i++) {
+			if (csCol1->setting[require_i].factor_i == avoid->factor_i &&
+					csCol1->setting[require_i].index == avoid->index) {
+				required = true;
+				break;
 			}
+		}
+		if (required) continue;
 
-			if (satisfiableInGroups) {
-				settingExists = true;
+		// check if possible for every constraint group
+		bool satisfiableInGroups = true;
+		for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
+			if (!conGroups[conGroup_i]->satisfiableInGroupLA(csCol1->setting, csCol1->factors, avoid, scratch)) {
+				satisfiableInGroups = false;
 				break;
 			}
-
-			avoidLevelRow[csCol2->setting[setting_i].factor_i] = -1;
 		}
+
+		if (satisfiableInGroups) return true;
 	}
 
 	/* for factors not in a constraint group, simply set their settings in csCol1 to be ENTRY_A,
 	 and the check passes because the interaction cannot be only */
 
-	// deallocate memory
-	delete[] requireLevelRow;
-	delete[] avoidLevelRow;
-
-	return settingExists;
+	return false;
 }
 
 void CSMatrix::randomizeArray(CSCol **array) {
@@ -1994,16 +3665,16 @@ void CSMatrix::randomizeArray(CSCol **array) {
 	int cols = getCols();
 
 	// resample entire locating array
-	char **levelMatrix = locatingArray->getLevelMatrix();
 	for (int row_i = 0; row_i < rows; row_i++) {
 		for (int factor_i = 0; factor_i < factors; factor_i++) {
-			levelMatrix[row_i][factor_i] = rand() % groupingInfo[factor_i]->levels;
+			locatingArray->setLevel(row_i, factor_i, random.nextInt(groupingInfo[factor_i]->levels));
 		}
 	}
 
 	// populate each column of the CS matrix
+	rowIndexValid = false;
 	for (int col_i = 0; col_i < cols; col_i++) {
-		populateColumnData(array[col_i], locatingArray->getLevelMatrix(), 0, rows);
+		populateColumnData(array[col_i], 0, rows);
 	}
 }
 
@@ -2036,7 +3707,7 @@ void CSMatrix::addRowFix(CSCol **array, long long int &csScore) {
 	for (int factor_i = 0; factor_i < factors; factor_i++) {
 		finalized[factor_i] = false;
 
-		levelRow[factor_i] = rand() % groupingInfo[factor_i]->levels;
+		levelRow[factor_i] = random.nextInt(groupingInfo[factor_i]->levels);
 	}
 
 	// add the row to locating array
@@ -2095,7 +3766,7 @@ void CSMatrix::addRowFix(CSCol **array, long long int &csScore) {
 			csCol = array[col_i];
 
 			// if duplicate and the column has factors to change (column is not the INTERCEPT)
-			if (duplicate && csCol->dataP[rows - 1] != 1 && csCol->factors > 0) {
+			if (duplicate && !getEntry(csCol, rows - 1) && csCol->factors > 0) {
 
 				// grab duplicate column
 				CSCol *csDup = array[col_i + 1];
@@ -2116,7 +3787,7 @@ void CSMatrix::addRowFix(CSCol **array, long long int &csScore) {
 					if (!finalized[factor_i]) {
 						// update factor to match the current column
 						newLevelRow[factor_i] = csCol->setting[setting_i].index +
-							(rand() % csCol->setting[setting_i].levelsInGroup);
+							random.nextInt(csCol->setting[setting_i].levelsInGroup);
 					} else {
 						// ensure this will actually make this column a 1
 						changeAllowed &= (newLevelRow[factor_i] >= csCol->setting[setting_i].index &&
@@ -2139,6 +3810,7 @@ void CSMatrix::addRowFix(CSCol **array, long long int &csScore) {
 						if (levelRow[factor_i] != newLevelRow[factor_i]) {
 							// update columns
 							levelRow[factor_i] = newLevelRow[factor_i];
+							locatingArray->setLevel(rows - 1, factor_i, levelRow[factor_i]);
 							repopulateColumns(factor_i, oldLevelRow[factor_i], rows - 1, 1);
 							repopulateColumns(factor_i, newLevelRow[factor_i], rows - 1, 1);
 						}
@@ -2166,6 +3838,7 @@ void CSMatrix::addRowFix(CSCol **array, long long int &csScore) {
 						if (oldLevelRow[factor_i] != levelRow[factor_i]) {
 							// rollback columns and get new score
 							levelRow[factor_i] = oldLevelRow[factor_i];
+							locatingArray->setLevel(rows - 1, factor_i, levelRow[factor_i]);
 							repopulateColumns(factor_i, oldLevelRow[factor_i], rows - 1, 1);
 							repopulateColumns(factor_i, newLevelRow[factor_i], rows - 1, 1);
 						}
@@ -2191,6 +3864,7 @@ void CSMatrix::addRowFix(CSCol **array, long long int &csScore) {
 					// update columns and get new score
 					oldLevelRow[factor_i] = levelRow[factor_i];
 					levelRow[factor_i] = bestLevelRow[factor_i];
+					locatingArray->setLevel(rows - 1, factor_i, levelRow[factor_i]);
 					repopulateColumns(factor_i, oldLevelRow[factor_i], rows - 1, 1);
 					repopulateColumns(factor_i, bestLevelRow[factor_i], rows - 1, 1);
 				}
@@ -2211,6 +3885,7 @@ void CSMatrix::addRowFix(CSCol **array, long long int &csScore) {
 
 	cout << "Score after finalized row: " << csScore << endl;
 
+	delete[] levelRow;
 	delete[] oldLevelRow;
 	delete[] newLevelRow;
 	delete[] bestLevelRow;
@@ -2262,11 +3937,7 @@ long long int CSMatrix::getBruteForceArrayScore(CSCol **array, int k) {
 					indistinguishable++;
 				}
 
-				differences = 0;
-
-				for (int row_i = 0; row_i < rows; row_i++) {
-					if (array[col_i1]->dataP[row_i] != array[col_i2]->dataP[row_i]) differences++;
-				}
+				differences = countDifferences(array[col_i1], array[col_i2]);
 
 				if (differences < k) {
 					score += (k - differences);
@@ -2284,6 +3955,9 @@ long long int CSMatrix::getBruteForceArrayScore(CSCol **array, int k) {
 void CSMatrix::writeResponse(string responseDir, string responseCol, int terms, float *coefficients, int *columns) {
 	cout << responseDir << endl;
 
+	// the sparse columns add their coefficient to their ENTRY_A rows only
+	buildIndex();
+
 	// initialize all responses to 0
 	float *responses = new float[rows];
 	for (int row_i = 0; row_i < rows; row_i++) {
@@ -2291,6 +3965,7 @@ void CSMatrix::writeResponse(string responseDir, string responseCol, int terms,
 	}
 
 	// add contributions from all terms
+	float *scratch = new float[rows];
 	for (int term_i = 0; term_i < terms; term_i++) {
 
 		CSCol *csCol = data->at(columns[term_i]);
@@ -2298,10 +3973,21 @@ void CSMatrix::writeResponse(string responseDir, string responseCol, int terms,
 
 		cout << coefficient << " * " << getColName(csCol) << endl;
 
+		int rows_n;
+		int *colRows = getColRows(columns[term_i], rows_n);
+		if (colRows != NULL) {
+			for (int entry_i = 0; entry_i < rows_n; entry_i++) {
+				responses[colRows[entry_i]] += coefficient;
+			}
+			continue;
+		}
+
+		float *colData = getColData(columns[term_i], scratch);
 		for (int row_i = 0; row_i < rows; row_i++) {
-			responses[row_i] += coefficient * csCol->dataP[row_i];
+			responses[row_i] += coefficient * colData[row_i];
 		}
 	}
+	delete[] scratch;
 
 	// open a response file for writing
 	string file = responseDir + "/Response.tsv";
@@ -2326,36 +4012,29 @@ void CSMatrix::writeResponse(string responseDir, string responseCol, int terms,
 CSMatrix::~CSMatrix() {
 	CSCol *csCol;
 
-	// delete all mappings strategically
-	for (int t = locatingArray->getT(); t >= 0; t--) {
+	// a worker only owns its column data and level matrix
+	if (source != NULL) {
 		for (int col_i = 0; col_i < getCols(); col_i++) {
-			csCol = data->at(col_i);
-
-			if (csCol->factors == t) {
-				Mapping *mappingTemp = mapping;
-				FactorSetting *setting;
-				for (int setting_i = 0; setting_i < t; setting_i++) {
-					setting = &csCol->setting[setting_i];
-					mappingTemp = mappingTemp->mapping[factorLevelMap[setting->factor_i][setting->index]];
-				}
-
-				// deallocate mapping->mapping array
-				if (t == 1 && groupingInfo[setting->factor_i]->grouped && setting->index > 0 &&
-						groupingInfo[setting->factor_i]->levelGroups[setting->index] == groupingInfo[setting->factor_i]->levelGroups[setting->index - 1]) {
-					// This column is a main effect that is grouped with other main effects, but it is not the first main effect in its group.
-					// All main effects in a particular group have separate columns in the CS matrix and separate mapping structs but they share mapping->mapping arrays,
-					// because the main effects (although separate) are not differentiated in any interactions that they are included in.
-					// We only deallocate the mapping->mapping array for the first main effect in a group so as not to deallocate the same array more than once.
-					// We therefore ignore this main effect in terms of deallocating the mapping-mapping array.
-				} else if (mappingTemp->mapping != NULL) {
-					delete[] mappingTemp->mapping;
-				}
-
-				// deallocate mapping struct
-				delete mappingTemp;
-			}
+			delete data->at(col_i);
 		}
+		delete data;
+		delete locatingArray;
+		return;
+	}
+
+	// delete the column numbering
+	for (int factor_i = 0; factor_i < locatingArray->getFactors(); factor_i++) {
+		delete[] groupLevelMap[factor_i];
+		delete[] groupFirstLevel[factor_i];
 	}
+	delete[] groupCounts;
+	delete[] groupLevelMap;
+	delete[] groupFirstLevel;
+	for (int depth = 0; depth <= locatingArray->getT(); depth++) {
+		delete[] subtreeCols[depth];
+	}
+	delete[] subtreeCols;
+	delete[] interactionStart;
 
 	// delete all csCols
 	for (int col_i = 0; col_i < getCols(); col_i++) {
@@ -2372,13 +4051,19 @@ CSMatrix::~CSMatrix() {
 	}
 	delete[] factorLevelMap;
 
+	delete[] indistinguishable;
+
 }
 
 
 // [[Rcpp::export]]
-SEXP makeCSMatrix2(SEXP la){
+SEXP makeCSMatrix2(SEXP la, double memlimit = 0){
   Rcpp::XPtr<LocatingArray> la_ptr(la);
-  CSMatrix* cs = new CSMatrix(la_ptr);
+  bool virtualCols = false;
+  if (!CSMatrix::fitMemory(la_ptr, true, memlimit * 1048576, &virtualCols)) {
+    Rcpp::stop("CS Matrix would exceed the memory limit");
+  }
+  CSMatrix* cs = new CSMatrix(la_ptr, true, "", virtualCols);
   Rcpp::XPtr<CSMatrix> ptr(cs);
   return ptr;
 }
@@ -1,6 +1,8 @@
 #ifndef CSMATRIX_H
 #define CSMATRIX_H
 
+#include <atomic>
+#include <climits>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -8,7 +10,9 @@
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <set>
 #include <sstream>
+#include <stdint.h>
 #include <stdio.h>
 #include <string>
 #include <sys/time.h>
@@ -17,24 +21,14 @@
 
 #include "FactorData.h"
 #include "LocatingArray.h"
+#include "MoveScheduler.h"
 #include "Occurrence.h"
+#include "Random.h"
 
 
 
 using namespace std;
 
-struct FactorSetting {
-	
-	bool grouped;
-	char factor_i;
-	char index;			// level index (1st level if part of group)
-	char levelsInGroup;	// levels in group (1 if not a group)
-	
-};
-struct Mapping {
-	int mappedTo;
-	Mapping **mapping;
-};
 struct Path {
 	int min;
 	int max;
@@ -42,6 +36,51 @@ struct Path {
 	Path *entryA;
 	Path *entryB;
 };
+/*
+	Path nodes come from fixed-size blocks, so a node never moves while the tree
+	grows. Deleted subtrees go on a free list (linked through entryA) that later
+	sorts take nodes from, so re-sorting the path tree does no heap allocation.
+*/
+class PathArena {
+private:
+	vector <Path*>blocks;
+	int blockUsed;		// nodes handed out from the last block
+	Path *freeList;
+	
+public:
+	PathArena();
+	
+	Path *newPath(int min, int max);
+	void deletePath(Path *path);
+	
+	~PathArena();
+};
+// a pair of paths still to be checked from row_i on (a task of the parallel checker)
+struct PathCheck {
+	Path *pathA;
+	Path *pathB;
+	int row_i;
+	int k;
+};
+/*
+	Where the columns of a work array are while pathSort moves them (by column index),
+	and the coverable columns below the c requirement by position, so randomizePaths
+	finds a changed column's paths and its min count setting without a scan.
+*/
+class ColumnPositions {
+public:
+	int *position;	// by column index
+	int *indexAt;	// by position
+	bool *belowC;	// by column index
+	set <int>belowCPositions;
+	
+	ColumnPositions(int cols);
+	
+	void swap(int pos1, int pos2);
+	void setBelowC(int index, bool below);
+	
+	~ColumnPositions();
+};
 
 class CSCol {
 public:
@@ -49,6 +88,11 @@ public:
 	vector <float>dataVector;
 	float *dataP; // pointer to the 1st vector element
 
+	// packed column data (only used when the CS matrix is packed)
+	// row_i is stored in bit (row_i % 64) of word (row_i / 64), unused bits are 0
+	vector <uint64_t>bitVector;
+	uint64_t *bitP; // pointer to the 1st word
+
 	// number of contributing factors
 	int factors;
 	
@@ -65,47 +109,138 @@ private:
 
 	int rows;
 	
+	// columns are also stored as bits (64 rows per word) for the construction kernels
+	bool packed;
+	
+	/* In virtual mode (packed only) the interaction columns (2 or more factors) store no
+	data. getWord ANDs their words from the main effect columns of their settings (ORing
+	the levels of a grouped setting) whenever a kernel reads them, so the memory per row
+	grows with the levels instead of the columns. */
+	bool virtualCols;
+	bool isVirtual(CSCol *csCol);
+	uint64_t getWord(CSCol *csCol, int word_i);
+	int getWords(CSCol *csCol);
+	
+	// threads used by the locating array checker (0 for all cores)
+	int threads;
+	
+	// restarts that randomFix and autoFindRows run at once (1 runs them one by one)
+	int starts;
+	
+	// every random choice of the construction routines comes from random
+	Random random;
+	
+	// picks and accepts the moves of randomizePaths
+	MoveScheduler scheduler;
+	
+	// buffers of the lazy constraint group searches run on this matrix's own thread
+	GroupScratch groupScratch;
+	
+	/* A multi-start worker is a copy of a CS matrix with its own level matrix,
+	column data and random stream. It shares the settings, column numbering and grouping of
+	its source matrix, stops once cancel drops below its start index and does not
+	print its progress. */
+	CSMatrix *source;	// NULL if not a worker
+	int startIndex;
+	atomic<int> *cancel;
+	bool verbose;
+	CSMatrix(CSMatrix *source, int startIndex, Random &random);
+	bool runStart(int k, int c, int totalRows, bool randomize, long long int &score);
+	bool multiStart(int k, int c, int totalRows, bool randomize, long long int &score);
+	void adoptWorker(CSMatrix *worker);
+	
 	FactorData *factorData;
 	LocatingArray *locatingArray;
 	GroupingInfo **groupingInfo;
 	
 	vector <CSCol*>*data;	// m by n
 	
-	/* The Mapping structure helps map (factor + level) interactions to their
-	appropriate column in the CS Matrix. First, a (factor + level) combination
-	is mapped to an index using 'factorLevelMap'. The index for factor = 1,
-	level = 2 can be found by: factorLevelMap[1][2]; This index represents a
-	(factor + level) combination. A t-way interaction of these indeces is
-	mapped to a column of the CS Matrix using 'mapping'. Indeces are placed in
-	decreasing order. For example 10, 7, 2 represents a 3-way interaction and
-	its column index would be found in the following way:
-	mapping->mapping[10]->mapping[7]->mapping[2]->mappedTo;
+	/* Column indeces are computed instead of looked up. A (factor + level) combination
+	is mapped to an index using 'factorLevelMap'. The index for factor = 1, level = 2
+	can be found by: factorLevelMap[1][2]; and its main effect is the column after it
+	(the INTERCEPT is column 0). An interaction takes a level group of each of its
+	factors, in decreasing factor order. Group group_i of factor_i is numbered by
+	groupLevelMap[factor_i][level_i] for each of its levels, and has the levels from
+	groupFirstLevel[factor_i][group_i] to groupFirstLevel[factor_i][group_i + 1] - 1.
+	
+	The interactions follow the main effects (from firstInteraction) in depth first
+	order of their settings, so the index of an interaction is its rank in that order.
+	subtreeCols[depth][factor_i] counts the interactions that add 1 to depth more
+	settings below factor_i to a column, and interactionStart[factor_i] is where the
+	interactions with a 1st factor of factor_i begin (relative to firstInteraction).
 	*/
 	int **factorLevelMap;
-	Mapping *mapping;
+	int *groupCounts;
+	int **groupLevelMap;
+	int **groupFirstLevel;
+	int **subtreeCols;
+	int *interactionStart;
+	int firstInteraction;
+	void buildColumnNumbering();
+	
+	/* Row-wise index of the ENTRY_A entries (the transpose of the CS matrix in
+	compressed sparse row form). The columns that are ENTRY_A in row row_i are
+	rowIndexCols[rowIndexStart[row_i]] to rowIndexCols[rowIndexStart[row_i + 1] - 1]
+	in increasing order. It is built on demand by getProductsWithCols (or by
+	buildIndex) and invalidated whenever column data changes.
+	
+	Built with it, the sparse columns (those with at most SPARSE_MAX_DENSITY of
+	their rows ENTRY_A) list their ENTRY_A rows, in increasing order, from
+	colIndexRows[colIndexStart[col_i]] to colIndexRows[colIndexStart[col_i + 1] - 1].
+	The range of a dense column is empty.
+	*/
+	bool rowIndexValid;
+	vector <int>rowIndexStart;
+	vector <int>rowIndexCols;
+	vector <bool>colSparse;
+	vector <int>colIndexStart;
+	vector <int>colIndexRows;
+	void buildRowIndex();
+	
+	/* The pairs of columns that the constraints keep any row from telling apart are found
+	once by buildIndistinguishable, so checkDistinguishable is a lookup. indistinguishable[col_i]
+	lists (in increasing order) the columns that coverable column col_i is indistinguishable
+	from. Two columns that are not coverable are always indistinguishable. Workers share the
+	lists of their source. */
+	vector <int>*indistinguishable;
+	void buildIndistinguishable(int buildThreads);
 	
-	bool checkColumnCoverability(CSCol *csCol);
-	bool checkOneWayDistinguishable(CSCol *csCol1, CSCol *csCol2);
+	bool checkColumnCoverability(CSCol *csCol, GroupScratch *scratch);
+	bool checkOneWayDistinguishable(CSCol *csCol1, CSCol *csCol2, GroupScratch *scratch);
 	bool checkDistinguishable(CSCol *csCol1, CSCol *csCol2);
 	
 	void addRow(CSCol *csCol);
 	void remRow(CSCol *csCol);
+	// allocates every row of a new column at once (all ENTRY_B)
+	void allocateRows(CSCol *csCol);
+	bool getEntry(CSCol *csCol, int row_i);
+	void setEntry(CSCol *csCol, int row_i, bool entryA);
+	int countDifferences(CSCol *csCol1, CSCol *csCol2);
 	void resizeArray(CSCol **array, int newRows);
 	void randomizeArray(CSCol **array);
 	
 	string getFactorLevelName(int factor_i, int level_i);
 	string getFactorString(FactorSetting setting);
 	
-	void addOneWayInteraction(int factor_i, char level_i, char **levelMatrix, vector <float>&sumOfSquares);
+	void addOneWayInteraction(int factor_i, char level_i);
 	
 	void addTWayInteractions(CSCol *csColA, int colBMax_i, int &col_i, int t,
-		Mapping **mapping, vector <float>&sumOfSquares, GroupingInfo **groupingInfo, char **levelMatrix);
-	int populateColumnData(CSCol *csCol, char **levelMatrix, int row_top, int row_len);
+		GroupingInfo **groupingInfo);
+	
+	// binary cache of the column data and coverability (see CSMatrix.cpp for the layout)
+	bool loadCache(string cacheFile);
+	void writeCache(string cacheFile);
+	// callers invalidate the row index (rowIndexValid) themselves
+	int populateColumnData(CSCol *csCol, int row_top, int row_len);
 	void randomizePaths(CSCol **array, FactorSetting *&settingToResample, Path *path, int row_top, int k, int c, long long int &score, list <Path*>*pathList, int iters);
+	void saveLevels(char *levels, int row_top);
+	void restoreLevels(char *levels, int row_top);
 	void repopulateColumns(int setFactor_i, int setLevel_i, int row_top, int row_len);
-	void repopulateColumns(int setFactor_i, int setLevel_i, int maxFactor_i, int t,
-		Mapping *mapping, char **levelMatrix, int &lastCol_i, int row_top, int row_len);
+	void repopulateColumns(int setFactor_i, int setGroup_i, int maxFactor_i, int depth, int start, bool set,
+		int row_top, int row_len);
 	int getColIndex(CSCol *csCol);
+	// the inverse of getColIndex: fills setting (room for t settings) and returns the number of factors
+	int getColSettings(int col_i, FactorSetting *setting);
 	
 	void swapColumns(CSCol **array, int col_i1, int col_i2);
 	void swapRows(CSCol **array, int row_i1, int row_i2);
@@ -114,14 +249,42 @@ private:
 	void rowSort(CSCol **array, int min, int max, int row_i, int row_len);
 	int sortByCoverable(CSCol **array, int min, int max);
 	int sortByTWayInteraction(CSCol **array, int min, int max);
+	// every Path of the construction routines comes from pathArena
+	PathArena pathArena;
+	vector <pair<Path*, int> >pathSortStack;
+	// the column positions in the work array of randomizePaths while it runs (NULL otherwise)
+	ColumnPositions *colPositions;
+	Path *newPath(int min, int max);
 	void pathSort(CSCol **array, Path *path, int row_i, int &nPaths, list <Path*>*pathList);
 	void deletePath(Path *path);
 	void pathDAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i, int k,
 		long long int &score, FactorSetting *&settingToResample, long long int *rowContributions);
 	void pathLAChecker(CSCol **array, Path *pathA, Path *pathB, int row_i, int k,
+		long long int &score, FactorSetting *&settingToResample, long long int *rowContributions,
+		PathCheck *firstLeaf = NULL);
+	void parallelPathLAChecker(CSCol **array, Path *path, int k,
 		long long int &score, FactorSetting *&settingToResample, long long int *rowContributions);
+	void splitPathChecks(CSCol **array, vector <PathCheck>&checks, int row_end, int maxChecks,
+		long long int *rowContributions);
+	void scorePathChecks(CSCol **array, vector <PathCheck>&checks, long long int *scores,
+		PathCheck *firstLeaves, long long int *rowContributions);
+	void chooseSettingFromChecks(CSCol **array, vector <PathCheck>&checks, long long int *scores,
+		PathCheck *firstLeaves, FactorSetting *&settingToResample);
+	void chooseSettingFromChecks(CSCol **array, vector <PathCheck>&checks, set <int>&scoredChecks,
+		PathCheck *firstLeaves, FactorSetting *&settingToResample);
+	void pathLAFindSetting(CSCol **array, Path *pathA, Path *pathB, int row_i, int k,
+		int &leavesToSkip, FactorSetting *&settingToResample);
+	void getPathEntries(CSCol **array, Path *path, int row_i, Path *&entryA, Path *&entryB);
+	FactorSetting *chooseSettingToResample(CSCol **array, Path *pathA, Path *pathB);
 	int compare(CSCol *csCol1, CSCol *csCol2, int row_top, int row_len);
 	
+	// incremental rescoring in randomizePaths
+	int countEntries(CSCol *csCol, int c);
+	void chooseMinCountSetting(CSCol **array, FactorSetting *&settingToResample);
+	void getFactorColumns(int setFactor_i, vector <int>&cols);
+	void getFactorColumns(int setFactor_i, int maxFactor_i, int depth, int start, vector <int>&cols);
+	void markChangedFactor(int factor_i, bool *factorChanged, bool *colChanged, vector <int>&changedCols);
+	
 	// LEGACY
 	long checkAdvanced(CSCol **array, int k, int min, int max, int row_top, int row_len, FactorSetting *&settingToResample);
 	void randomizeRows(CSCol **backupArray, CSCol **array, long long int &csScore, int row_top, int row_len);
@@ -134,15 +297,42 @@ private:
 	long long int getBruteForceArrayScore(CSCol **array, int k);
 	
 public:
-	CSMatrix(LocatingArray *locatingArray);
+	// cacheFile (optional) is loaded instead of populating the columns when it matches
+	// the locating array, and is written after populating them otherwise
+	// virtualCols (implies packed) computes the interaction columns from the main effects
+	// buildThreads (0 for all cores) populate the columns and check them
+	CSMatrix(LocatingArray *locatingArray, bool packed = true, string cacheFile = "", bool virtualCols = false,
+		int buildThreads = 1);
+	
+	/* columns of the CS matrix of locatingArray and the bytes it takes, counted without
+	enumerating it (so before allocating anything) */
+	static double countColumns(LocatingArray *locatingArray);
+	static double estimateBytes(LocatingArray *locatingArray, bool packed, bool virtualCols);
+	
+	/* whether the CS matrix of locatingArray fits in memLimit bytes (0 for no limit), switching
+	*virtualCols on when only virtual columns fit */
+	static bool fitMemory(LocatingArray *locatingArray, bool packed, double memLimit, bool *virtualCols);
 	
 	int getRows();
 	int getCols();
 	
+	void setThreads(int threads);
+	void setStarts(int starts);
+	void setSeed(uint64_t seed);
+	MoveScheduler *getMoveScheduler();
+	
 	float getDistanceToCol(int col_i, float *residuals);
 	float getProductWithCol(int col_i, float *residuals);
+	void getProductsWithCols(int residuals_n, float **residuals, float **products);
 	
 	CSCol *getCol(int col_i);
+	// the entries of column col_i (written to scratch, rows long, if the column is virtual)
+	float *getColData(int col_i, float *scratch);
+	/* the ENTRY_A rows of column col_i (rows_n of them) if it is sparse, NULL if it is dense
+	or the index is not up to date. Only reads the index, so the models can call it from
+	several threads once buildIndex is called */
+	int *getColRows(int col_i, int &rows_n);
+	void buildIndex();
 	
 	string getColName(CSCol *csCol);
 	
@@ -167,4 +357,31 @@ public:
 	~CSMatrix();
 };
 
+inline bool CSMatrix::isVirtual(CSCol *csCol) {
+	return virtualCols && csCol->factors > 1;
+}
+
+inline uint64_t CSMatrix::getWord(CSCol *csCol, int word_i) {
+	if (!isVirtual(csCol)) return csCol->bitP[word_i];
+
+	// AND the settings, each the OR of the main effects of its levels
+	uint64_t word = ~(uint64_t)0;
+	for (int setting_i = 0; setting_i < csCol->factors; setting_i++) {
+		FactorSetting *setting = &csCol->setting[setting_i];
+		int *levelCols = factorLevelMap[(int)setting->factor_i];
+
+		uint64_t settingWord = 0;
+		for (int level_i = setting->index; level_i < setting->index + setting->levelsInGroup; level_i++) {
+			settingWord |= (*data)[levelCols[level_i] + 1]->bitP[word_i];	// add 1 for INTERCEPT
+		}
+		word &= settingWord;
+	}
+	return word;
+}
+
+inline int CSMatrix::getWords(CSCol *csCol) {
+	if (!isVirtual(csCol)) return csCol->bitVector.size();
+	return (*data)[factorLevelMap[(int)csCol->setting[0].factor_i][(int)csCol->setting[0].index] + 1]->bitVector.size();
+}
+
 #endif
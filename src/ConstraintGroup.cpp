@@ -1,6 +1,6 @@
 #include "ConstraintGroup.h"
 
-ConstraintGroup::ConstraintGroup(LocatingArray *array, ifstream &ifs) {
+ConstraintGroup::ConstraintGroup(LocatingArray *array, istream &ifs) {
 	
 	// load constraint group factors
 	ifs >> factors;
@@ -27,23 +27,53 @@ ConstraintGroup::ConstraintGroup(LocatingArray *array, ifstream &ifs) {
 		boolConstraints[constraint_i] = BoolResult::readBoolResult(array, ifs);
 	}
 	
-	// link to factors in array
-	for (int factor_i = 0; factor_i < factors; factor_i++) {
-		array->getGroupingInfo()[factorIndeces[factor_i]]->conGroup = this;
-		array->getGroupingInfo()[factorIndeces[factor_i]]->conGroupIndex = factor_i;
+	// compile the conjunction of the constraints
+	for (int constraint_i = 0; constraint_i < constraints; constraint_i++) {
+		boolConstraints[constraint_i]->compile(&program);
+		if (constraint_i > 0) program.emit(OP_AND);
 	}
+	if (constraints == 0) program.emitConst(1);
 	
-	// populate groupLA
-	char *levelRow = new char[array->getFactors()];
-	char *factorLevels = new char[factors];
+	// groups too large to enumerate compile each constraint alone for searching
+	double fullFactorial = 1;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		fullFactorial *= levelCounts[factor_i];
+	}
+	lazy = (fullFactorial > GROUP_LA_MAX_ROWS);
 	
-	// loop through all locating array factors and set all to 0
-	for (int factor_i = 0; factor_i < array->getFactors(); factor_i++) {
-		levelRow[factor_i] = 0;
+	readyDepth = new int[constraints];
+	checkDepth = new int[constraints];
+	searchStack = 0;
+	if (lazy) {
+		constraintPrograms.resize(constraints);
+		for (int constraint_i = 0; constraint_i < constraints; constraint_i++) {
+			boolConstraints[constraint_i]->compile(&constraintPrograms[constraint_i]);
+			if (constraintPrograms[constraint_i].getMaxDepth() > searchStack) {
+				searchStack = constraintPrograms[constraint_i].getMaxDepth();
+			}
+			
+			// find the last 2 group factors the constraint reads
+			vector <int>readFactors;
+			constraintPrograms[constraint_i].getFactors(readFactors);
+			readyDepth[constraint_i] = -1;
+			checkDepth[constraint_i] = -1;
+			for (int factor_i = 0; factor_i < factors; factor_i++) {
+				for (size_t read_i = 0; read_i < readFactors.size(); read_i++) {
+					if (factorIndeces[factor_i] == readFactors[read_i]) {
+						checkDepth[constraint_i] = readyDepth[constraint_i];
+						readyDepth[constraint_i] = factor_i;
+						break;
+					}
+				}
+			}
+		}
 	}
 	
-	// add row of 0s to the array for use in recursive function
-	array->addLevelRow(levelRow);
+	// link to factors in array
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		array->getGroupingInfo()[factorIndeces[factor_i]]->conGroup = this;
+		array->getGroupingInfo()[factorIndeces[factor_i]]->conGroupIndex = factor_i;
+	}
 	
 	// count of each level occurrence (used for weighting)
 	int **settingCount = new int*[factors];
@@ -57,11 +87,9 @@ ConstraintGroup::ConstraintGroup(LocatingArray *array, ifstream &ifs) {
 	// count of full-factorial combinations (used for weighting)
 	int fullFactorialCount = 0;
 	
-	// call recursive populator
-	populateGroupLA(array, levelRow, factorLevels, 0, settingCount, fullFactorialCount);
+	if (!lazy) populateGroupLA(array, settingCount, fullFactorialCount);
 	
 	// assign row weights based on groupLA entries
-	char **groupLevelMatrix = groupLA->getLevelMatrix();
 	float *rowWeights = new float[groupLA->getTests()];
 	weightMin = new int[groupLA->getTests()];
 	weightMax = new int[groupLA->getTests()];
@@ -70,8 +98,8 @@ ConstraintGroup::ConstraintGroup(LocatingArray *array, ifstream &ifs) {
 	for (int row_i = 0; row_i < groupLA->getTests(); row_i++) {
 		rowWeights[row_i] = prevWeight;
 		for (int col_i = 0; col_i < factors; col_i++) {
-			rowWeights[row_i] += (float)fullFactorialCount / settingCount[col_i][groupLevelMatrix[row_i][col_i]];
-//			cout << (int)groupLevelMatrix[row_i][col_i] << "\t";
+			rowWeights[row_i] += (float)fullFactorialCount / settingCount[col_i][groupLA->getLevel(row_i, col_i)];
+//			cout << (int)groupLA->getLevel(row_i, col_i) << "\t";
 		}
 		
 		weightMin[row_i] = (int)prevWeight;
@@ -90,90 +118,376 @@ ConstraintGroup::ConstraintGroup(LocatingArray *array, ifstream &ifs) {
 	}
 	delete[] settingCount;
 	delete[] levelCounts;
-	levelRow = array->remLevelRow();
-	delete[] levelRow;
-	delete[] factorLevels;
+	
+	buildLevelRows(array);
+	
+	lazySettings = NULL;
+	lazySettings_n = 0;
+	settingSatisfiable = NULL;
+	pairMemo = NULL;
+	avoidMemo = NULL;
+	if (lazy) findLazySettings();
 }
 
-void ConstraintGroup::populateGroupLA(LocatingArray *array, char *levelRow, char *factorLevels, int fixedFactors,
-		int **settingCount, int &fullFactorialCount) {
-	if (fixedFactors == factors) {
-//		for (int factor_i = 0; factor_i < factors; factor_i++) {
-//			cout << (int)factorLevels[factor_i] << "\t";
-//		}
-//		cout << endl;
-		
-		// increment full-factorial count
-		fullFactorialCount++;
-		
-		// loop through all factors in constraint group
+void ConstraintGroup::findLazySettings() {
+	lazySettings = new FactorSetting[settings];
+	settingSatisfiable = new bool[settings];
+	
+	// keep the settings that some row of the group has
+	GroupScratch scratch;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		for (int level_i = 0; level_i < groupLA->getGroupingInfo()[factor_i]->levels; level_i++) {
+			FactorSetting *setting = &lazySettings[lazySettings_n];
+			setting->grouped = false;
+			setting->factor_i = factorIndeces[factor_i];
+			setting->index = level_i;
+			setting->levelsInGroup = 1;
+			
+			settingSatisfiable[levelStart[factor_i] + level_i] = search(setting, 1, NULL, NULL, NULL, &scratch);
+			if (settingSatisfiable[levelStart[factor_i] + level_i]) lazySettings_n++;
+		}
+	}
+	
+	if (settings <= GROUP_MEMO_MAX_SETTINGS) {
+		pairMemo = new atomic <char>[(size_t)settings * settings];
+		for (size_t memo_i = 0; memo_i < (size_t)settings * settings; memo_i++) {
+			pairMemo[memo_i] = MEMO_UNKNOWN;
+		}
+		avoidMemo = new atomic <char>[(size_t)(settings + 1) * settings];
+		for (size_t memo_i = 0; memo_i < (size_t)(settings + 1) * settings; memo_i++) {
+			avoidMemo[memo_i] = MEMO_UNKNOWN;
+		}
+	}
+	
+	if (lazySettings_n == 0) {
+		cout << "Constraint group of factor " << factorIndeces[0] << " has no row that satisfies its constraints" << endl;
+	}
+}
+
+void ConstraintGroup::buildLevelRows(LocatingArray *array) {
+	int tests = groupLA->getTests();
+	rowWords = (tests + 63) / 64;
+	
+	levelStart = new int[factors];
+	int levels = 0;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		levelStart[factor_i] = levels;
+		levels += groupLA->getGroupingInfo()[factor_i]->levels;
+	}
+	settings = levels;
+	
+	levelRows = new uint64_t[(size_t)levels * rowWords];
+	for (size_t word_i = 0; word_i < (size_t)levels * rowWords; word_i++) {
+		levelRows[word_i] = 0;
+	}
+	for (int test_i = 0; test_i < tests; test_i++) {
 		for (int factor_i = 0; factor_i < factors; factor_i++) {
-			levelRow[factorIndeces[factor_i]] = factorLevels[factor_i];
+			uint64_t *rows = &levelRows[(size_t)(levelStart[factor_i] + groupLA->getLevel(test_i, factor_i)) * rowWords];
+			rows[test_i / 64] |= (uint64_t)1 << (test_i % 64);
+		}
+	}
+	
+	arrayFactors = array->getFactors();
+	groupIndeces = new int[arrayFactors];
+	for (int factor_i = 0; factor_i < array->getFactors(); factor_i++) {
+		groupIndeces[factor_i] = -1;
+	}
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		groupIndeces[factorIndeces[factor_i]] = factor_i;
+	}
+}
+
+void ConstraintGroup::populateGroupLA(LocatingArray *array, int **settingCount, int &fullFactorialCount) {
+	
+	/* Enumerate the full-factorial design of the group in batches of rows laid out like rows of
+	the array (factors outside the group stay at level 0), with the last factor changing fastest,
+	and add the rows that satisfy the constraints to groupLA in order. */
+	int arrayFactors = array->getFactors();
+	char *batch = new char[CONSTRAINT_BATCH * arrayFactors];
+	for (int entry_i = 0; entry_i < CONSTRAINT_BATCH * arrayFactors; entry_i++) {
+		batch[entry_i] = 0;
+	}
+	bool *results = new bool[CONSTRAINT_BATCH];
+	char *factorLevels = new char[factors];
+	char *groupRow = new char[factors];
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		factorLevels[factor_i] = 0;
+	}
+	
+	bool done = false;
+	while (!done) {
+		// fill a batch
+		int n = 0;
+		while (n < CONSTRAINT_BATCH && !done) {
+			for (int factor_i = 0; factor_i < factors; factor_i++) {
+				batch[n * arrayFactors + factorIndeces[factor_i]] = factorLevels[factor_i];
+			}
+			n++;
+			
+			// advance to the next combination
+			int factor_i = factors - 1;
+			while (factor_i >= 0 &&
+					++factorLevels[factor_i] == array->getGroupingInfo()[factorIndeces[factor_i]]->levels) {
+				factorLevels[factor_i] = 0;
+				factor_i--;
+			}
+			done = (factor_i < 0);
 		}
 		
-		// add factorLevels to groupLA if group constraints are satisfied
-		if (getResult(0)) {
-			char *groupLevelRow = new char[factors];
+		getResults(batch, arrayFactors, 1, n, results);
+		fullFactorialCount += n;
+		
+		// add rows to groupLA if group constraints are satisfied
+		for (int row_i = 0; row_i < n; row_i++) {
+			if (!results[row_i]) continue;
+			
 			for (int factor_i = 0; factor_i < factors; factor_i++) {
-				groupLevelRow[factor_i] = factorLevels[factor_i];
-				
+				groupRow[factor_i] = batch[row_i * arrayFactors + factorIndeces[factor_i]];
 				// increment the setting count
-				settingCount[factor_i][factorLevels[factor_i]]++;
+				settingCount[factor_i][(int)groupRow[factor_i]]++;
 			}
-			groupLA->addLevelRow(groupLevelRow);
+			groupLA->addLevelRow(groupRow);
 		}
-	} else {
-		// call recursively for full-factorial design
-		for (int level_i = 0; level_i < array->getGroupingInfo()[factorIndeces[fixedFactors]]->levels; level_i++) {
-			factorLevels[fixedFactors] = level_i;
-			populateGroupLA(array, levelRow, factorLevels, fixedFactors + 1, settingCount, fullFactorialCount);
+	}
+	
+	delete[] batch;
+	delete[] results;
+	delete[] factorLevels;
+	delete[] groupRow;
+}
+
+// search for a row with every required setting and not the avoided one (NULL for none), copying it to levelRow
+bool ConstraintGroup::search(FactorSetting *require, int require_n, FactorSetting *avoid, Random *random,
+		char *levelRow, GroupScratch *scratch) {
+	// factors outside the group are at level 0, as when enumerating
+	if (scratch->levelRow.size() < (size_t)arrayFactors) scratch->levelRow.resize(arrayFactors, 0);
+	if (scratch->stack.size() < (size_t)searchStack * CONSTRAINT_BATCH) scratch->stack.resize(searchStack * CONSTRAINT_BATCH);
+	if (scratch->prunedAt.size() < (size_t)settings) scratch->prunedAt.resize(settings);
+	if (scratch->alive.size() < (size_t)factors) scratch->alive.resize(factors);
+	char *searchRow = &scratch->levelRow[0];
+	int *prunedAt = &scratch->prunedAt[0];
+	int *alive = &scratch->alive[0];
+	
+	for (int setting_i = 0; setting_i < settings; setting_i++) {
+		prunedAt[setting_i] = NOT_PRUNED;
+	}
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		alive[factor_i] = groupLA->getGroupingInfo()[factor_i]->levels;
+	}
+	
+	// a required level is the only one left of its factor, and the avoided level is pruned
+	for (int require_i = 0; require_i <= require_n; require_i++) {
+		FactorSetting *setting = (require_i < require_n ? &require[require_i] : avoid);
+		if (setting == NULL || groupIndeces[(int)setting->factor_i] == -1) continue;
+		
+		int factor_i = groupIndeces[(int)setting->factor_i];
+		for (int level_i = 0; level_i < groupLA->getGroupingInfo()[factor_i]->levels; level_i++) {
+			int setting_i = levelStart[factor_i] + level_i;
+			if ((level_i == setting->index) == (require_i < require_n) || prunedAt[setting_i] != NOT_PRUNED) continue;
+			prunedAt[setting_i] = -1;
+			alive[factor_i]--;
 		}
 	}
+	
+	bool found = true;
+	for (int factor_i = 0; factor_i < factors && found; factor_i++) {
+		found = (alive[factor_i] > 0);
+	}
+	
+	// constraints that read no group factor hold or fail for every row
+	for (int constraint_i = 0; constraint_i < constraints && found; constraint_i++) {
+		if (readyDepth[constraint_i] == -1) {
+			constraintPrograms[constraint_i].evaluate(searchRow, 0, 1, 1, &scratch->stack[0], &found);
+		}
+	}
+	
+	found = found && prune(-1, scratch) && searchGroup(0, random, scratch);
+	
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		if (found && levelRow != NULL) levelRow[factorIndeces[factor_i]] = searchRow[factorIndeces[factor_i]];
+		searchRow[factorIndeces[factor_i]] = 0;
+	}
+	
+	return found;
+}
+
+// assign the group factors from depth on (in a random order of levels if random is not NULL)
+bool ConstraintGroup::searchGroup(int depth, Random *random, GroupScratch *scratch) {
+	if (depth == factors) return true;
+	
+	int factor_i = factorIndeces[depth];
+	
+	// levels left to try
+	char order[256];
+	int tries = 0;
+	for (int level_i = 0; level_i < groupLA->getGroupingInfo()[depth]->levels; level_i++) {
+		if (scratch->prunedAt[levelStart[depth] + level_i] == NOT_PRUNED) order[tries++] = level_i;
+	}
+	
+	for (int try_i = 0; try_i < tries; try_i++) {
+		// draw the next level at random when sampling
+		if (random != NULL) {
+			int swap_i = try_i + random->nextInt(tries - try_i);
+			char level = order[swap_i];
+			order[swap_i] = order[try_i];
+			order[try_i] = level;
+		}
+		
+		scratch->levelRow[factor_i] = order[try_i];
+		if (prune(depth, scratch) && searchGroup(depth + 1, random, scratch)) {
+			return true;
+		}
+		unprune(depth, scratch);
+	}
+	
+	return false;
 }
 
-bool ConstraintGroup::satisfiableInGroupLA(char *requireLevelRow, char *avoidLevelRow) {
-	char **levelMatrix = groupLA->getLevelMatrix();
+// prune the levels that fail the constraints checkable once the factors up to depth are assigned
+bool ConstraintGroup::prune(int depth, GroupScratch *scratch) {
+	char *levelRow = &scratch->levelRow[0];
+	int *prunedAt = &scratch->prunedAt[0];
+	int *alive = &scratch->alive[0];
 	
-	for (int test_i = 0; test_i < groupLA->getTests(); test_i++) {
-		bool match = true;
+	for (int constraint_i = 0; constraint_i < constraints; constraint_i++) {
+		int ready = readyDepth[constraint_i];
+		if (checkDepth[constraint_i] != depth || ready == -1) continue;
 		
-		// check requireLevelRow
-		for (int factor_i = 0; factor_i < groupLA->getFactors() && match; factor_i++) {
-			// check if the required level disagrees with the LA row
-			if (requireLevelRow[factorIndeces[factor_i]] != -1 &&
-				requireLevelRow[factorIndeces[factor_i]] != levelMatrix[test_i][factor_i]) {
-				match = false;
+		for (int level_i = 0; level_i < groupLA->getGroupingInfo()[ready]->levels; level_i++) {
+			int setting_i = levelStart[ready] + level_i;
+			if (prunedAt[setting_i] != NOT_PRUNED) continue;
+			
+			bool result;
+			levelRow[factorIndeces[ready]] = level_i;
+			constraintPrograms[constraint_i].evaluate(levelRow, 0, 1, 1, &scratch->stack[0], &result);
+			if (!result) {
+				prunedAt[setting_i] = depth;
+				alive[ready]--;
 			}
 		}
 		
-		// check avoidLevelRow
-		for (int factor_i = 0; factor_i < groupLA->getFactors() && match; factor_i++) {
-			// check if the avoided level disagrees with the LA row
-			if (avoidLevelRow[factorIndeces[factor_i]] != -1 &&
-				avoidLevelRow[factorIndeces[factor_i]] == levelMatrix[test_i][factor_i]) {
-				match = false;
+		if (alive[ready] == 0) return false;
+	}
+	
+	return true;
+}
+
+// restore the levels pruned when the factor at depth was assigned
+void ConstraintGroup::unprune(int depth, GroupScratch *scratch) {
+	for (int factor_i = depth + 1; factor_i < factors; factor_i++) {
+		for (int level_i = 0; level_i < groupLA->getGroupingInfo()[factor_i]->levels; level_i++) {
+			if (scratch->prunedAt[levelStart[factor_i] + level_i] == depth) {
+				scratch->prunedAt[levelStart[factor_i] + level_i] = NOT_PRUNED;
+				scratch->alive[factor_i]++;
 			}
 		}
+	}
+}
+
+bool ConstraintGroup::satisfiableLazy(FactorSetting *require, int require_n, FactorSetting *avoid, GroupScratch *scratch) {
+	
+	// the settings of the group the query involves
+	int required[2];
+	int required_n = 0;
+	for (int require_i = 0; require_i < require_n; require_i++) {
+		int group_i = groupIndeces[(int)require[require_i].factor_i];
+		if (group_i == -1) continue;
 		
-		// check if the row satisfies
-		if (match) return true;
+		int setting_i = levelStart[group_i] + require[require_i].index;
+		if (!settingSatisfiable[setting_i]) return false;
+		if ((required_n > 0 && required[0] == setting_i) || (required_n > 1 && required[1] == setting_i)) continue;
+		if (required_n < 2) required[required_n] = setting_i;
+		required_n++;
+	}
+	int avoided = -1;
+	if (avoid != NULL && groupIndeces[(int)avoid->factor_i] != -1) {
+		avoided = levelStart[groupIndeces[(int)avoid->factor_i]] + avoid->index;
+	}
+	
+	if (avoided == -1 && required_n == 0) return (lazySettings_n > 0);
+	if (avoided == -1 && required_n == 1) return true;
+	
+	atomic <char>*memo = NULL;
+	if (pairMemo != NULL && avoided == -1 && required_n == 2) {
+		int low = (required[0] < required[1] ? required[0] : required[1]);
+		int high = (required[0] < required[1] ? required[1] : required[0]);
+		memo = &pairMemo[(size_t)low * settings + high];
+	} else if (avoidMemo != NULL && avoided != -1 && required_n < 2) {
+		memo = &avoidMemo[(size_t)(required_n == 1 ? required[0] : settings) * settings + avoided];
+	}
+	
+	if (memo != NULL) {
+		char known = memo->load(memory_order_relaxed);
+		if (known != MEMO_UNKNOWN) return (known == MEMO_TRUE);
+	}
+	
+	bool satisfiable = search(require, require_n, avoid, NULL, NULL, scratch);
+	if (memo != NULL) memo->store(satisfiable ? MEMO_TRUE : MEMO_FALSE, memory_order_relaxed);
+	
+	return satisfiable;
+}
+
+bool ConstraintGroup::satisfiableInGroupLA(FactorSetting *require, int require_n, FactorSetting *avoid, GroupScratch *scratch) {
+	
+	if (lazy) return satisfiableLazy(require, require_n, avoid, scratch);
+	
+	// settings of factors outside the group do not restrict it
+	int avoidGroup_i = (avoid == NULL ? -1 : groupIndeces[(int)avoid->factor_i]);
+	
+	// AND the rows with each required level and ANDNOT the rows with the avoided level, a word at a time
+	int tests = groupLA->getTests();
+	for (int word_i = 0; word_i < rowWords; word_i++) {
+		uint64_t rows = (word_i < rowWords - 1 || tests % 64 == 0 ? ~(uint64_t)0 : ((uint64_t)1 << (tests % 64)) - 1);
+		
+		for (int require_i = 0; require_i < require_n && rows != 0; require_i++) {
+			int group_i = groupIndeces[(int)require[require_i].factor_i];
+			if (group_i != -1) {
+				rows &= levelRows[(size_t)(levelStart[group_i] + require[require_i].index) * rowWords + word_i];
+			}
+		}
+		
+		if (avoidGroup_i != -1) {
+			rows &= ~levelRows[(size_t)(levelStart[avoidGroup_i] + avoid->index) * rowWords + word_i];
+		}
+		
+		// check if a row satisfies
+		if (rows != 0) return true;
 	}
 	
 	return false;
 }
 
-bool ConstraintGroup::getResult(int test) {
-	for (int constraint_i = 0; constraint_i < this->constraints; constraint_i++) {
-		if (!boolConstraints[constraint_i]->getResult(test)) return false;
+void ConstraintGroup::getResults(LocatingArray *array, int test_i, int tests, bool *results) {
+	getResults(array->getFactorColumn(0) + (size_t)test_i * array->getTestStride(),
+		array->getTestStride(), array->getFactorStride(), tests, results);
+}
+
+void ConstraintGroup::getResults(char *levels, size_t testStride, size_t factorStride, int tests, bool *results) {
+	float *stack = new float[program.getMaxDepth() * CONSTRAINT_BATCH];
+	for (int batch_i = 0; batch_i < tests; batch_i += CONSTRAINT_BATCH) {
+		int n = (tests - batch_i < CONSTRAINT_BATCH ? tests - batch_i : CONSTRAINT_BATCH);
+		program.evaluate(levels + batch_i * testStride, testStride, factorStride, n, stack, &results[batch_i]);
 	}
-	return true;
+	delete[] stack;
 }
 
-void ConstraintGroup::randPopulateLevelRow(char *levelRow) {
+void ConstraintGroup::randPopulateLevelRow(char *levelRow, Random &random, GroupScratch *scratch) {
+	
+	if (lazy) {
+		// no row satisfies the group (reported when it was built), so leave the levels as they are
+		if (lazySettings_n == 0) return;
+		
+		// draw a setting, then search for a row with it, trying the levels of each factor in random order
+		FactorSetting *setting = &lazySettings[random.nextInt(lazySettings_n)];
+		if (!search(setting, 1, NULL, &random, levelRow, scratch)) {
+			cout << "No row satisfies the constraint group of factor " << factorIndeces[0] << endl;
+		}
+		return;
+	}
+	
 	GroupingInfo **groupingInfo = groupLA->getGroupingInfo();
-	char **levelMatrix = groupLA->getLevelMatrix();
 	
-	int weightRand = rand() % weightRandMax;
+	int weightRand = random.nextInt(weightRandMax);
 	
 	// use binary search to find weight window with weightRand
 	int botRow = 0;
@@ -196,11 +510,11 @@ void ConstraintGroup::randPopulateLevelRow(char *levelRow) {
 	}
 	
 	for (int factor_i = 0; factor_i < factors; factor_i++) {
-		levelRow[factorIndeces[factor_i]] = levelMatrix[topRow][factor_i];
+		levelRow[factorIndeces[factor_i]] = groupLA->getLevel(topRow, factor_i);
 	}
 }
 
-void ConstraintGroup::writeToStream(ofstream &ofs) {
+void ConstraintGroup::writeToStream(ostream &ofs) {
 	// write constraint group factors
 	ofs << factors;
 	for (int factor_i = 0; factor_i < factors; factor_i++) {
@@ -216,10 +530,28 @@ void ConstraintGroup::writeToStream(ofstream &ofs) {
 	}
 }
 
+LocatingArray *ConstraintGroup::getGroupLA() {
+	return groupLA;
+}
+
+bool ConstraintGroup::isLazy() {
+	return lazy;
+}
+
 ConstraintGroup::~ConstraintGroup() {
 	delete[] weightMin;
 	delete[] weightMax;
 	
+	delete[] levelStart;
+	delete[] levelRows;
+	delete[] groupIndeces;
+	delete[] readyDepth;
+	delete[] checkDepth;
+	delete[] lazySettings;
+	delete[] settingSatisfiable;
+	delete[] pairMemo;
+	delete[] avoidMemo;
+	
 	delete[] factorIndeces;
 	
 	delete groupLA;
@@ -230,11 +562,118 @@ ConstraintGroup::~ConstraintGroup() {
 	delete[] boolConstraints;
 }
 
+ConstraintProgram::ConstraintProgram() {
+	depth = 0;
+	maxDepth = 0;
+}
+
+void ConstraintProgram::push(ConstraintOp &op, int pops) {
+	ops.push_back(op);
+	depth += 1 - pops;
+	if (depth > maxDepth) maxDepth = depth;
+}
+
+void ConstraintProgram::emitConst(float value) {
+	ConstraintOp op;
+	op.code = OP_CONST;
+	op.value = value;
+	push(op, 0);
+}
+
+void ConstraintProgram::emitFactor(LocatingArray *array, int factor_i) {
+	ConstraintOp op;
+	op.code = OP_FACTOR;
+	op.factor_i = factor_i;
+	
+	// look up the numeric levels once, here
+	op.values_i = levelValues.size();
+	for (int level_i = 0; level_i < array->getGroupingInfo()[factor_i]->levels; level_i++) {
+		levelValues.push_back(array->getFactorData()->getNumericFactorLevel(factor_i, level_i));
+	}
+	
+	push(op, 0);
+}
+
+void ConstraintProgram::emit(char code) {
+	ConstraintOp op;
+	op.code = code;
+	push(op, 2);
+}
+
+int ConstraintProgram::getMaxDepth() {
+	return maxDepth;
+}
+
+void ConstraintProgram::getFactors(vector <int>&factors) {
+	for (size_t op_i = 0; op_i < ops.size(); op_i++) {
+		if (ops[op_i].code == OP_FACTOR) factors.push_back(ops[op_i].factor_i);
+	}
+}
+
+void ConstraintProgram::evaluate(char *levels, size_t testStride, size_t factorStride, int n, float *stack, bool *results) {
+	float *top = stack - CONSTRAINT_BATCH;	// entry on top of the stack
+	
+	for (size_t op_i = 0; op_i < ops.size(); op_i++) {
+		ConstraintOp &op = ops[op_i];
+		
+		if (op.code == OP_CONST) {
+			top += CONSTRAINT_BATCH;
+			for (int test_i = 0; test_i < n; test_i++) {
+				top[test_i] = op.value;
+			}
+			continue;
+		} else if (op.code == OP_FACTOR) {
+			top += CONSTRAINT_BATCH;
+			char *factorLevels = levels + op.factor_i * factorStride;
+			float *values = &levelValues[op.values_i];
+			for (int test_i = 0; test_i < n; test_i++) {
+				top[test_i] = values[(int)factorLevels[test_i * testStride]];
+			}
+			continue;
+		}
+		
+		// binary ops replace the 2 top entries with their result
+		float *lhs = top - CONSTRAINT_BATCH;
+		float *rhs = top;
+		switch (op.code) {
+		case OP_ADD:
+			for (int test_i = 0; test_i < n; test_i++) lhs[test_i] = lhs[test_i] + rhs[test_i];
+			break;
+		case OP_MUL:
+			for (int test_i = 0; test_i < n; test_i++) lhs[test_i] = lhs[test_i] * rhs[test_i];
+			break;
+		case OP_DIV:
+			for (int test_i = 0; test_i < n; test_i++) lhs[test_i] = lhs[test_i] / rhs[test_i];
+			break;
+		case OP_EQ:
+			for (int test_i = 0; test_i < n; test_i++) lhs[test_i] = (lhs[test_i] == rhs[test_i]);
+			break;
+		case OP_LTEQ:
+			for (int test_i = 0; test_i < n; test_i++) lhs[test_i] = (lhs[test_i] <= rhs[test_i]);
+			break;
+		case OP_GT:
+			for (int test_i = 0; test_i < n; test_i++) lhs[test_i] = (lhs[test_i] > rhs[test_i]);
+			break;
+		case OP_IF:
+			for (int test_i = 0; test_i < n; test_i++) lhs[test_i] = (lhs[test_i] == 0 || rhs[test_i] != 0);
+			break;
+		case OP_AND:
+			for (int test_i = 0; test_i < n; test_i++) lhs[test_i] = (lhs[test_i] != 0 && rhs[test_i] != 0);
+			break;
+		}
+		top = lhs;
+	}
+	
+	for (int test_i = 0; test_i < n; test_i++) {
+		results[test_i] = (top[test_i] != 0);
+	}
+}
+
 BoolResult::BoolResult(LocatingArray *array) {
 	this->array = array;
 }
 
-BoolResult *BoolResult::readBoolResult(LocatingArray *array, ifstream &ifs) {
+BoolResult *BoolResult::readBoolResult(LocatingArray *array, istream &ifs) {
 	string type;
 	ifs >> type;
 	
@@ -258,7 +697,7 @@ FloatResult::FloatResult(LocatingArray *array) {
 	this->array = array;
 }
 
-FloatResult *FloatResult::readFloatResult(LocatingArray *array, ifstream &ifs) {
+FloatResult *FloatResult::readFloatResult(LocatingArray *array, istream &ifs) {
 	string type;
 	ifs >> type;
 	
@@ -280,7 +719,7 @@ FloatResult::~FloatResult() {
 	// needs to be defined because it must be virtual
 }
 
-EqResult::EqResult(LocatingArray *array, ifstream &ifs): BoolResult(array) {
+EqResult::EqResult(LocatingArray *array, istream &ifs): BoolResult(array) {
 	floatResult1 = FloatResult::readFloatResult(array, ifs);
 	floatResult2 = FloatResult::readFloatResult(array, ifs);
 }
@@ -289,7 +728,13 @@ bool EqResult::getResult(int test) {
 	return floatResult1->getResult(test) == floatResult2->getResult(test);
 }
 
-void EqResult::writeToStream(ofstream &ofs) {
+void EqResult::compile(ConstraintProgram *program) {
+	floatResult1->compile(program);
+	floatResult2->compile(program);
+	program->emit(OP_EQ);
+}
+
+void EqResult::writeToStream(ostream &ofs) {
 	ofs << "\t==";
 	floatResult1->writeToStream(ofs);
 	floatResult2->writeToStream(ofs);
@@ -300,7 +745,7 @@ EqResult::~EqResult() {
 	delete floatResult2;
 }
 
-LtEqResult::LtEqResult(LocatingArray *array, ifstream &ifs): BoolResult(array) {
+LtEqResult::LtEqResult(LocatingArray *array, istream &ifs): BoolResult(array) {
 	floatResult1 = FloatResult::readFloatResult(array, ifs);
 	floatResult2 = FloatResult::readFloatResult(array, ifs);
 }
@@ -309,7 +754,13 @@ bool LtEqResult::getResult(int test) {
 	return floatResult1->getResult(test) <= floatResult2->getResult(test);
 }
 
-void LtEqResult::writeToStream(ofstream &ofs) {
+void LtEqResult::compile(ConstraintProgram *program) {
+	floatResult1->compile(program);
+	floatResult2->compile(program);
+	program->emit(OP_LTEQ);
+}
+
+void LtEqResult::writeToStream(ostream &ofs) {
 	ofs << "\t<=";
 	floatResult1->writeToStream(ofs);
 	floatResult2->writeToStream(ofs);
@@ -320,7 +771,7 @@ LtEqResult::~LtEqResult() {
 	delete floatResult2;
 }
 
-GtResult::GtResult(LocatingArray *array, ifstream &ifs): BoolResult(array) {
+GtResult::GtResult(LocatingArray *array, istream &ifs): BoolResult(array) {
 	floatResult1 = FloatResult::readFloatResult(array, ifs);
 	floatResult2 = FloatResult::readFloatResult(array, ifs);
 }
@@ -329,7 +780,13 @@ bool GtResult::getResult(int test) {
 	return floatResult1->getResult(test) > floatResult2->getResult(test);
 }
 
-void GtResult::writeToStream(ofstream &ofs) {
+void GtResult::compile(ConstraintProgram *program) {
+	floatResult1->compile(program);
+	floatResult2->compile(program);
+	program->emit(OP_GT);
+}
+
+void GtResult::writeToStream(ostream &ofs) {
 	ofs << "\t>";
 	floatResult1->writeToStream(ofs);
 	floatResult2->writeToStream(ofs);
@@ -340,7 +797,7 @@ GtResult::~GtResult() {
 	delete floatResult2;
 }
 
-IfResult::IfResult(LocatingArray *array, ifstream &ifs): BoolResult(array) {
+IfResult::IfResult(LocatingArray *array, istream &ifs): BoolResult(array) {
 	boolResult1 = BoolResult::readBoolResult(array, ifs);
 	boolResult2 = BoolResult::readBoolResult(array, ifs);
 }
@@ -349,7 +806,13 @@ bool IfResult::getResult(int test) {
 	return !boolResult1->getResult(test) || boolResult2->getResult(test);
 }
 
-void IfResult::writeToStream(ofstream &ofs) {
+void IfResult::compile(ConstraintProgram *program) {
+	boolResult1->compile(program);
+	boolResult2->compile(program);
+	program->emit(OP_IF);
+}
+
+void IfResult::writeToStream(ostream &ofs) {
 	ofs << "\tIF";
 	boolResult1->writeToStream(ofs);
 	boolResult2->writeToStream(ofs);
@@ -360,7 +823,7 @@ IfResult::~IfResult() {
 	delete boolResult2;
 }
 
-AdditionResult::AdditionResult(LocatingArray *array, ifstream &ifs): FloatResult(array) {
+AdditionResult::AdditionResult(LocatingArray *array, istream &ifs): FloatResult(array) {
 	floatResult1 = FloatResult::readFloatResult(array, ifs);
 	floatResult2 = FloatResult::readFloatResult(array, ifs);
 }
@@ -369,7 +832,13 @@ float AdditionResult::getResult(int test) {
 	return floatResult1->getResult(test) + floatResult2->getResult(test);
 }
 
-void AdditionResult::writeToStream(ofstream &ofs) {
+void AdditionResult::compile(ConstraintProgram *program) {
+	floatResult1->compile(program);
+	floatResult2->compile(program);
+	program->emit(OP_ADD);
+}
+
+void AdditionResult::writeToStream(ostream &ofs) {
 	ofs << "\t+";
 	floatResult1->writeToStream(ofs);
 	floatResult2->writeToStream(ofs);
@@ -380,7 +849,7 @@ AdditionResult::~AdditionResult() {
 	delete floatResult2;
 }
 
-MultiplicationResult::MultiplicationResult(LocatingArray *array, ifstream &ifs): FloatResult(array) {
+MultiplicationResult::MultiplicationResult(LocatingArray *array, istream &ifs): FloatResult(array) {
 	floatResult1 = FloatResult::readFloatResult(array, ifs);
 	floatResult2 = FloatResult::readFloatResult(array, ifs);
 }
@@ -389,7 +858,13 @@ float MultiplicationResult::getResult(int test) {
 	return floatResult1->getResult(test) * floatResult2->getResult(test);
 }
 
-void MultiplicationResult::writeToStream(ofstream &ofs) {
+void MultiplicationResult::compile(ConstraintProgram *program) {
+	floatResult1->compile(program);
+	floatResult2->compile(program);
+	program->emit(OP_MUL);
+}
+
+void MultiplicationResult::writeToStream(ostream &ofs) {
 	ofs << "\t*";
 	floatResult1->writeToStream(ofs);
 	floatResult2->writeToStream(ofs);
@@ -400,7 +875,7 @@ MultiplicationResult::~MultiplicationResult() {
 	delete floatResult2;
 }
 
-DivisionResult::DivisionResult(LocatingArray *array, ifstream &ifs): FloatResult(array) {
+DivisionResult::DivisionResult(LocatingArray *array, istream &ifs): FloatResult(array) {
 	floatResult1 = FloatResult::readFloatResult(array, ifs);
 	floatResult2 = FloatResult::readFloatResult(array, ifs);
 }
@@ -409,7 +884,13 @@ float DivisionResult::getResult(int test) {
 	return floatResult1->getResult(test) / floatResult2->getResult(test);
 }
 
-void DivisionResult::writeToStream(ofstream &ofs) {
+void DivisionResult::compile(ConstraintProgram *program) {
+	floatResult1->compile(program);
+	floatResult2->compile(program);
+	program->emit(OP_DIV);
+}
+
+void DivisionResult::writeToStream(ostream &ofs) {
 	ofs << "\t/";
 	floatResult1->writeToStream(ofs);
 	floatResult2->writeToStream(ofs);
@@ -420,7 +901,7 @@ DivisionResult::~DivisionResult() {
 	delete floatResult2;
 }
 
-ConstantResult::ConstantResult(LocatingArray *array, ifstream &ifs): FloatResult(array) {
+ConstantResult::ConstantResult(LocatingArray *array, istream &ifs): FloatResult(array) {
 	ifs >> value;
 }
 
@@ -428,18 +909,26 @@ float ConstantResult::getResult(int test) {
 	return value;
 }
 
-void ConstantResult::writeToStream(ofstream &ofs) {
+void ConstantResult::compile(ConstraintProgram *program) {
+	program->emitConst(value);
+}
+
+void ConstantResult::writeToStream(ostream &ofs) {
 	ofs << "\tC\t" << value;
 }
 
-FactorAssignment::FactorAssignment(LocatingArray *array, ifstream &ifs): FloatResult(array) {
+FactorAssignment::FactorAssignment(LocatingArray *array, istream &ifs): FloatResult(array) {
 	ifs >> factor_i;
 }
 
 float FactorAssignment::getResult(int test) {
-	return array->getFactorData()->getNumericFactorLevel(factor_i, array->getLevelMatrix()[test][factor_i]);
+	return array->getFactorData()->getNumericFactorLevel(factor_i, array->getLevel(test, factor_i));
+}
+
+void FactorAssignment::compile(ConstraintProgram *program) {
+	program->emitFactor(array, factor_i);
 }
 
-void FactorAssignment::writeToStream(ofstream &ofs) {
+void FactorAssignment::writeToStream(ostream &ofs) {
 	ofs << "\tF\t" << factor_i;
 }
@@ -1,16 +1,89 @@
 #ifndef CONSTRAINTGROUP_H
 #define CONSTRAINTGROUP_H
 
+#include <atomic>
 #include <cstdlib>
 #include <iostream>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "LocatingArray.h"
 #include "FactorData.h"
+#include "Random.h"
 
 using namespace std;
 
 class LocatingArray;
+struct FactorSetting;
+
+// opcodes of a compiled constraint program
+#define OP_CONST	0	// push value
+#define OP_FACTOR	1	// push the numeric level of factor_i
+#define OP_ADD		2	// pop 2, push their sum
+#define OP_MUL		3
+#define OP_DIV		4
+#define OP_EQ		5	// pop 2, push 1 if true and 0 if false
+#define OP_LTEQ		6
+#define OP_GT		7
+#define OP_IF		8	// pop 2, push 1 unless the first is true and the second false
+#define OP_AND		9
+
+// tests evaluated together by a constraint program
+#define CONSTRAINT_BATCH	64
+
+// groups with a larger full factorial are searched lazily instead of enumerated into groupLA
+#ifndef GROUP_LA_MAX_ROWS
+#define GROUP_LA_MAX_ROWS	1048576
+#endif
+
+// lazy groups with at most this many settings remember the queries on one or two of them
+#ifndef GROUP_MEMO_MAX_SETTINGS
+#define GROUP_MEMO_MAX_SETTINGS	2048
+#endif
+#define MEMO_UNKNOWN	0
+#define MEMO_FALSE		1
+#define MEMO_TRUE		2
+
+// prunedAt of a setting a lazy search has not pruned
+#define NOT_PRUNED		-2
+
+struct ConstraintOp {
+	char code;
+	int factor_i;		// OP_FACTOR
+	int values_i;		// OP_FACTOR: numeric levels of factor_i start at levelValues[values_i]
+	float value;		// OP_CONST
+};
+
+/*
+	The constraints of a group compiled to a stack program in postfix order, so they can be
+	evaluated without walking the BoolResult/FloatResult trees. Each stack entry holds a value
+	for every test of a batch (truth values are 1 or 0), and each op is a plain loop over the
+	batch. evaluate only reads the program, so threads can share it.
+*/
+class ConstraintProgram {
+private:
+	vector <ConstraintOp>ops;
+	vector <float>levelValues;
+	int depth;
+	int maxDepth;
+	
+	void push(ConstraintOp &op, int pops);
+public:
+	ConstraintProgram();
+	
+	void emitConst(float value);
+	void emitFactor(LocatingArray *array, int factor_i);
+	void emit(char code);
+	
+	int getMaxDepth();
+	// the factors the program reads
+	void getFactors(vector <int>&factors);
+	
+	/* evaluate for n tests (at most CONSTRAINT_BATCH), where the level of test_i and factor_i is
+	levels[test_i * testStride + factor_i * factorStride], using a stack of getMaxDepth() * CONSTRAINT_BATCH */
+	void evaluate(char *levels, size_t testStride, size_t factorStride, int n, float *stack, bool *results);
+};
 
 class BoolResult {
 protected:
@@ -18,10 +91,11 @@ protected:
 public:
 	BoolResult(LocatingArray *array);
 	
-	static BoolResult *readBoolResult(LocatingArray *array, ifstream &ifs);
+	static BoolResult *readBoolResult(LocatingArray *array, istream &ifs);
 	
 	virtual bool getResult(int test) = 0;
-	virtual void writeToStream(ofstream &ofs) = 0;
+	virtual void compile(ConstraintProgram *program) = 0;
+	virtual void writeToStream(ostream &ofs) = 0;
 	
 	virtual ~BoolResult();
 };
@@ -32,35 +106,105 @@ protected:
 public:
 	FloatResult(LocatingArray *array);
 	
-	static FloatResult *readFloatResult(LocatingArray *array, ifstream &ifs);
+	static FloatResult *readFloatResult(LocatingArray *array, istream &ifs);
 	
 	virtual float getResult(int test) = 0;
-	virtual void writeToStream(ofstream &ofs) = 0;
+	virtual void compile(ConstraintProgram *program) = 0;
+	virtual void writeToStream(ostream &ofs) = 0;
 	
 	virtual ~FloatResult();
 };
 
+/* Buffers of the searches of lazy constraint groups. Each thread passes its own, so once they
+have grown to the largest group the searches allocate nothing. */
+class GroupScratch {
+public:
+	vector <char>levelRow;	// a row of the array (factors outside the group stay at level 0)
+	vector <float>stack;
+	vector <int>prunedAt;	// depth that pruned each setting of the group (NOT_PRUNED if none)
+	vector <int>alive;		// settings of the factor at each depth that are not pruned
+};
+
 class ConstraintGroup {
 private:
 	LocatingArray *groupLA;
 	
 	int constraints;
 	BoolResult** boolConstraints;
+	ConstraintProgram program;	// the conjunction of boolConstraints
 	
 	// there exists a weight window for each row (larger weight window means more likely to be chosen)
 	int *weightMin;		// bottom of weight window for each row
 	int *weightMax;		// top of weight window for each row
 	int weightRandMax;
+	
+	/* Rows of groupLA by setting, as bitsets of rowWords words (row_i is bit
+	row_i % 64 of word row_i / 64). The rows in which the factor at index factor_i of
+	the group has level level_i are levelRows[(levelStart[factor_i] + level_i) * rowWords].
+	groupIndeces maps a factor of the main array to its index in the group (-1 if
+	not in the group). */
+	int rowWords;
+	int *levelStart;
+	uint64_t *levelRows;
+	int *groupIndeces;
+	int arrayFactors;
+	void buildLevelRows(LocatingArray *array);
+	
+	/* A lazy group never enumerates its full factorial, so groupLA stays empty. Queries search
+	the levels of the group factors in order instead, with forward checking: each constraint
+	(compiled alone into constraintPrograms) reads group factors up to readyDepth (-1 if it reads
+	none), and once the others are assigned, at checkDepth (-1 if it reads no other), it prunes
+	the levels of the factor at readyDepth that fail it. The search backtracks as soon as a
+	factor has no level left, and the levels it reaches satisfy every constraint ready there. */
+	bool lazy;
+	vector <ConstraintProgram>constraintPrograms;
+	int *readyDepth;
+	int *checkDepth;
+	int searchStack;
+	int settings;	// levels of all the group factors, numbered by levelStart
+	bool search(FactorSetting *require, int require_n, FactorSetting *avoid, Random *random,
+		char *levelRow, GroupScratch *scratch);
+	bool searchGroup(int depth, Random *random, GroupScratch *scratch);
+	bool prune(int depth, GroupScratch *scratch);
+	void unprune(int depth, GroupScratch *scratch);
+	
+	/* The queries of a lazy group on one or two of its settings never change, so they are
+	answered once. settingSatisfiable[setting_i] is whether some row has the setting. For
+	groups of at most GROUP_MEMO_MAX_SETTINGS settings, pairMemo[setting1_i * settings +
+	setting2_i] is whether some row has both settings, and avoidMemo[setting_i * settings +
+	avoid_i] whether some row has the setting but not the avoided one (setting_i == settings
+	for no setting), each MEMO_UNKNOWN until a query asks. Threads may fill them at once. */
+	bool *settingSatisfiable;
+	atomic <char>*pairMemo;
+	atomic <char>*avoidMemo;
+	bool satisfiableLazy(FactorSetting *require, int require_n, FactorSetting *avoid, GroupScratch *scratch);
+	
+	/* A lazy group samples rows with the same level weighting as the rows of groupLA: a row there
+	is drawn with probability proportional to the sum, over its factors, of the inverse count of
+	rows sharing that factor's level. That is the same as drawing one of the lazySettings_n
+	settings of a group factor that some row satisfies (lazySettings) uniformly, then a row with
+	it. The row is found by a randomized search, so unlike groupLA it is not uniform among the
+	rows with the setting. */
+	FactorSetting *lazySettings;
+	int lazySettings_n;
+	void findLazySettings();
 public:
 	int factors;
 	int *factorIndeces;
 	
-	ConstraintGroup(LocatingArray *array, ifstream &ifs);
-	void populateGroupLA(LocatingArray *array, char *levelRow, char *factorLevels, int fixedFactors, int **settingCount, int &fullFactorialCount);
-	bool satisfiableInGroupLA(char *requireLevelRow, char *avoidLevelRow);
-	virtual bool getResult(int test);
-	void randPopulateLevelRow(char *levelRow);
-	void writeToStream(ofstream &ofs);
+	ConstraintGroup(LocatingArray *array, istream &ifs);
+	void populateGroupLA(LocatingArray *array, int **settingCount, int &fullFactorialCount);
+	/* whether a row of groupLA has every required setting and not the avoided one (NULL for none),
+	searching with the buffers of scratch when the group is lazy */
+	bool satisfiableInGroupLA(FactorSetting *require, int require_n, FactorSetting *avoid, GroupScratch *scratch);
+	// whether each of tests tests of array from test_i satisfies the constraints
+	void getResults(LocatingArray *array, int test_i, int tests, bool *results);
+	void getResults(char *levels, size_t testStride, size_t factorStride, int tests, bool *results);
+	void randPopulateLevelRow(char *levelRow, Random &random, GroupScratch *scratch);
+	void writeToStream(ostream &ofs);
+	
+	LocatingArray *getGroupLA();
+	bool isLazy();
 	
 	virtual ~ConstraintGroup();
 };
@@ -70,9 +214,10 @@ private:
 	FloatResult *floatResult1; // LHS of Eq equation
 	FloatResult *floatResult2; // RHS of Eq equation
 public:
-	EqResult(LocatingArray *array, ifstream &ifs);
+	EqResult(LocatingArray *array, istream &ifs);
 	virtual bool getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 	virtual ~EqResult();
 };
 
@@ -81,9 +226,10 @@ private:
 	FloatResult *floatResult1; // LHS of LtEq equation
 	FloatResult *floatResult2; // RHS of LtEq equation
 public:
-	LtEqResult(LocatingArray *array, ifstream &ifs);
+	LtEqResult(LocatingArray *array, istream &ifs);
 	virtual bool getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 	virtual ~LtEqResult();
 };
 
@@ -92,9 +238,10 @@ private:
 	FloatResult *floatResult1; // LHS of Gt equation
 	FloatResult *floatResult2; // RHS of Gt equation
 public:
-	GtResult(LocatingArray *array, ifstream &ifs);
+	GtResult(LocatingArray *array, istream &ifs);
 	virtual bool getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 	virtual ~GtResult();
 };
 
@@ -103,9 +250,10 @@ private:
 	BoolResult *boolResult1; // If this is true
 	BoolResult *boolResult2; // Then this must also be true
 public:
-	IfResult(LocatingArray *array, ifstream &ifs);
+	IfResult(LocatingArray *array, istream &ifs);
 	virtual bool getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 	virtual ~IfResult();
 };
 
@@ -114,9 +262,10 @@ private:
 	FloatResult *floatResult1;
 	FloatResult *floatResult2;
 public:
-	AdditionResult(LocatingArray *array, ifstream &ifs);
+	AdditionResult(LocatingArray *array, istream &ifs);
 	virtual float getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 	virtual ~AdditionResult();
 };
 
@@ -125,9 +274,10 @@ private:
 	FloatResult *floatResult1;
 	FloatResult *floatResult2;
 public:
-	MultiplicationResult(LocatingArray *array, ifstream &ifs);
+	MultiplicationResult(LocatingArray *array, istream &ifs);
 	virtual float getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 	virtual ~MultiplicationResult();
 };
 
@@ -136,9 +286,10 @@ private:
 	FloatResult *floatResult1;
 	FloatResult *floatResult2;
 public:
-	DivisionResult(LocatingArray *array, ifstream &ifs);
+	DivisionResult(LocatingArray *array, istream &ifs);
 	virtual float getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 	virtual ~DivisionResult();
 };
 
@@ -146,18 +297,20 @@ class ConstantResult: public FloatResult {
 private:
 	float value;
 public:
-	ConstantResult(LocatingArray *array, ifstream &ifs);
+	ConstantResult(LocatingArray *array, istream &ifs);
 	float getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 };
 
 class FactorAssignment: public FloatResult {
 private:
 	int factor_i;
 public:
-	FactorAssignment(LocatingArray *array, ifstream &ifs);
+	FactorAssignment(LocatingArray *array, istream &ifs);
 	float getResult(int test);
-	virtual void writeToStream(ofstream &ofs);
+	virtual void compile(ConstraintProgram *program);
+	virtual void writeToStream(ostream &ofs);
 };
 
 #endif
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <climits>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -9,6 +10,12 @@
 #include <sstream>
 #include <string>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include <Rcpp.h>
 #include<RcppCommon.h>
 #include "Model.h"
@@ -23,6 +30,8 @@ LocatingArray::LocatingArray(int factors, int *levelCounts) {
 
 	t = 1;
 
+	initLevelData();
+
 	factorGrouping = new GroupingInfo*[factors];
 
 	// load the level counts and grouping for the factors
@@ -41,15 +50,35 @@ LocatingArray::LocatingArray(int factors, int *levelCounts) {
 	conGroups = new ConstraintGroup*[nConGroups];
 
 	factorData = NULL;
+	sharesFactors = false;
+
+	mappedFile = NULL;
+	mappedSize = 0;
 
 }
 
-LocatingArray::LocatingArray(string file, string factorDataFile) {
+LocatingArray::LocatingArray(string file, string factorDataFile, int t) {
 	int tempData;
 	string tempString;
 
+	this->t = t;
+
+	sharesFactors = false;
+	mappedFile = NULL;
+	mappedSize = 0;
+
 	ifstream ifs(file.c_str(), ifstream::in);
 
+	// check for the binary format
+	char magic[8];
+	if (ifs.read(magic, 8) && memcmp(magic, laBinaryMagic, 8) == 0) {
+		ifs.close();
+		loadBinary(file, factorDataFile);
+		return;
+	}
+	ifs.clear();
+	ifs.seekg(0);
+
 	// verify version
 	ifs >> tempString;
 	if (tempString != laVersion) {
@@ -60,12 +89,14 @@ LocatingArray::LocatingArray(string file, string factorDataFile) {
 	}
 
 	// read the first 2 lines of locating array
-	ifs >> tests;
+	int rows;
+	ifs >> rows;
 	ifs >> factors;
+	tests = 0;
 
-	t = 2;
+	initLevelData();
 
-	cout << tests << ", " << factors << endl;
+	cout << rows << ", " << factors << endl;
 	factorGrouping = new GroupingInfo*[factors];
 
 	// load the level counts for the factors
@@ -116,9 +147,10 @@ LocatingArray::LocatingArray(string file, string factorDataFile) {
 		conGroups[iConGroup] = new ConstraintGroup(this, ifs);
 	}
 
-	// load the tests now
-	for (int test_i = 0; test_i < tests; test_i++) {
-		char *levelRow = new char[factors];
+	// load the tests now (the level matrix is allocated once for all of them)
+	relayoutLevelData(rows, false);
+	char *levelRow = new char[factors];
+	for (int test_i = 0; test_i < rows; test_i++) {
 
 		// now load each factor level for this specific test
 		for (int factor_i = 0; factor_i < factors; factor_i++) {
@@ -127,8 +159,8 @@ LocatingArray::LocatingArray(string file, string factorDataFile) {
 		}
 
 		addLevelRow(levelRow);
-		tests--;
 	}
+	delete[] levelRow;
 
 	ifs.close();
 
@@ -136,28 +168,131 @@ LocatingArray::LocatingArray(string file, string factorDataFile) {
 
 }
 
+LocatingArray::LocatingArray(LocatingArray *source) {
+	factors = source->factors;
+	t = source->t;
+	tests = 0;
+
+	initLevelData();
+	copyLevels(source);
+
+	factorGrouping = source->factorGrouping;
+	nConGroups = source->nConGroups;
+	conGroups = source->conGroups;
+	factorData = source->factorData;
+	sharesFactors = true;
 
+	mappedFile = NULL;
+	mappedSize = 0;
+}
 
 
 
+
+
+// start with an empty row-major level matrix
+void LocatingArray::initLevelData() {
+	levelData = NULL;
+	capacity = 0;
+	columnMajor = false;
+	testStride = factors;
+	factorStride = 1;
+	ownsLevelData = true;
+}
+
+// move the level matrix into a new buffer with room for newCapacity tests
+void LocatingArray::relayoutLevelData(int newCapacity, bool newColumnMajor) {
+	char *newData = new char[(size_t)newCapacity * factors];
+	size_t newTestStride = newColumnMajor ? 1 : factors;
+	size_t newFactorStride = newColumnMajor ? newCapacity : 1;
+
+	if (tests > 0 && !columnMajor && !newColumnMajor) {
+		// rows are already packed at the start of the buffer
+		memcpy(newData, levelData, (size_t)tests * factors);
+	} else if (tests > 0 && columnMajor && newColumnMajor) {
+		for (int factor_i = 0; factor_i < factors; factor_i++) {
+			memcpy(newData + factor_i * newFactorStride, levelData + factor_i * factorStride, tests);
+		}
+	} else {
+		for (int test_i = 0; test_i < tests; test_i++) {
+			for (int factor_i = 0; factor_i < factors; factor_i++) {
+				newData[test_i * newTestStride + factor_i * newFactorStride] = getLevel(test_i, factor_i);
+			}
+		}
+	}
+
+	if (ownsLevelData) {
+		delete[] levelData;
+	}
+
+	levelData = newData;
+	capacity = newCapacity;
+	columnMajor = newColumnMajor;
+	testStride = newTestStride;
+	factorStride = newFactorStride;
+	ownsLevelData = true;
+}
+
 void LocatingArray::addLevelRow(char *levelRow) {
-	levels.push_back(levelRow);
+	// grow geometrically so adding rows one at a time is amortised O(factors)
+	if (tests == capacity) {
+		relayoutLevelData(capacity < 16 ? 16 : capacity * 2, columnMajor);
+	}
+
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		setLevel(tests, factor_i, levelRow[factor_i]);
+	}
 	tests++;
 }
 
-char *LocatingArray::remLevelRow() {
-	char *levelRow = levels.back();
-	levels.pop_back();
+void LocatingArray::remLevelRow() {
 	tests--;
-	return levelRow;
 }
 
-GroupingInfo **LocatingArray::getGroupingInfo() {
-	return factorGrouping;
+void LocatingArray::getLevelRow(int test_i, char *levelRow) {
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		levelRow[factor_i] = getLevel(test_i, factor_i);
+	}
 }
 
-char **LocatingArray::getLevelMatrix() {
-	return &levels[0];
+void LocatingArray::swapLevelRows(int test_i1, int test_i2) {
+	char tempLevel;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		tempLevel = getLevel(test_i1, factor_i);
+		setLevel(test_i1, factor_i, getLevel(test_i2, factor_i));
+		setLevel(test_i2, factor_i, tempLevel);
+	}
+}
+
+void LocatingArray::copyLevels(LocatingArray *source) {
+	// the old levels are not needed, so drop them before any relayout
+	tests = 0;
+	if (!ownsLevelData || capacity < source->tests || columnMajor != source->columnMajor) {
+		relayoutLevelData(source->capacity, source->columnMajor);
+	}
+
+	tests = source->tests;
+	if (columnMajor) {
+		for (int factor_i = 0; factor_i < factors; factor_i++) {
+			memcpy(getFactorColumn(factor_i), source->getFactorColumn(factor_i), tests);
+		}
+	} else {
+		memcpy(levelData, source->levelData, (size_t)tests * factors);
+	}
+}
+
+void LocatingArray::setColumnMajor(bool columnMajor) {
+	if (this->columnMajor != columnMajor) {
+		relayoutLevelData(capacity, columnMajor);
+	}
+}
+
+bool LocatingArray::isColumnMajor() {
+	return columnMajor;
+}
+
+GroupingInfo **LocatingArray::getGroupingInfo() {
+	return factorGrouping;
 }
 
 int LocatingArray::getFactors() {
@@ -180,6 +315,283 @@ ConstraintGroup **LocatingArray::getConGroups() {
 	return conGroups;
 }
 
+// FNV-1a over the levels, grouping, t, tests and constraint groups
+static uint64_t hashBytes(uint64_t hash, const void *bytes, int length) {
+	const unsigned char *p = (const unsigned char *)bytes;
+	for (int byte_i = 0; byte_i < length; byte_i++) {
+		hash ^= p[byte_i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+uint64_t LocatingArray::getHash() {
+	uint64_t hash = 14695981039346656037ULL;
+
+	hash = hashBytes(hash, &tests, sizeof(int));
+	hash = hashBytes(hash, &factors, sizeof(int));
+	hash = hashBytes(hash, &t, sizeof(int));
+
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		GroupingInfo *grouping = factorGrouping[factor_i];
+		hash = hashBytes(hash, &grouping->levels, sizeof(int));
+		hash = hashBytes(hash, &grouping->grouped, sizeof(bool));
+		if (grouping->grouped) {
+			hash = hashBytes(hash, grouping->levelGroups, grouping->levels);
+		}
+	}
+
+	// hash row by row so the layout of the level matrix does not matter
+	char *levelRow = new char[factors];
+	for (int test_i = 0; test_i < tests; test_i++) {
+		getLevelRow(test_i, levelRow);
+		hash = hashBytes(hash, levelRow, factors);
+	}
+	delete[] levelRow;
+
+	// constraint groups decide which columns are coverable
+	hash = hashBytes(hash, &nConGroups, sizeof(int));
+	for (int conGroup_i = 0; conGroup_i < nConGroups; conGroup_i++) {
+		hash = hashBytes(hash, &conGroups[conGroup_i]->factors, sizeof(int));
+		hash = hashBytes(hash, conGroups[conGroup_i]->factorIndeces, sizeof(int) * conGroups[conGroup_i]->factors);
+
+		if (conGroups[conGroup_i]->isLazy()) {
+			// a lazy group has no rows, so hash its constraints
+			ostringstream oss;
+			conGroups[conGroup_i]->writeToStream(oss);
+			string constraintText = oss.str();
+			hash = hashBytes(hash, constraintText.data(), constraintText.size());
+		} else {
+			uint64_t groupHash = conGroups[conGroup_i]->getGroupLA()->getHash();
+			hash = hashBytes(hash, &groupHash, sizeof(uint64_t));
+		}
+	}
+
+	return hash;
+}
+
+/*
+	Binary locating array (all integers are 32 bit in native byte order):
+		LABinaryHeader
+		levels of each factor (factors integers)
+		grouped flag of each factor (factors bytes)
+		level groups of each grouped factor (levels bytes per grouped factor)
+		constraint groups in the same text form as the TSV (constraintBytes bytes)
+		zero padding to a multiple of 8 bytes
+		level matrix (tests * factors bytes, column-major: the levels of each factor for every test)
+	The file is memory-mapped privately and the level matrix points straight into
+	the mapping, so loading does not parse or copy it. It is column-major because
+	that is the layout a CS matrix works on, so it is only copied out when it has
+	to grow.
+*/
+struct LABinaryHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t tests;
+	uint32_t factors;
+	uint32_t constraintBytes;
+};
+
+void LocatingArray::loadBinary(string file, string factorDataFile) {
+
+	int fd = open(file.c_str(), O_RDONLY);
+	struct stat fileStat;
+	if (fd < 0 || fstat(fd, &fileStat) != 0) {
+		cout << "Cannot open " << file << endl;
+		exit(0);
+	}
+	mappedSize = fileStat.st_size;
+
+#ifdef _WIN32
+	mappedFile = new char[mappedSize];
+	if (read(fd, mappedFile, mappedSize) != (int)mappedSize) {
+		cout << "Cannot read " << file << endl;
+		exit(0);
+	}
+#else
+	// private and writable so the rows can be changed (copy-on-write) without touching the file
+	mappedFile = (char *)mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (mappedFile == MAP_FAILED) {
+		cout << "Cannot map " << file << endl;
+		exit(0);
+	}
+#endif
+	close(fd);
+
+	LABinaryHeader *header = (LABinaryHeader *)mappedFile;
+	if (mappedSize < sizeof(LABinaryHeader) || memcmp(header->magic, laBinaryMagic, 8) != 0) {
+		cout << file << " is not a binary LA" << endl;
+		cout << "Exiting" << endl;
+		exit(0);
+	}
+	if (header->version != laBinaryVersion) {
+		cout << "Binary LA version must be " << laBinaryVersion << " for this software" << endl;
+		cout << "Exiting" << endl;
+		exit(0);
+	}
+
+	// every section is checked against the file size before it is read
+	size_t offset = sizeof(LABinaryHeader);
+	auto checkSection = [&](size_t bytes) {
+		if (bytes > mappedSize - offset) {
+			cout << "Binary LA " << file << " is truncated" << endl;
+			cout << "Exiting" << endl;
+			exit(0);
+		}
+		offset += bytes;
+	};
+
+	int rows = header->tests;
+	factors = header->factors;
+	tests = 0;
+
+	initLevelData();
+
+	cout << rows << ", " << factors << endl;
+
+	char *p = mappedFile + sizeof(LABinaryHeader);
+
+	// load the level counts for the factors (levels are stored as chars)
+	checkSection(sizeof(uint32_t) * (size_t)header->factors);
+	factorGrouping = new GroupingInfo*[factors];
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		uint32_t levels = ((uint32_t *)p)[factor_i];
+		if (levels < 1 || levels > CHAR_MAX) {
+			cout << "Binary LA " << file << " has an invalid level count" << endl;
+			cout << "Exiting" << endl;
+			exit(0);
+		}
+
+		factorGrouping[factor_i] = new GroupingInfo();
+		factorGrouping[factor_i]->levels = levels;
+	}
+	p += sizeof(uint32_t) * factors;
+
+	// load the grouping for the factors
+	checkSection(factors);
+	char *grouped = p;
+	p += factors;
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		factorGrouping[factor_i]->grouped = grouped[factor_i];
+
+		if (factorGrouping[factor_i]->grouped) {
+			checkSection(factorGrouping[factor_i]->levels);
+			factorGrouping[factor_i]->levelGroups = new char[factorGrouping[factor_i]->levels];
+			memcpy(factorGrouping[factor_i]->levelGroups, p, factorGrouping[factor_i]->levels);
+			p += factorGrouping[factor_i]->levels;
+		} else {
+			factorGrouping[factor_i]->levelGroups = NULL;
+		}
+
+		factorGrouping[factor_i]->conGroup = NULL;
+		factorGrouping[factor_i]->conGroupIndex = -1;
+	}
+
+	// load factor data (must be done before constraint groups)
+	if (factorDataFile == "") {
+		factorData = new FactorData(getGroupingInfo(), getFactors());
+	} else {
+		factorData = new FactorData(factorDataFile);
+	}
+
+	// load constraint groups from their text form
+	checkSection(header->constraintBytes);
+	istringstream iss(string(p, header->constraintBytes));
+	p += header->constraintBytes;
+
+	iss >> nConGroups;
+	conGroups = new ConstraintGroup*[nConGroups];
+	for (int iConGroup = 0; iConGroup < nConGroups; iConGroup++) {
+		conGroups[iConGroup] = new ConstraintGroup(this, iss);
+	}
+
+	// the level matrix starts at the next multiple of 8 bytes
+	size_t matrixOffset = ((p - mappedFile) + 7) / 8 * 8;
+	checkSection(matrixOffset - offset);
+	checkSection((size_t)header->tests * header->factors);
+
+	// point the level matrix into the file (replacing any buffer the constraint groups grew)
+	if (ownsLevelData) {
+		delete[] levelData;
+	}
+	levelData = mappedFile + matrixOffset;
+	capacity = rows;
+	tests = rows;
+	columnMajor = true;
+	testStride = 1;
+	factorStride = rows;
+	ownsLevelData = false;
+
+}
+
+void LocatingArray::writeBinary(string file) {
+
+	LABinaryHeader header;
+	memcpy(header.magic, laBinaryMagic, 8);
+	header.version = laBinaryVersion;
+	header.tests = tests;
+	header.factors = factors;
+
+	// constraint groups are kept in their text form
+	ostringstream oss;
+	oss << nConGroups << endl;
+	for (int iConGroup = 0; iConGroup < nConGroups; iConGroup++) {
+		conGroups[iConGroup]->writeToStream(oss);
+	}
+	string constraintText = oss.str();
+	header.constraintBytes = constraintText.size();
+
+	ofstream ofs(file.c_str(), ofstream::binary);
+	ofs.write((char *)&header, sizeof(LABinaryHeader));
+	size_t written = sizeof(LABinaryHeader);
+
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		uint32_t levels = factorGrouping[factor_i]->levels;
+		ofs.write((char *)&levels, sizeof(uint32_t));
+	}
+	written += sizeof(uint32_t) * factors;
+
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		ofs.put(factorGrouping[factor_i]->grouped ? 1 : 0);
+	}
+	written += factors;
+
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		if (factorGrouping[factor_i]->grouped) {
+			ofs.write(factorGrouping[factor_i]->levelGroups, factorGrouping[factor_i]->levels);
+			written += factorGrouping[factor_i]->levels;
+		}
+	}
+
+	ofs.write(constraintText.c_str(), constraintText.size());
+	written += constraintText.size();
+
+	for (; written % 8 != 0; written++) {
+		ofs.put(0);
+	}
+
+	char *levelColumn = new char[tests];
+	for (int factor_i = 0; factor_i < factors; factor_i++) {
+		for (int test_i = 0; test_i < tests; test_i++) {
+			levelColumn[test_i] = getLevel(test_i, factor_i);
+		}
+		ofs.write(levelColumn, tests);
+	}
+	delete[] levelColumn;
+
+	ofs.close();
+
+}
+
+void LocatingArray::writeToFile(string file, bool binary) {
+	if (binary) {
+		cout << "Writing to " << file << "...";
+		writeBinary(file);
+	} else {
+		writeToFile(file);
+	}
+}
+
 void LocatingArray::writeToFile(string file) {
 
 	cout << "Writing to " << file << "...";
@@ -221,11 +633,10 @@ void LocatingArray::writeToFile(string file) {
 	}
 
 	// write the tests now
-	char **levelMatrix = getLevelMatrix();
 	for (int test_i = 0; test_i < tests; test_i++) {
 		// now write each factor level for this specific test
 		for (int factor_i = 0; factor_i < factors; factor_i++) {
-			ofs << (int)levelMatrix[test_i][factor_i] << "\t";
+			ofs << (int)getLevel(test_i, factor_i) << "\t";
 		}
 		ofs << endl;
 	}
@@ -240,35 +651,60 @@ FactorData *LocatingArray::getFactorData() {
 
 
 LocatingArray::~LocatingArray() {
-	for (int factor_i = 0; factor_i < factors; factor_i++) {
-		if (factorGrouping[factor_i]->grouped) {
-			delete[] factorGrouping[factor_i]->levelGroups;
+	if (!sharesFactors) {
+		for (int factor_i = 0; factor_i < factors; factor_i++) {
+			if (factorGrouping[factor_i]->grouped) {
+				delete[] factorGrouping[factor_i]->levelGroups;
+			}
+
+			delete factorGrouping[factor_i];
 		}
+		delete[] factorGrouping;
 
-		delete factorGrouping[factor_i];
-	}
-	delete[] factorGrouping;
+		// deallocate the factor data if it exists
+		if (factorData != NULL) {
+			delete factorData;
+		}
 
-	// deallocate the factor data if it exists
-	if (factorData != NULL) {
-		delete factorData;
+		for (int iConGroup = 0; iConGroup < nConGroups; iConGroup++) {
+			delete conGroups[iConGroup];
+		}
+		delete[] conGroups;
 	}
 
-	for (int iConGroup = 0; iConGroup < nConGroups; iConGroup++) {
-		delete conGroups[iConGroup];
+	if (ownsLevelData) {
+		delete[] levelData;
 	}
-	delete[] conGroups;
-
-	while (tests > 0) {
-		char *levelRow = remLevelRow();
 
-		delete[] levelRow;
+	// unmap the binary file the level matrix pointed into
+	if (mappedFile != NULL) {
+#ifdef _WIN32
+		delete[] mappedFile;
+#else
+		munmap(mappedFile, mappedSize);
+#endif
 	}
 }
 
+//' Converts a locating array between the TSV and binary formats
+//' 
+//' Either format is accepted as input. The binary format loads without parsing, which is much faster for large arrays.
+//' 
+//' @param la_path Path to the locating array (TSV or binary).
+//' @param out_path Path of the converted locating array.
+//' @param factor_data_path Path to factor data file in TSV format (used to evaluate constraints).
+//' @param binary TRUE writes the binary format, FALSE writes TSV.
+//' @export
+// [[Rcpp::export]]
+void convertLA(std::string la_path, std::string out_path, std::string factor_data_path = "", bool binary = true){
+  LocatingArray* la = new LocatingArray(la_path, factor_data_path);
+  la->writeToFile(out_path, binary);
+  delete la;
+}
+
 // [[Rcpp::export]]
-SEXP makeLA2(std::string file, std::string factorDataFile){
-  LocatingArray* la = new LocatingArray(file, factorDataFile);
+SEXP makeLA2(std::string file, std::string factorDataFile, int t = 2){
+  LocatingArray* la = new LocatingArray(file, factorDataFile, t);
   Rcpp::XPtr<LocatingArray> ptr(la);
   return ptr;
 }
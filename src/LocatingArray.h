@@ -1,6 +1,7 @@
 #ifndef LOCATINGARRAY_H
 #define LOCATINGARRAY_H
 #include <fstream>
+#include <stdint.h>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -14,9 +15,22 @@ using namespace std;
 
 const string laVersion = "v2.0";
 
+// binary locating array format (see LocatingArray.cpp for the layout)
+const char laBinaryMagic[8] = {'L', 'A', 'B', 'I', 'N', 'A', 'R', 'Y'};
+const unsigned int laBinaryVersion = 2;
+
 class ConstraintGroup;
 class FactorData;
 
+struct FactorSetting {
+	
+	bool grouped;
+	char factor_i;
+	char index;			// level index (1st level if part of group)
+	char levelsInGroup;	// levels in group (1 if not a group)
+	
+};
+
 struct GroupingInfo {
 	int levels;	// total levels for this factor
 	
@@ -31,7 +45,18 @@ class LocatingArray {
 private:
 	GroupingInfo **factorGrouping;
 	
-	vector <char*>levels;	// pointer to array of test levels (the main locating array)
+	/*
+		The level matrix (the main locating array) is one contiguous buffer with room for
+		capacity tests. It is stored row-major (a row per test) or column-major (a column
+		per factor), and the level of a test and factor sits at
+		test_i * testStride + factor_i * factorStride.
+	*/
+	char *levelData;
+	int capacity;
+	bool columnMajor;
+	size_t testStride;
+	size_t factorStride;
+	bool ownsLevelData;	// false while levelData points into mappedFile
 	
 	int tests;		// count of tests in locating array
 	int factors;	// count of factors in locating array
@@ -42,18 +67,49 @@ private:
 	ConstraintGroup **conGroups;
 	
 	FactorData *factorData;
+	
+	// a worker copy shares the grouping, constraint groups and factor data of its source
+	bool sharesFactors;
+	
+	// binary locating array file the level matrix points into (NULL if loaded from TSV)
+	char *mappedFile;
+	size_t mappedSize;
+	
+	void initLevelData();
+	void relayoutLevelData(int newCapacity, bool newColumnMajor);
+	void loadBinary(string file, string factorDataFile);
+	void writeBinary(string file);
 public:
 	LocatingArray(int factors, int *levelCounts);
-	LocatingArray(string file, string factorDataFile);
+	// the CS matrix of the array has the interactions of up to t factors
+	LocatingArray(string file, string factorDataFile, int t = 2);
+	// a copy of source with its own level matrix (the rest is shared, so source must outlive it)
+	LocatingArray(LocatingArray *source);
 	
 	LocatingArray makeLA(string file, string factorDataFile);
 	
+	// the row is copied into the level matrix, which grows as needed
 	void addLevelRow(char *levelRow);
-	char *remLevelRow();
+	void remLevelRow();
 	
 	GroupingInfo **getGroupingInfo();
 	
-	char **getLevelMatrix();
+	char getLevel(int test_i, int factor_i);
+	void setLevel(int test_i, int factor_i, char level);
+	void getLevelRow(int test_i, char *levelRow);
+	void swapLevelRows(int test_i1, int test_i2);
+	// replace the tests and levels with those of source (an array with the same factors)
+	void copyLevels(LocatingArray *source);
+	
+	// levels of a factor for every test, getTestStride() apart (contiguous when column-major)
+	char *getFactorColumn(int factor_i);
+	size_t getTestStride();
+	// distance between the levels of consecutive factors of a test (1 when row-major)
+	size_t getFactorStride();
+	
+	// switch the layout of the level matrix (column-major suits resampling whole factors)
+	void setColumnMajor(bool columnMajor);
+	bool isColumnMajor();
 	
 	int getFactors();
 	int getTests();
@@ -65,11 +121,33 @@ public:
 	
 	FactorData *getFactorData();
 	
+	// hash of everything a CS matrix built from this array depends on
+	uint64_t getHash();
+	
 	void writeToFile(string file);
+	void writeToFile(string file, bool binary);
 	
 	~LocatingArray();
 };
 
+inline char LocatingArray::getLevel(int test_i, int factor_i) {
+	return levelData[test_i * testStride + factor_i * factorStride];
+}
+
+inline void LocatingArray::setLevel(int test_i, int factor_i, char level) {
+	levelData[test_i * testStride + factor_i * factorStride] = level;
+}
+
+inline char *LocatingArray::getFactorColumn(int factor_i) {
+	return levelData + factor_i * factorStride;
+}
+
+inline size_t LocatingArray::getTestStride() {
+	return testStride;
+}
 
+inline size_t LocatingArray::getFactorStride() {
+	return factorStride;
+}
 
 #endif
\ No newline at end of file
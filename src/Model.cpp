@@ -1,3 +1,4 @@
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 
@@ -24,11 +25,26 @@ Model::Model(VectorXf *response, int maxTerms, CSMatrix *csMatrix) {
 	// allocate memory for the model response
 	modelResponse = new float[tests];
 
+	// allocate memory for the QR factorization
+	qrTerms = 0;
+	qrCols = new int[maxTerms];
+	dataQ = new float[tests * maxTerms];
+	dataR = new float[maxTerms * maxTerms];
+	qtb = new float[maxTerms];
+
+	// logistic regression starts from zero weights
+	logitSolver = LOGIT_IRLS;
+	logitWeights = new float[maxTerms];
+	for (int term_i = 0; term_i < maxTerms; term_i++) {
+		logitWeights[term_i] = 0;
+	}
+
 	// add the intercept
 	terms = 1;
 	hTermIndex = new TermIndex;
 	hTermIndex->termIndex = 0;
 	hTermIndex->next = NULL;
+	appendQR(0);
 
 	// this is a one line way to get the same intercept above
 	leastSquares();
@@ -67,6 +83,22 @@ Model::Model(Model *model) {
 		modelResponse[resp_i] = model->modelResponse[resp_i];
 	}
 
+	// take over the QR factorization (only the columns in use)
+	qrTerms = model->qrTerms;
+	qrCols = new int[maxTerms];
+	dataQ = new float[tests * maxTerms];
+	dataR = new float[maxTerms * maxTerms];
+	qtb = new float[maxTerms];
+	memcpy(qrCols, model->qrCols, sizeof(int) * qrTerms);
+	memcpy(dataQ, model->dataQ, sizeof(float) * tests * qrTerms);
+	memcpy(dataR, model->dataR, sizeof(float) * maxTerms * qrTerms);
+	memcpy(qtb, model->qtb, sizeof(float) * qrTerms);
+
+	// the parent's logistic weights are the warm start for this model
+	logitSolver = model->logitSolver;
+	logitWeights = new float[maxTerms];
+	memcpy(logitWeights, model->logitWeights, sizeof(float) * maxTerms);
+
 	// copy term index list
 	TermIndex **destTermIndex = &hTermIndex;
 	for (TermIndex *pTermIndex = model->hTermIndex; pTermIndex != NULL;
@@ -115,7 +147,199 @@ void Model::printModelFactors() {
 }
 
 
-void Model::logisticRegression(){
+void Model::setLogitSolver(int logitSolver) {
+	this->logitSolver = logitSolver;
+}
+
+void Model::logisticRegression() {
+	if (logitSolver == LOGIT_GRADIENT) {
+		logisticRegressionGradient();
+	} else {
+		logisticRegressionIRLS();
+	}
+}
+
+/*
+	Newton's method (IRLS) for logistic regression. The term columns are gathered into a
+	contiguous design matrix X once, then every iteration solves
+		(X^T W X) delta = X^T (y - p),  W = diag(p (1 - p))
+	with a Cholesky factorization and updates the weights by delta. It starts from the weights
+	of the model this one was duplicated from (0 for the new term), so usually only a few
+	iterations are needed. It stops when the deviance changes by less than LOGIT_TOLERANCE
+	(relative), or after LOGIT_MAX_ITERATIONS.
+*/
+void Model::logisticRegressionIRLS() {
+
+	float *responseData = response->getData();
+
+	// gather the term columns into a design matrix (column-major), and the rows of the sparse ones
+	float *design = new float[tests * terms];
+	int **termRows = new int*[terms];
+	int *termRows_n = new int[terms];
+	int term_i = 0;
+	for (TermIndex *pTermIndex = hTermIndex; pTermIndex != NULL; pTermIndex = pTermIndex->next) {
+		float *termData = &design[term_i * tests];
+		float *colData = csMatrix->getColData(pTermIndex->termIndex, termData);
+		if (colData != termData) memcpy(termData, colData, sizeof(float) * tests);
+		termRows[term_i] = csMatrix->getColRows(pTermIndex->termIndex, termRows_n[term_i]);
+		term_i++;
+	}
+
+	double *weights = new double[terms];
+	double *gradient = new double[terms];
+	double *hessian = new double[terms * terms];	// row-major, lower triangle holds the Cholesky factor
+	double *probs = new double[tests];
+
+	for (int term_i = 0; term_i < terms; term_i++) {
+		weights[term_i] = logitWeights[term_i];
+	}
+
+	double deviance = 0, oldDeviance = 0;
+	for (int iter_i = 0; ; iter_i++) {
+
+		// probabilities for the current weights (z = X * weights)
+		for (int row_i = 0; row_i < tests; row_i++) {
+			probs[row_i] = 0;
+		}
+		for (int term_i = 0; term_i < terms; term_i++) {
+			float *col = &design[term_i * tests];
+			if (termRows[term_i] != NULL) {
+				// a sparse term only adds to its ENTRY_A rows (where it is 1)
+				for (int entry_i = 0; entry_i < termRows_n[term_i]; entry_i++) {
+					probs[termRows[term_i][entry_i]] += weights[term_i];
+				}
+				continue;
+			}
+			for (int row_i = 0; row_i < tests; row_i++) {
+				probs[row_i] += col[row_i] * weights[term_i];
+			}
+		}
+		deviance = 0;
+		for (int row_i = 0; row_i < tests; row_i++) {
+			probs[row_i] = 1 / (1 + exp(-probs[row_i]));
+
+			// keep the logs finite when the data is separable
+			double prob = probs[row_i];
+			if (prob < 1e-10) prob = 1e-10;
+			if (prob > 1 - 1e-10) prob = 1 - 1e-10;
+			deviance -= 2 * (responseData[row_i] * log(prob) + (1 - responseData[row_i]) * log(1 - prob));
+		}
+
+		// check for convergence
+		if (iter_i > 0 && fabs(deviance - oldDeviance) / (fabs(deviance) + 0.1) < LOGIT_TOLERANCE) break;
+		if (iter_i == LOGIT_MAX_ITERATIONS) break;
+		oldDeviance = deviance;
+
+		// gradient X^T (y - p) and hessian X^T W X (lower triangle), over the rows of a sparse term if there is one
+		for (int term_i = 0; term_i < terms; term_i++) {
+			float *col1 = &design[term_i * tests];
+
+			gradient[term_i] = 0;
+			if (termRows[term_i] != NULL) {
+				for (int entry_i = 0; entry_i < termRows_n[term_i]; entry_i++) {
+					int row_i = termRows[term_i][entry_i];
+					gradient[term_i] += responseData[row_i] - probs[row_i];
+				}
+			} else {
+				for (int row_i = 0; row_i < tests; row_i++) {
+					gradient[term_i] += col1[row_i] * (responseData[row_i] - probs[row_i]);
+				}
+			}
+
+			for (int term_j = 0; term_j <= term_i; term_j++) {
+				float *col2 = &design[term_j * tests];
+
+				double sum = 0;
+				if (termRows[term_i] != NULL || termRows[term_j] != NULL) {
+					int *rows = (termRows[term_i] != NULL ? termRows[term_i] : termRows[term_j]);
+					int rows_n = (termRows[term_i] != NULL ? termRows_n[term_i] : termRows_n[term_j]);
+					float *other = (termRows[term_i] != NULL ? col2 : col1);
+					for (int entry_i = 0; entry_i < rows_n; entry_i++) {
+						int row_i = rows[entry_i];
+						sum += other[row_i] * probs[row_i] * (1 - probs[row_i]);
+					}
+				} else {
+					for (int row_i = 0; row_i < tests; row_i++) {
+						sum += col1[row_i] * col2[row_i] * probs[row_i] * (1 - probs[row_i]);
+					}
+				}
+				hessian[term_i * terms + term_j] = sum;
+			}
+		}
+
+		// cholesky factorization in place (a tiny ridge keeps it positive definite
+		// when columns are collinear or the probabilities saturate)
+		for (int term_i = 0; term_i < terms; term_i++) {
+			for (int term_j = 0; term_j <= term_i; term_j++) {
+				double sum = hessian[term_i * terms + term_j];
+				for (int term_k = 0; term_k < term_j; term_k++) {
+					sum -= hessian[term_i * terms + term_k] * hessian[term_j * terms + term_k];
+				}
+
+				if (term_i == term_j) {
+					sum += 1e-9 * tests;
+					hessian[term_i * terms + term_i] = (sum > 0 ? sqrt(sum) : 0);
+				} else {
+					double pivot = hessian[term_j * terms + term_j];
+					hessian[term_i * terms + term_j] = (pivot > 0 ? sum / pivot : 0);
+				}
+			}
+		}
+
+		// forward then backward substitution, leaving delta in the gradient vector
+		for (int term_i = 0; term_i < terms; term_i++) {
+			double sum = gradient[term_i];
+			for (int term_k = 0; term_k < term_i; term_k++) {
+				sum -= hessian[term_i * terms + term_k] * gradient[term_k];
+			}
+			double pivot = hessian[term_i * terms + term_i];
+			gradient[term_i] = (pivot > 0 ? sum / pivot : 0);
+		}
+		for (int term_i = terms - 1; term_i >= 0; term_i--) {
+			double sum = gradient[term_i];
+			for (int term_k = term_i + 1; term_k < terms; term_k++) {
+				sum -= hessian[term_k * terms + term_i] * gradient[term_k];
+			}
+			double pivot = hessian[term_i * terms + term_i];
+			gradient[term_i] = (pivot > 0 ? sum / pivot : 0);
+		}
+
+		// take the newton step
+		for (int term_i = 0; term_i < terms; term_i++) {
+			weights[term_i] += gradient[term_i];
+		}
+	}
+
+	// fill the coefficients, model response and residuals
+	for (int term_i = 0; term_i < terms; term_i++) {
+		logitWeights[term_i] = weights[term_i];
+		coefVec[term_i] = weights[term_i];
+	}
+
+	long totalCorrect = 0;
+	for (int row_i = 0; row_i < tests; row_i++) {
+		modelResponse[row_i] = probs[row_i];
+		resiVec[row_i] = responseData[row_i] - probs[row_i];
+
+		// r-squared is the fraction of tests classified correctly
+		float predictedValue = (probs[row_i] < 0.5 ? 0 : 1);
+		if (predictedValue == responseData[row_i]) {
+			totalCorrect++;
+		}
+	}
+	rSquared = totalCorrect / double(tests);
+
+	delete[] design;
+	delete[] termRows;
+	delete[] termRows_n;
+	delete[] weights;
+	delete[] gradient;
+	delete[] hessian;
+	delete[] probs;
+
+}
+
+void Model::logisticRegressionGradient(){
 
   int NUM_ITERATIONS = 1000;
 
@@ -135,8 +359,8 @@ void Model::logisticRegression(){
   }
 
 
-  // used when accessing CS Matrix
-  CSCol *csCol;
+  // the term columns (column-major)
+  float *termData = new float[terms * tests];
 
   // used when looping through term indices
   TermIndex *pTermIndex;
@@ -144,6 +368,12 @@ void Model::logisticRegression(){
   //start at the head of index list
   pTermIndex = hTermIndex;
 
+  for (int col_i=0; col_i < terms; col_i++){
+    float *colData = csMatrix->getColData(pTermIndex->termIndex, &termData[col_i * tests]);
+    if (colData != &termData[col_i * tests]) memcpy(&termData[col_i * tests], colData, sizeof(float) * tests);
+    pTermIndex = pTermIndex->next;
+  }
+
   //get response vector
   float *responseData = response->getData();
 
@@ -161,9 +391,7 @@ void Model::logisticRegression(){
 
       for (int col_i=0; col_i < terms; col_i++){
 
-        csCol = csMatrix->getCol(pTermIndex->termIndex);
-
-        score += csCol->dataVector[row_i] * weights[col_i];
+        score += termData[col_i * tests + row_i] * weights[col_i];
 
         pTermIndex = pTermIndex->next;
 
@@ -179,13 +407,11 @@ void Model::logisticRegression(){
     // loop 2: (gradients <- t(trainingSetFeatures)%*%scores)
     for (int col_i=0; col_i < terms; col_i++){
 
-      csCol = csMatrix->getCol(pTermIndex->termIndex);
-
       gradients[col_i] = 0.0f;
 
       for(int row_i=0; row_i < tests; row_i++){
 
-        gradients[col_i] += csCol->dataVector[row_i] * scores[row_i];
+        gradients[col_i] += termData[col_i * tests + row_i] * scores[row_i];
 
       }
 
@@ -217,10 +443,7 @@ void Model::logisticRegression(){
 
     for (int col_i=0; col_i < terms; col_i++){
 
-      //get col
-      csCol = csMatrix->getCol(pTermIndex->termIndex);
-
-      z += csCol->dataVector[row_i] * weights[col_i];
+      z += termData[col_i * tests + row_i] * weights[col_i];
 
       //next col
       pTermIndex = pTermIndex->next;
@@ -245,87 +468,139 @@ void Model::logisticRegression(){
 
   rSquared =totalCorrect/double(tests);
 
-}
-
-void Model::leastSquares() {
+  delete[] termData;
 
-	// used when accessing CS Matrix
-	CSCol *csCol;
+}
 
-	// used when looping through term indices
-	TermIndex *pTermIndex;
+void Model::appendQR(int col_i) {
 
 	// check dimensions
-	if (terms > tests) {
+	if (qrTerms >= tests || qrTerms >= maxTerms) {
 		cout << "Cols (terms) cannot be more than rows (tests) to perform QR" << endl;
 		return;
 	}
 
-	// do QR here (column by column)
-	pTermIndex = hTermIndex;
-	for (int col_i = 0; col_i < terms; col_i++) {
-
-		csCol = csMatrix->getCol(pTermIndex->termIndex);
-		// assign initial column A[col_i] to work vector
-		for (int row_i = 0; row_i < tests; row_i++) {
-			workSpace->workVec[row_i] = csCol->dataP[row_i];
-		}
-
-		// subtract appropriate other vectors
-		float dotProd;
-		for (int row_i = 0; row_i < col_i; row_i++) {
-			// find the dot product of A[:][col_i] and Q[:][row_i]
-			dotProd = 0;
-			for (int dotrow_i = 0; dotrow_i < tests; dotrow_i++)
-				dotProd += csCol->dataP[dotrow_i] * workSpace->dataQ[dotrow_i][row_i];
+	float *newQ = &dataQ[qrTerms * tests];
+	float *colData = csMatrix->getColData(col_i, newQ);
 
-			// assign the dot product to the R matrix
-			workSpace->dataR[row_i][col_i] = dotProd;
+	// assign initial column A[col_i] to the new column of Q
+	for (int row_i = 0; row_i < tests; row_i++) {
+		newQ[row_i] = colData[row_i];
+	}
 
-			// perform the necessary subtraction
-			for (int subrow_i = 0; subrow_i < tests; subrow_i++)
-				workSpace->workVec[subrow_i] -= dotProd * workSpace->dataQ[subrow_i][row_i];
+	// the ENTRY_A rows if the column is sparse
+	int rows_n;
+	int *colRows = csMatrix->getColRows(col_i, rows_n);
 
-		}
+	// subtract appropriate other vectors
+	float dotProd;
+	for (int qCol_i = 0; qCol_i < qrTerms; qCol_i++) {
+		float *q = &dataQ[qCol_i * tests];
 
-		// find the dot product of workVec and workVec
+		// find the dot product of A[:][col_i] and Q[:][qCol_i]
 		dotProd = 0;
-		for (int dotrow_i = 0; dotrow_i < tests; dotrow_i++)
-			dotProd += workSpace->workVec[dotrow_i] * workSpace->workVec[dotrow_i];
-		dotProd = sqrt(dotProd);
-
-		// assign the dot product to the R matrix
-		workSpace->dataR[col_i][col_i] = dotProd;
-
-		// assign the normalized column to Q
-		if (dotProd == 0) {
-			for (int row_i = 0; row_i < tests; row_i++)
-				workSpace->dataQ[row_i][col_i] = 0;
+		if (colRows != NULL) {
+			for (int entry_i = 0; entry_i < rows_n; entry_i++)
+				dotProd += q[colRows[entry_i]];
 		} else {
 			for (int row_i = 0; row_i < tests; row_i++)
-				workSpace->dataQ[row_i][col_i] = workSpace->workVec[row_i] / dotProd;
+				dotProd += colData[row_i] * q[row_i];
 		}
 
-		pTermIndex = pTermIndex->next;
+		// assign the dot product to the R matrix
+		dataR[qCol_i * maxTerms + qrTerms] = dotProd;
+
+		// perform the necessary subtraction
+		for (int row_i = 0; row_i < tests; row_i++)
+			newQ[row_i] -= dotProd * q[row_i];
 	}
 
-	/*
-	cout << "Q matrix" << endl;
-	for (int row_i = 0; row_i < tests; row_i++) {
-		for (int col_i = 0; col_i < terms; col_i++) {
-			cout << workSpace->dataQ[row_i][col_i] << "\t";
+	// find the norm of the new column
+	dotProd = 0;
+	for (int row_i = 0; row_i < tests; row_i++)
+		dotProd += newQ[row_i] * newQ[row_i];
+	dotProd = sqrt(dotProd);
+
+	// assign the norm to the R matrix
+	dataR[qrTerms * maxTerms + qrTerms] = dotProd;
+
+	// normalize the new column of Q
+	for (int row_i = 0; row_i < tests; row_i++)
+		newQ[row_i] = (dotProd == 0 ? 0 : newQ[row_i] / dotProd);
+
+	// extend Q-transpose * b
+	float *responseData = response->getData();
+	qtb[qrTerms] = 0;
+	for (int row_i = 0; row_i < tests; row_i++)
+		qtb[qrTerms] += newQ[row_i] * responseData[row_i];
+
+	qrCols[qrTerms] = col_i;
+	qrTerms++;
+}
+
+void Model::removeQR(int col_i) {
+
+	// find the column in the factorization
+	int remCol_i = 0;
+	while (remCol_i < qrTerms && qrCols[remCol_i] != col_i) remCol_i++;
+	if (remCol_i == qrTerms) return;
+
+	// drop the column from R, which leaves R upper Hessenberg from remCol_i on
+	for (int row_i = 0; row_i < qrTerms; row_i++) {
+		for (int rCol_i = remCol_i; rCol_i < qrTerms - 1; rCol_i++) {
+			dataR[row_i * maxTerms + rCol_i] = dataR[row_i * maxTerms + rCol_i + 1];
 		}
-		cout << endl;
 	}
+	for (int qCol_i = remCol_i; qCol_i < qrTerms - 1; qCol_i++) {
+		qrCols[qCol_i] = qrCols[qCol_i + 1];
+	}
+
+	// zero the subdiagonal with Givens rotations and apply them to Q and Q-transpose * b
+	for (int row_i = remCol_i; row_i < qrTerms - 1; row_i++) {
+		float *r1 = &dataR[row_i * maxTerms];
+		float *r2 = &dataR[(row_i + 1) * maxTerms];
+		float a = r1[row_i];
+		float b = r2[row_i];
+		float norm = sqrt(a * a + b * b);
+		float c = (norm == 0 ? 1 : a / norm);
+		float s = (norm == 0 ? 0 : b / norm);
+
+		for (int rCol_i = row_i; rCol_i < qrTerms - 1; rCol_i++) {
+			float x = r1[rCol_i];
+			float y = r2[rCol_i];
+			r1[rCol_i] = c * x + s * y;
+			r2[rCol_i] = -s * x + c * y;
+		}
 
-	cout << "R matrix" << endl;
-	for (int row_i = 0; row_i < terms; row_i++) {
-		for (int col_i = 0; col_i < terms; col_i++) {
-			cout << workSpace->dataR[row_i][col_i] << "\t";
+		float *q1 = &dataQ[row_i * tests];
+		float *q2 = &dataQ[(row_i + 1) * tests];
+		for (int q_i = 0; q_i < tests; q_i++) {
+			float x = q1[q_i];
+			float y = q2[q_i];
+			q1[q_i] = c * x + s * y;
+			q2[q_i] = -s * x + c * y;
 		}
-		cout << endl;
+
+		float x = qtb[row_i];
+		float y = qtb[row_i + 1];
+		qtb[row_i] = c * x + s * y;
+		qtb[row_i + 1] = -s * x + c * y;
+	}
+
+	// the last row of R and column of Q are no longer needed
+	qrTerms--;
+}
+
+void Model::leastSquares() {
+
+	// used when looping through term indices
+	TermIndex *pTermIndex;
+
+	// check dimensions
+	if (terms > tests) {
+		cout << "Cols (terms) cannot be more than rows (tests) to perform QR" << endl;
+		return;
 	}
-	*/
 
 	/* m >> n
 	** A is (m by n)
@@ -335,44 +610,45 @@ void Model::leastSquares() {
 	** Q-transpose is (n by m)
 	**
 	*/
-	// We now have QRx = b
-
-	// perform workVec = Q-transpose * b
+	// We have QRx = b, and the factorization is kept up to date by appendQR and removeQR,
+	// so Q-transpose * b is already in qtb
 
-	// first zero out the work vector up until n (or cols)
-	for (int row_i = 0; row_i < terms; row_i++)
-		workSpace->workVec[row_i] = 0;
-
-	// we go column 1st because Q is transposed
-	float *responseData = response->getData();
-	for (int col_i = 0; col_i < tests; col_i++) {
-		for (int row_i = 0; row_i < terms; row_i++) {
-			// row and col are swapped because of the transpose
-			workSpace->workVec[row_i] += workSpace->dataQ[col_i][row_i] * responseData[col_i];
-		}
-	}
-
-	// We now have Rx = workVec but R is upper triangular (n by n)
+	// We now have Rx = qtb but R is upper triangular (n by n)
+	float *qrCoefVec = new float[qrTerms];
 	float rowSolution;
-	for (int row_i = terms - 1; row_i >= 0; row_i--) {
+	for (int row_i = qrTerms - 1; row_i >= 0; row_i--) {
 
 		// initialize row solution
-		rowSolution = workSpace->workVec[row_i];
+		rowSolution = qtb[row_i];
 
 		// subtract other parts of LHS of equation
-		for (int col_i = terms - 1; col_i > row_i; col_i--) {
-			rowSolution -= workSpace->dataR[row_i][col_i] * coefVec[col_i];
+		for (int col_i = qrTerms - 1; col_i > row_i; col_i--) {
+			rowSolution -= dataR[row_i * maxTerms + col_i] * qrCoefVec[col_i];
 		}
 
 		// divide for final row solution
-		if (workSpace->dataR[row_i][row_i] == 0) {
-			coefVec[row_i] = 0;
+		if (dataR[row_i * maxTerms + row_i] == 0) {
+			qrCoefVec[row_i] = 0;
 		} else {
-			coefVec[row_i] = rowSolution / workSpace->dataR[row_i][row_i];
+			qrCoefVec[row_i] = rowSolution / dataR[row_i * maxTerms + row_i];
 		}
 
 	}
 
+	// put the coefficients in term list order
+	int term_i = 0;
+	for (pTermIndex = hTermIndex; pTermIndex != NULL; pTermIndex = pTermIndex->next) {
+		coefVec[term_i] = 0;
+		for (int col_i = 0; col_i < qrTerms; col_i++) {
+			if (qrCols[col_i] == pTermIndex->termIndex) {
+				coefVec[term_i] = qrCoefVec[col_i];
+				break;
+			}
+		}
+		term_i++;
+	}
+	delete[] qrCoefVec;
+
 	// coefVec holds the least squares coefficients
 	//cout << "coefficient vector" << endl;
 	//for (int term_i = 0; term_i < terms; term_i++) {
@@ -387,14 +663,25 @@ void Model::leastSquares() {
 	}
 
 	// find model response
+	float *responseData = response->getData();
+	float *scratch = new float[tests];
 	pTermIndex = hTermIndex;
 	for (int term_i = 0; term_i < terms; term_i++) {
-		csCol = csMatrix->getCol(pTermIndex->termIndex);
-		for (int row_i = 0; row_i < tests; row_i++) {
-			modelResponse[row_i] += csCol->dataP[row_i] * coefVec[term_i];
+		int rows_n;
+		int *colRows = csMatrix->getColRows(pTermIndex->termIndex, rows_n);
+		if (colRows != NULL) {
+			for (int entry_i = 0; entry_i < rows_n; entry_i++) {
+				modelResponse[colRows[entry_i]] += coefVec[term_i];
+			}
+		} else {
+			float *colData = csMatrix->getColData(pTermIndex->termIndex, scratch);
+			for (int row_i = 0; row_i < tests; row_i++) {
+				modelResponse[row_i] += colData[row_i] * coefVec[term_i];
+			}
 		}
 		pTermIndex = pTermIndex->next;
 	}
+	delete[] scratch;
 
 	// find residuals and SSres
 	for (int row_i = 0; row_i < tests; row_i++) {
@@ -435,7 +722,7 @@ bool Model::addTerm(int col_i, bool logit) {
 	TermIndex *termIndex = NULL;
 
 	TermIndex **pTermIndex = &hTermIndex;
-	for (; ; pTermIndex = &(*pTermIndex)->next) {
+	for (int term_i = 0; ; pTermIndex = &(*pTermIndex)->next, term_i++) {
 
 		if (*pTermIndex == NULL || (*pTermIndex)->termIndex > col_i) {
 			// insert within (or at the end of) the list
@@ -445,6 +732,15 @@ bool Model::addTerm(int col_i, bool logit) {
 			(*pTermIndex) = termIndex;
 			terms++;
 
+			// the new term starts with a zero logistic weight
+			for (int weight_i = terms - 1; weight_i > term_i; weight_i--) {
+				logitWeights[weight_i] = logitWeights[weight_i - 1];
+			}
+			logitWeights[term_i] = 0;
+
+			// extend the QR factorization with the new column
+			appendQR(col_i);
+
 			// calculate r-squared contribution for this term
 			float oldRSquared = this->rSquared;
 			
@@ -467,7 +763,8 @@ bool Model::addTerm(int col_i, bool logit) {
 // remove a term from the model
 bool Model::removeTerm(int col_i) {
 	// loop through the term index list
-	for (TermIndex **pTermIndex = &hTermIndex; *pTermIndex != NULL; pTermIndex = &(*pTermIndex)->next) {
+	int term_i = 0;
+	for (TermIndex **pTermIndex = &hTermIndex; *pTermIndex != NULL; pTermIndex = &(*pTermIndex)->next, term_i++) {
 		// check if it equals the term to be removed (col_i)
 		if ((*pTermIndex)->termIndex == col_i) {
 			// take the current term index out of the list
@@ -477,6 +774,14 @@ bool Model::removeTerm(int col_i) {
 			// decrease the number of terms
 			terms--;
 
+			// drop its logistic weight
+			for (int weight_i = term_i; weight_i < terms; weight_i++) {
+				logitWeights[weight_i] = logitWeights[weight_i + 1];
+			}
+
+			// downdate the QR factorization
+			removeQR(col_i);
+
 			// free its memory
 			delete removed;
 
@@ -492,25 +797,6 @@ int Model::getTerms() {
 	return terms;
 }
 
-// static
-void Model::setupWorkSpace(int rows, int cols) {
-	// allocate initial memory
-	workSpace = new WorkSpace;
-
-	// allocate memory for Q
-	workSpace->dataQ = new float*[rows];
-	for (int row_i = 0; row_i < rows; row_i++)
-		workSpace->dataQ[row_i] = new float[cols];
-
-	// allocate memory for R
-	workSpace->dataR = new float*[cols];
-	for (int row_i = 0; row_i < cols; row_i++)
-		workSpace->dataR[row_i] = new float[cols];
-
-	// allocate memory for work vector
-	workSpace->workVec = new float[rows];
-}
-
 void Model::countOccurrences(Occurrence *occurrence) {
 	// count occurrences for each term
 	int term_i = 0;
@@ -567,4 +853,13 @@ Model::~Model() {
 	// delete model response
 	delete[] modelResponse;
 
+	// delete QR factorization
+	delete[] qrCols;
+	delete[] dataQ;
+	delete[] dataR;
+	delete[] qtb;
+
+	// delete logistic weights
+	delete[] logitWeights;
+
 }
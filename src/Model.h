@@ -6,13 +6,13 @@
 #include "Occurrence.h"
 #include "VectorXf.h"
 
-// QR and least squares workspace
-typedef struct WorkSpace {
-	float **dataQ;
-	float **dataR;
-	
-	float *workVec;
-} WorkSpace;
+// solvers for logistic regression
+#define LOGIT_GRADIENT	0	// fixed step gradient ascent (1000 iterations, the original solver)
+#define LOGIT_IRLS		1	// iteratively reweighted least squares (Newton's method)
+
+// IRLS stopping rule (same as R's glm: relative change in deviance)
+#define LOGIT_TOLERANCE		1e-8
+#define LOGIT_MAX_ITERATIONS	25
 
 typedef struct TermIndex {
 	int termIndex;
@@ -22,8 +22,6 @@ typedef struct TermIndex {
 
 class Model {
 private:
-	static WorkSpace *workSpace;
-	
 	// CSMatrix to work with
 	CSMatrix *csMatrix;
 	
@@ -53,6 +51,27 @@ private:
 	
 	float rSquared;
 	
+	// QR factorization of the terms, kept up to date as terms are added and removed.
+	// Columns are in the order the terms were added, which is not the term list order.
+	int qrTerms;	// columns in the factorization
+	int *qrCols;	// cs matrix column of each factorization column
+	float *dataQ;	// m by n, column-major (column col_i starts at dataQ[col_i * tests])
+	float *dataR;	// n by n, row-major upper triangular
+	float *qtb;		// Q-transpose * response (n by 1)
+	
+	// logistic regression solver and its weights (term list order, used to warm start children)
+	int logitSolver;
+	float *logitWeights;
+	
+	// logistic regression solvers
+	void logisticRegressionGradient();
+	void logisticRegressionIRLS();
+	
+	// append a cs matrix column to the QR factorization (one orthogonalization step)
+	void appendQR(int col_i);
+	
+	// remove a cs matrix column from the QR factorization (Givens downdate)
+	void removeQR(int col_i);
 	
 public:
 	// constructor - initialize the model
@@ -71,6 +90,9 @@ public:
 	//perform logistic regression on this model
 	void logisticRegression();
 	
+	// select the logistic regression solver (LOGIT_GRADIENT or LOGIT_IRLS), inherited by duplicates
+	void setLogitSolver(int logitSolver);
+	
 	// get the residuals vector for this model
 	float *getResiVec();
 	
@@ -100,9 +122,6 @@ public:
 	
 	// destructor
 	~Model();
-	
-	// static: setup the global workspace
-	static void setupWorkSpace(int rows, int cols);
 };
 
 #endif
@@ -0,0 +1,164 @@
+#include "MoveScheduler.h"
+
+#include <cmath>
+
+MoveScheduler::MoveScheduler() {
+	annealing = false;
+	startTemperature = 0;
+	cooling = 1;
+	temperature = 0;
+
+	moveWeights[MOVE_COLUMN] = 1;
+	moveWeights[MOVE_BLOCK] = 0;
+	moveWeights[MOVE_CELL] = 0;
+	blockRows = 1;
+
+	tabuTenure = 0;
+
+	start(0, 0);
+}
+
+void MoveScheduler::setAnnealing(float startTemperature, float cooling) {
+	this->annealing = startTemperature > 0;
+	this->startTemperature = startTemperature;
+	this->cooling = cooling;
+}
+
+void MoveScheduler::setMoveWeights(int columnWeight, int blockWeight, int cellWeight, int blockRows) {
+	moveWeights[MOVE_COLUMN] = columnWeight;
+	moveWeights[MOVE_BLOCK] = blockWeight;
+	moveWeights[MOVE_CELL] = cellWeight;
+	this->blockRows = (blockRows < 1 ? 1 : blockRows);
+
+	// fall back to column moves if no weight was given
+	if (columnWeight + blockWeight + cellWeight <= 0) moveWeights[MOVE_COLUMN] = 1;
+}
+
+void MoveScheduler::setTabu(int tenure) {
+	tabuTenure = tenure;
+}
+
+bool MoveScheduler::isAnnealing() {
+	return annealing;
+}
+
+void MoveScheduler::start(int factors, long long int score) {
+	temperature = startTemperature;
+
+	tabuUntil.assign(factors, 0);
+
+	for (int type_i = 0; type_i < MOVE_TYPES; type_i++) {
+		movesOfType[type_i] = 0;
+		acceptedOfType[type_i] = 0;
+	}
+	worseAccepted = 0;
+	tabuSkips = 0;
+	bestScore = score;
+	bestMove = -1;
+	seconds = 0;
+
+	trajectory.clear();
+	trajectory.push_back(score);
+}
+
+// the factor to resample instead of factor_i (itself unless it is tabu)
+int MoveScheduler::chooseFactor(int factor_i, int move_i, Random &random) {
+	if (tabuTenure <= 0 || tabuUntil[factor_i] <= move_i) return factor_i;
+
+	tabuSkips++;
+
+	// try a few random factors before looking through all of them
+	int factors = tabuUntil.size();
+	for (int try_i = 0; try_i < 8; try_i++) {
+		int tryFactor_i = random.nextInt(factors);
+		if (tabuUntil[tryFactor_i] <= move_i) return tryFactor_i;
+	}
+	for (int tryFactor_i = 0; tryFactor_i < factors; tryFactor_i++) {
+		if (tabuUntil[tryFactor_i] <= move_i) return tryFactor_i;
+	}
+
+	// everything is tabu
+	return factor_i;
+}
+
+// pick a move type and its rows [move_top, move_end) out of [row_top, rows)
+int MoveScheduler::chooseRows(int row_top, int rows, int &move_top, int &move_end, Random &random) {
+	int moveType = MOVE_COLUMN;
+
+	int totalWeight = 0;
+	for (int type_i = 0; type_i < MOVE_TYPES; type_i++) {
+		totalWeight += moveWeights[type_i];
+	}
+	if (totalWeight != moveWeights[MOVE_COLUMN]) {
+		int weight = random.nextInt(totalWeight);
+		for (moveType = 0; weight >= moveWeights[moveType]; moveType++) {
+			weight -= moveWeights[moveType];
+		}
+	}
+
+	int moveRows = (moveType == MOVE_BLOCK ? blockRows : 1);
+	if (moveType == MOVE_COLUMN || rows - row_top <= moveRows) {
+		move_top = row_top;
+		move_end = rows;
+	} else {
+		move_top = row_top + random.nextInt(rows - row_top - moveRows + 1);
+		move_end = move_top + moveRows;
+	}
+
+	return moveType;
+}
+
+bool MoveScheduler::accept(long long int newScore, long long int score, Random &random) {
+	if (newScore <= score) return true;
+	if (!annealing || temperature <= 0) return false;
+
+	return random.nextFloat() < exp(-(newScore - score) / temperature);
+}
+
+void MoveScheduler::record(int move_i, int moveType, int factor_i, bool accepted, bool worse, long long int score) {
+	movesOfType[moveType]++;
+	if (accepted) {
+		acceptedOfType[moveType]++;
+		if (worse) worseAccepted++;
+	} else if (tabuTenure > 0) {
+		tabuUntil[factor_i] = move_i + 1 + tabuTenure;
+	}
+
+	if (score < bestScore) {
+		bestScore = score;
+		bestMove = move_i;
+	}
+	trajectory.push_back(score);
+
+	temperature *= cooling;
+}
+
+void MoveScheduler::finish(float seconds) {
+	this->seconds = seconds;
+}
+
+long long int MoveScheduler::getBestScore() {
+	return bestScore;
+}
+
+vector <long long int>&MoveScheduler::getTrajectory() {
+	return trajectory;
+}
+
+void MoveScheduler::printStatistics() {
+	long long int moves = 0;
+	long long int accepted = 0;
+	for (int type_i = 0; type_i < MOVE_TYPES; type_i++) {
+		moves += movesOfType[type_i];
+		accepted += acceptedOfType[type_i];
+	}
+
+	cout << "Moves: " << moves;
+	if (seconds > 0) cout << " (" << (int)(moves / seconds) << "/s)";
+	cout << " accepted " << accepted << " (" << worseAccepted << " worse)";
+	cout << " column " << acceptedOfType[MOVE_COLUMN] << "/" << movesOfType[MOVE_COLUMN];
+	cout << " block " << acceptedOfType[MOVE_BLOCK] << "/" << movesOfType[MOVE_BLOCK];
+	cout << " cell " << acceptedOfType[MOVE_CELL] << "/" << movesOfType[MOVE_CELL];
+	if (tabuSkips > 0) cout << " tabu " << tabuSkips;
+	cout << " best " << bestScore << " after move " << bestMove << endl;
+}
@@ -0,0 +1,71 @@
+#ifndef MOVESCHEDULER_H
+#define MOVESCHEDULER_H
+
+#include <iostream>
+#include <vector>
+
+#include "Random.h"
+
+using namespace std;
+
+// moves of randomizePaths (each resamples a factor, or its constraint group, in a range of rows)
+#define MOVE_COLUMN		0	// every row from row_top on
+#define MOVE_BLOCK		1	// a block of consecutive rows
+#define MOVE_CELL		2	// a single row
+#define MOVE_TYPES		3
+
+/*
+	Decides which moves randomizePaths makes and which it keeps. By default every move
+	resamples a whole column, only moves that do not raise the score are accepted and
+	nothing is tabu, which draws no random numbers of its own. Annealing also accepts a
+	worse move with probability exp(-(newScore - score) / temperature), where the
+	temperature starts at startTemperature and is multiplied by cooling after every move.
+	With a tabu tenure, a factor whose move was rejected is not resampled again for that
+	many moves (another factor is chosen at random instead).
+*/
+class MoveScheduler {
+private:
+	bool annealing;
+	float startTemperature;
+	float cooling;
+	float temperature;
+
+	// relative frequency of each move type
+	int moveWeights[MOVE_TYPES];
+	int blockRows;
+
+	int tabuTenure;
+	vector <int>tabuUntil;	// first move at which each factor is no longer tabu
+
+	// statistics of the last run
+	long long int movesOfType[MOVE_TYPES];
+	long long int acceptedOfType[MOVE_TYPES];
+	long long int worseAccepted;
+	long long int tabuSkips;
+	long long int bestScore;
+	int bestMove;
+	float seconds;
+	vector <long long int>trajectory;	// score before the first move and after every move
+
+public:
+	MoveScheduler();
+
+	void setAnnealing(float startTemperature, float cooling);
+	void setMoveWeights(int columnWeight, int blockWeight, int cellWeight, int blockRows);
+	void setTabu(int tenure);
+	bool isAnnealing();
+
+	// a run of randomizePaths
+	void start(int factors, long long int score);
+	int chooseFactor(int factor_i, int move_i, Random &random);
+	int chooseRows(int row_top, int rows, int &move_top, int &move_end, Random &random);
+	bool accept(long long int newScore, long long int score, Random &random);
+	void record(int move_i, int moveType, int factor_i, bool accepted, bool worse, long long int score);
+	void finish(float seconds);
+
+	long long int getBestScore();
+	vector <long long int>&getTrajectory();
+	void printStatistics();
+};
+
+#endif
@@ -1,12 +1,13 @@
 #include "Noise.h"
 
 
-Noise::Noise(float ratio) {
+Noise::Noise(float ratio, uint64_t seed) {
 	this->ratio = ratio;
+	random.seed(seed);
 }
 
 float Noise::addNoise(float mean, float range) {
-	float noise = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+	float noise = random.nextFloat();
 
 	float noiseRange = ratio * range;
 	float noisy = mean + (noise * noiseRange) - (noiseRange / 2);
@@ -3,6 +3,9 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <stdint.h>
+
+#include "Random.h"
 
 using namespace std;
 
@@ -11,9 +14,11 @@ private:
 	
 	float ratio;
 	
+	Random random;
+	
 public:
 	
-	Noise(float ratio);
+	Noise(float ratio, uint64_t seed);
 	float addNoise(float mean, float range);
 	
 };
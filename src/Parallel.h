@@ -0,0 +1,51 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// resolve a requested thread count (0 or less means one per hardware thread)
+inline int resolveThreads(int threads) {
+	if (threads <= 0) {
+		threads = thread::hardware_concurrency();
+		if (threads <= 0) threads = 1;
+	}
+	return threads;
+}
+
+/*
+	Run func(task_i, thread_i) for every task_i in [0, tasks) across a pool of threads.
+	Tasks are handed out one at a time from a shared counter, so uneven tasks balance
+	themselves. thread_i is in [0, threads) and lets the caller keep per-thread scratch
+	buffers. With a single thread (or a single task) everything runs on the calling thread.
+*/
+template <typename Func>
+void parallelFor(int tasks, int threads, Func func) {
+	threads = resolveThreads(threads);
+	if (threads > tasks) threads = tasks;
+
+	if (threads <= 1) {
+		for (int task_i = 0; task_i < tasks; task_i++) {
+			func(task_i, 0);
+		}
+		return;
+	}
+
+	atomic<int> nextTask(0);
+	vector<thread> workers;
+	for (int thread_i = 0; thread_i < threads; thread_i++) {
+		workers.push_back(thread([&nextTask, &func, tasks, thread_i]() {
+			for (int task_i = nextTask++; task_i < tasks; task_i = nextTask++) {
+				func(task_i, thread_i);
+			}
+		}));
+	}
+	for (int thread_i = 0; thread_i < threads; thread_i++) {
+		workers[thread_i].join();
+	}
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+/*
+	xoshiro256** pseudorandom generator (Blackman and Vigna). The state is seeded
+	from a single 64 bit seed with splitmix64, so every seed gives a good state.
+	A Random holds no global state, so each thread can own one. jump() advances the
+	stream by 2^128 draws: copying a generator and jumping the original once per
+	copy gives streams that never overlap (see streams()).
+*/
+class Random {
+private:
+	uint64_t state[4];
+
+	static uint64_t rotl(uint64_t x, int k);
+
+public:
+	Random(uint64_t seed = 1);
+
+	void seed(uint64_t seed);
+
+	uint64_t next();
+
+	// nonnegative 31 bit int (a drop-in for rand())
+	int nextInt();
+	// int in [0, n) for n > 0
+	int nextInt(int n);
+	// float in [0, 1)
+	float nextFloat();
+
+	void jump();
+	// fill streams[0 .. n-1] with non-overlapping streams split off this generator
+	void streams(Random *streams, int n);
+};
+
+inline uint64_t Random::rotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+inline Random::Random(uint64_t seed) {
+	this->seed(seed);
+}
+
+inline void Random::seed(uint64_t seed) {
+	for (int word_i = 0; word_i < 4; word_i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		state[word_i] = z ^ (z >> 31);
+	}
+}
+
+inline uint64_t Random::next() {
+	uint64_t result = rotl(state[1] * 5, 7) * 9;
+	uint64_t t = state[1] << 17;
+
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+
+	state[2] ^= t;
+	state[3] = rotl(state[3], 45);
+
+	return result;
+}
+
+inline int Random::nextInt() {
+	return (int)(next() >> 33);
+}
+
+inline int Random::nextInt(int n) {
+	// multiply the top 32 bits into [0, n) instead of dividing
+	return (int)(((next() >> 32) * (uint64_t)n) >> 32);
+}
+
+inline float Random::nextFloat() {
+	return (next() >> 40) * (1.0f / 16777216.0f);
+}
+
+inline void Random::jump() {
+	static const uint64_t jumpPoly[4] = {
+		0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+	};
+
+	uint64_t jumped[4] = {0, 0, 0, 0};
+	for (int word_i = 0; word_i < 4; word_i++) {
+		for (int bit_i = 0; bit_i < 64; bit_i++) {
+			if (jumpPoly[word_i] & ((uint64_t)1 << bit_i)) {
+				for (int state_i = 0; state_i < 4; state_i++) {
+					jumped[state_i] ^= state[state_i];
+				}
+			}
+			next();
+		}
+	}
+
+	for (int state_i = 0; state_i < 4; state_i++) {
+		state[state_i] = jumped[state_i];
+	}
+}
+
+inline void Random::streams(Random *streams, int n) {
+	for (int stream_i = 0; stream_i < n; stream_i++) {
+		streams[stream_i] = *this;
+		jump();
+	}
+}
+
+#endif
@@ -11,31 +11,46 @@ Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
 // makeCSMatrix2
-SEXP makeCSMatrix2(SEXP la);
-RcppExport SEXP _LATools_makeCSMatrix2(SEXP laSEXP) {
+SEXP makeCSMatrix2(SEXP la, double memlimit);
+RcppExport SEXP _LATools_makeCSMatrix2(SEXP laSEXP, SEXP memlimitSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< SEXP >::type la(laSEXP);
-    rcpp_result_gen = Rcpp::wrap(makeCSMatrix2(la));
+    Rcpp::traits::input_parameter< double >::type memlimit(memlimitSEXP);
+    rcpp_result_gen = Rcpp::wrap(makeCSMatrix2(la, memlimit));
     return rcpp_result_gen;
 END_RCPP
 }
+// convertLA
+void convertLA(std::string la_path, std::string out_path, std::string factor_data_path, bool binary);
+RcppExport SEXP _LATools_convertLA(SEXP la_pathSEXP, SEXP out_pathSEXP, SEXP factor_data_pathSEXP, SEXP binarySEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type la_path(la_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_path(out_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type factor_data_path(factor_data_pathSEXP);
+    Rcpp::traits::input_parameter< bool >::type binary(binarySEXP);
+    convertLA(la_path, out_path, factor_data_path, binary);
+    return R_NilValue;
+END_RCPP
+}
 // makeLA2
-SEXP makeLA2(std::string file, std::string factorDataFile);
-RcppExport SEXP _LATools_makeLA2(SEXP fileSEXP, SEXP factorDataFileSEXP) {
+SEXP makeLA2(std::string file, std::string factorDataFile, int t);
+RcppExport SEXP _LATools_makeLA2(SEXP fileSEXP, SEXP factorDataFileSEXP, SEXP tSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< std::string >::type file(fileSEXP);
     Rcpp::traits::input_parameter< std::string >::type factorDataFile(factorDataFileSEXP);
-    rcpp_result_gen = Rcpp::wrap(makeLA2(file, factorDataFile));
+    Rcpp::traits::input_parameter< int >::type t(tSEXP);
+    rcpp_result_gen = Rcpp::wrap(makeLA2(file, factorDataFile, t));
     return rcpp_result_gen;
 END_RCPP
 }
 // createModels_wrapper
-RcppExport SEXP createModels_wrapper(SEXP la_, SEXP response_, SEXP csMatrix_, SEXP maxTerms_, SEXP models_n_, SEXP newModels_n_, SEXP logit_);
-RcppExport SEXP _LATools_createModels_wrapper(SEXP la_SEXP, SEXP response_SEXP, SEXP csMatrix_SEXP, SEXP maxTerms_SEXP, SEXP models_n_SEXP, SEXP newModels_n_SEXP, SEXP logit_SEXP) {
+RcppExport SEXP createModels_wrapper(SEXP la_, SEXP response_, SEXP csMatrix_, SEXP maxTerms_, SEXP models_n_, SEXP newModels_n_, SEXP logit_, SEXP logitSolver_, SEXP threads_);
+RcppExport SEXP _LATools_createModels_wrapper(SEXP la_SEXP, SEXP response_SEXP, SEXP csMatrix_SEXP, SEXP maxTerms_SEXP, SEXP models_n_SEXP, SEXP newModels_n_SEXP, SEXP logit_SEXP, SEXP logitSolver_SEXP, SEXP threads_SEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -46,7 +61,68 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< SEXP >::type models_n_(models_n_SEXP);
     Rcpp::traits::input_parameter< SEXP >::type newModels_n_(newModels_n_SEXP);
     Rcpp::traits::input_parameter< SEXP >::type logit_(logit_SEXP);
-    rcpp_result_gen = Rcpp::wrap(createModels_wrapper(la_, response_, csMatrix_, maxTerms_, models_n_, newModels_n_, logit_));
+    Rcpp::traits::input_parameter< SEXP >::type logitSolver_(logitSolver_SEXP);
+    Rcpp::traits::input_parameter< SEXP >::type threads_(threads_SEXP);
+    rcpp_result_gen = Rcpp::wrap(createModels_wrapper(la_, response_, csMatrix_, maxTerms_, models_n_, newModels_n_, logit_, logitSolver_, threads_));
+    return rcpp_result_gen;
+END_RCPP
+}
+// buildModels_wrapper
+int buildModels_wrapper(std::string la_path, std::string factor_data_path, std::string response_dir, std::string response_column, bool log_data, int maxTerms, int models_n, int newModels_n, bool logit, int logitSolver, int threads, std::string cache_file, int t, double memlimit);
+RcppExport SEXP _LATools_buildModels_wrapper(SEXP la_pathSEXP, SEXP factor_data_pathSEXP, SEXP response_dirSEXP, SEXP response_columnSEXP, SEXP log_dataSEXP, SEXP maxTermsSEXP, SEXP models_nSEXP, SEXP newModels_nSEXP, SEXP logitSEXP, SEXP logitSolverSEXP, SEXP threadsSEXP, SEXP cache_fileSEXP, SEXP tSEXP, SEXP memlimitSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type la_path(la_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type factor_data_path(factor_data_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type response_dir(response_dirSEXP);
+    Rcpp::traits::input_parameter< std::string >::type response_column(response_columnSEXP);
+    Rcpp::traits::input_parameter< bool >::type log_data(log_dataSEXP);
+    Rcpp::traits::input_parameter< int >::type maxTerms(maxTermsSEXP);
+    Rcpp::traits::input_parameter< int >::type models_n(models_nSEXP);
+    Rcpp::traits::input_parameter< int >::type newModels_n(newModels_nSEXP);
+    Rcpp::traits::input_parameter< bool >::type logit(logitSEXP);
+    Rcpp::traits::input_parameter< int >::type logitSolver(logitSolverSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache_file(cache_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type t(tSEXP);
+    Rcpp::traits::input_parameter< double >::type memlimit(memlimitSEXP);
+    rcpp_result_gen = Rcpp::wrap(buildModels_wrapper(la_path, factor_data_path, response_dir, response_column, log_data, maxTerms, models_n, newModels_n, logit, logitSolver, threads, cache_file, t, memlimit));
+    return rcpp_result_gen;
+END_RCPP
+}
+// loadAnalysis_wrapper
+SEXP loadAnalysis_wrapper(std::string la_path, std::string factor_data_path, std::string cache_file, int t, double memlimit);
+RcppExport SEXP _LATools_loadAnalysis_wrapper(SEXP la_pathSEXP, SEXP factor_data_pathSEXP, SEXP cache_fileSEXP, SEXP tSEXP, SEXP memlimitSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type la_path(la_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type factor_data_path(factor_data_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache_file(cache_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type t(tSEXP);
+    Rcpp::traits::input_parameter< double >::type memlimit(memlimitSEXP);
+    rcpp_result_gen = Rcpp::wrap(loadAnalysis_wrapper(la_path, factor_data_path, cache_file, t, memlimit));
+    return rcpp_result_gen;
+END_RCPP
+}
+// buildModelsBatch_wrapper
+int buildModelsBatch_wrapper(SEXP analysis_, std::string response_dir, std::vector<std::string> response_column, std::vector<bool> log_data, std::vector<int> maxTerms, std::vector<int> models_n, std::vector<int> newModels_n, std::vector<bool> logit, std::vector<int> logitSolver, int threads);
+RcppExport SEXP _LATools_buildModelsBatch_wrapper(SEXP analysis_SEXP, SEXP response_dirSEXP, SEXP response_columnSEXP, SEXP log_dataSEXP, SEXP maxTermsSEXP, SEXP models_nSEXP, SEXP newModels_nSEXP, SEXP logitSEXP, SEXP logitSolverSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type analysis_(analysis_SEXP);
+    Rcpp::traits::input_parameter< std::string >::type response_dir(response_dirSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type response_column(response_columnSEXP);
+    Rcpp::traits::input_parameter< std::vector<bool> >::type log_data(log_dataSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type maxTerms(maxTermsSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type models_n(models_nSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type newModels_n(newModels_nSEXP);
+    Rcpp::traits::input_parameter< std::vector<bool> >::type logit(logitSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type logitSolver(logitSolverSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(buildModelsBatch_wrapper(analysis_, response_dir, response_column, log_data, maxTerms, models_n, newModels_n, logit, logitSolver, threads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -80,9 +156,13 @@ RcppExport SEXP _rcpp_module_boot_CSMatrix_module();
 RcppExport SEXP _rcpp_module_boot_VectorXf_module();
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_LATools_makeCSMatrix2", (DL_FUNC) &_LATools_makeCSMatrix2, 1},
-    {"_LATools_makeLA2", (DL_FUNC) &_LATools_makeLA2, 2},
-    {"_LATools_createModels_wrapper", (DL_FUNC) &_LATools_createModels_wrapper, 7},
+    {"_LATools_makeCSMatrix2", (DL_FUNC) &_LATools_makeCSMatrix2, 2},
+    {"_LATools_convertLA", (DL_FUNC) &_LATools_convertLA, 4},
+    {"_LATools_makeLA2", (DL_FUNC) &_LATools_makeLA2, 3},
+    {"_LATools_createModels_wrapper", (DL_FUNC) &_LATools_createModels_wrapper, 9},
+    {"_LATools_buildModels_wrapper", (DL_FUNC) &_LATools_buildModels_wrapper, 14},
+    {"_LATools_loadAnalysis_wrapper", (DL_FUNC) &_LATools_loadAnalysis_wrapper, 5},
+    {"_LATools_buildModelsBatch_wrapper", (DL_FUNC) &_LATools_buildModelsBatch_wrapper, 10},
     {"_LATools_makeVectorXF2", (DL_FUNC) &_LATools_makeVectorXF2, 4},
     {"_LATools_rcpp_hello_world", (DL_FUNC) &_LATools_rcpp_hello_world, 0},
     {"_rcpp_module_boot_LocatingArray_module", (DL_FUNC) &_rcpp_module_boot_LocatingArray_module, 0},
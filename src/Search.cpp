@@ -16,14 +16,12 @@
 #include "LocatingArray.h"
 #include "Noise.h"
 #include "Occurrence.h"
+#include "Parallel.h"
 #include "VectorXf.h"
 
 using namespace std;
 using namespace Rcpp;
 
-// static member of the class
-WorkSpace *Model::workSpace = NULL;
-
 // loader section
 
 VectorXf* loadResponseVector(VectorXf *response, string directory, string column, bool performLog) {
@@ -245,175 +243,194 @@ void deallocateOccurrences(Occurrence *occurrence, int factors) {
 
 */
 
-int createModels(LocatingArray *locatingArray, VectorXf *response, CSMatrix *csMatrix,
-					int maxTerms, int models_n, int newModels_n, bool logit) {
-	cout << "Creating Models..." << endl;
-	Model::setupWorkSpace(response->getLength(), maxTerms);
-
-	// work variables
-	Model *model;		// current model we are working on
-
-	Model **topModels = new Model*[models_n];
-	Model **nextTopModels = new Model*[models_n];
+// struct for the details of a column of CS matrix when looking for the top columns
+struct ColDetails {
+	int termIndex;
+	float dotProduct;
+	bool used;
+};
 
-	// populate initial top models
-	topModels[0] = new Model(response, maxTerms, csMatrix);
-	for (int model_i = 1; model_i < models_n; model_i++)
-		topModels[model_i] = NULL;
+/*
+	Expand a single model: take the (newModels_n) unused columns with the largest dot products
+	against the model's residuals and build one new model for each. The new models are written
+	to children in the order they were created (NULL after the last one). Only reads the model,
+	cs matrix and products, so separate models can be expanded concurrently as long as every
+	caller passes its own colDetails buffer.
+*/
+void expandModel(Model *model, CSMatrix *csMatrix, float *products, ColDetails *colDetails,
+					int newModels_n, bool logit, Model **children) {
+
+	// grab the distances to columns in cs matrix
+	for (int col_i = 0; col_i < csMatrix->getCols(); col_i++) {
+		colDetails[col_i].dotProduct = products[col_i];
+		colDetails[col_i].termIndex = col_i;
+		colDetails[col_i].used = model->termExists(col_i);
+	}
 
-	// struct for linked list of top columns of CS matrix
-	struct ColDetails {
-		int termIndex;
-		float dotProduct;
-		bool used;
+	for (int child_i = 0; child_i < newModels_n; child_i++) {
+		children[child_i] = NULL;
+	}
 
-	} *colDetails;
+	// find the columns with the largest dot products (at most as many as we have models)
+	for (int colsUsed = 0; colsUsed < newModels_n; colsUsed++) {
 
-	// allocate memory for top columns
-	colDetails = new ColDetails[csMatrix->getCols()];
+		float largestDotProduct = 0;
+		int bestCol_i = -1;
 
-	while (topModels[0] != NULL && topModels[0]->getTerms() < maxTerms) {
-		// LOOP HERE
+		// find the unused column with smallest distance
+		for (int col_i = 0; col_i < csMatrix->getCols(); col_i++) {
 
+			// check if this column has larger dot product and should be marked as best
+			if (!colDetails[col_i].used &&
+				(bestCol_i == -1 || colDetails[col_i].dotProduct > largestDotProduct)) {
+				bestCol_i = col_i;
+				largestDotProduct = colDetails[col_i].dotProduct;
+			}
 
-		// make sure all next top models are NULL
-		for (int model_i = 0; model_i < models_n; model_i++) {
-			nextTopModels[model_i] = NULL;
 		}
 
-		// grab the models from the topModels priority queue
-		for (int model_i = 0; model_i < models_n; model_i++) {
+		// check if all columns have been used already
+		if (bestCol_i == -1) {
+			break;
+		}
 
-			// we are done finding the next top models if we hit a NULL model
-			if (topModels[model_i] == NULL) break;
+		// mark the term as used
+		colDetails[bestCol_i].used = true;
 
+		// create a new model and add the term to the model
+		Model *newModel = new Model(model);
+		newModel->addTerm(bestCol_i, logit);
 
-			// grab the model from top models queue
-			model = topModels[model_i];
+		children[colsUsed] = newModel;
+	}
 
-//			cout << "Grabbing model" << endl;
-//			model->printModelFactors();
-//			cout << endl;
+}
 
+// state of one model search (a response and a set of search parameters)
+struct ModelSearch {
+	VectorXf *response;
+	int maxTerms;
+	int models_n;
+	int newModels_n;
+	bool logit;
+	int logitSolver;
+
+	Model **topModels;
+	Model **nextTopModels;
+	Model **children;	// new models created from each top model, newModels_n slots per top model
+	float **products;	// dot products of each top model's residuals with every column of cs matrix
+	int active_n;		// top models being expanded in the current iteration
+};
+
+void startSearch(ModelSearch *search, CSMatrix *csMatrix) {
+	int models_n = search->models_n;
+
+	search->topModels = new Model*[models_n];
+	search->nextTopModels = new Model*[models_n];
+	search->children = new Model*[models_n * search->newModels_n];
+	search->products = new float*[models_n];
+	for (int model_i = 0; model_i < models_n; model_i++) {
+		search->products[model_i] = new float[csMatrix->getCols()];
+	}
+	search->active_n = 0;
 
-			// grab the distances to columns in cs matrix
-			for (int col_i = 0; col_i < csMatrix->getCols(); col_i++) {
-				colDetails[col_i].dotProduct =
-					csMatrix->getProductWithCol(col_i, model->getResiVec());
-				colDetails[col_i].termIndex = col_i;
-				colDetails[col_i].used = model->termExists(col_i);
-			}
+	// populate initial top models
+	search->topModels[0] = new Model(search->response, search->maxTerms, csMatrix);
+	search->topModels[0]->setLogitSolver(search->logitSolver);
+	for (int model_i = 1; model_i < models_n; model_i++)
+		search->topModels[model_i] = NULL;
+}
 
+// check if the search still has models to grow
+bool searchActive(ModelSearch *search) {
+	return search->topModels[0] != NULL && search->topModels[0]->getTerms() < search->maxTerms;
+}
 
-			// find the columns with the largest dot products (at most as many as we have models)
-			for (int colsUsed = 0; colsUsed < newModels_n; colsUsed++) {
+/*
+	Merge the new models into the next top models queue. This runs serially in the same
+	order the models were created in when expanding one model at a time, so the ranking
+	(and the merging of duplicates) does not depend on the thread count.
+*/
+void mergeSearch(ModelSearch *search) {
+	int models_n = search->models_n;
+	int newModels_n = search->newModels_n;
+	Model **topModels = search->topModels;
+	Model **nextTopModels = search->nextTopModels;
+	Model *model;
+
+	// make sure all next top models are NULL
+	for (int model_i = 0; model_i < models_n; model_i++) {
+		nextTopModels[model_i] = NULL;
+	}
 
-				float largestDotProduct = 0;
-				int bestCol_i = -1;
+	for (int model_i = 0; model_i < search->active_n; model_i++) {
 
-				// find the unused column with smallest distance
-				for (int col_i = 0; col_i < csMatrix->getCols(); col_i++) {
+		// grab the model from top models queue
+		model = topModels[model_i];
 
-					// check if this column has larger dot product and should be marked as best
-					if (!colDetails[col_i].used &&
-						(bestCol_i == -1 || colDetails[col_i].dotProduct > largestDotProduct)) {
-						bestCol_i = col_i;
-						largestDotProduct = colDetails[col_i].dotProduct;
-					}
+		for (int child_i = 0; child_i < newModels_n; child_i++) {
 
-				}
+			Model *newModel = search->children[model_i * newModels_n + child_i];
+			if (newModel == NULL) break;
 
-				// check if all columns have been used already
-				if (bestCol_i == -1) {
+			// check if the model is a duplicate
+			bool isDuplicate = false;
+			for (int model_i = 0; model_i < models_n; model_i++) {
+				if (nextTopModels[model_i] == NULL) {
+					break;
+				} else if (nextTopModels[model_i]->isDuplicate(newModel, true)) {
+					//cout << "Duplicate Model!!! Merged!" << endl;
+					isDuplicate = true;
 					break;
 				}
+			}
 
-				// mark the term as used
-				colDetails[bestCol_i].used = true;
-
-        // create a new model and add the term to the model
-				Model *newModel = new Model(model);
-				newModel->addTerm(bestCol_i, logit);
-
-				// add the term to the model temporarily
-				//model->addTerm(bestCol_i);
-				//model->leastSquares();
-
-//				cout << "Ran least squares on:" << endl;
-//				model->printModelFactors();
-//				cout << endl;
-
-				// check if the model is a duplicate
-				bool isDuplicate = false;
-				for (int model_i = 0; model_i < models_n; model_i++) {
-					if (nextTopModels[model_i] == NULL) {
-						break;
-					} else if (nextTopModels[model_i]->isDuplicate(newModel, true)) {
-						//cout << "Duplicate Model!!! Merged!" << endl;
-						isDuplicate = true;
-						break;
-					}
-				}
-
-				if (!isDuplicate) {
-					// find a possible next top model to replace
-					if (nextTopModels[models_n - 1] == NULL ||
-						nextTopModels[models_n - 1]->getRSquared() < newModel->getRSquared()) {
-
-						// make sure we deallocate the older next top model
-						if (nextTopModels[models_n - 1] != NULL) {
-							delete nextTopModels[models_n - 1];
-							nextTopModels[models_n - 1] = NULL;
-						}
+			if (!isDuplicate) {
+				// find a possible next top model to replace
+				if (nextTopModels[models_n - 1] == NULL ||
+					nextTopModels[models_n - 1]->getRSquared() < newModel->getRSquared()) {
 
-						// insert the new next top model
-						nextTopModels[models_n - 1] = newModel;
-                                                } else {
-						delete newModel;
+					// make sure we deallocate the older next top model
+					if (nextTopModels[models_n - 1] != NULL) {
+						delete nextTopModels[models_n - 1];
+						nextTopModels[models_n - 1] = NULL;
 					}
 
-					// perform swapping to maintain sorted list
-					for (int model_i = models_n - 2; model_i >= 0; model_i--) {
-						if (nextTopModels[model_i] == NULL ||
-							nextTopModels[model_i]->getRSquared() < nextTopModels[model_i + 1]->getRSquared()) {
-
-							Model *temp = nextTopModels[model_i];
-							nextTopModels[model_i] = nextTopModels[model_i + 1];
-							nextTopModels[model_i + 1] = temp;
-						}
-					}
-
-                                    } else {
+					// insert the new next top model
+					nextTopModels[models_n - 1] = newModel;
+				} else {
 					delete newModel;
-				    }
 				}
 
-				// remove the temporarily added term
-				//model->removeTerm(bestCol_i);
-
-
+				// perform swapping to maintain sorted list
+				for (int model_i = models_n - 2; model_i >= 0; model_i--) {
+					if (nextTopModels[model_i] == NULL ||
+						nextTopModels[model_i]->getRSquared() < nextTopModels[model_i + 1]->getRSquared()) {
 
-			// delete the model from the top models queue since it has been processed
-			delete model;
+						Model *temp = nextTopModels[model_i];
+						nextTopModels[model_i] = nextTopModels[model_i + 1];
+						nextTopModels[model_i + 1] = temp;
+					}
+				}
 
+			} else {
+				delete newModel;
+			}
 		}
 
-		// copy next top models to top models
-		for (int model_i = 0; model_i < models_n; model_i++) {
-			topModels[model_i] = nextTopModels[model_i];
-		}
+		// delete the model from the top models queue since it has been processed
+		delete model;
 
-		// find the top model
-		if (topModels[0] != NULL) {
-			cout << "Top Model (" << topModels[0]->getRSquared() << "):" << endl;
-			topModels[0]->printModelFactors();
-		} else {
-			cout << "No Model" << endl;
-		}
+	}
 
+	// copy next top models to top models
+	for (int model_i = 0; model_i < models_n; model_i++) {
+		topModels[model_i] = nextTopModels[model_i];
 	}
+}
 
-	delete[] colDetails;
+// print the final ranking and occurrence counts of a search and free it
+void finishSearch(ModelSearch *search, LocatingArray *locatingArray) {
 
 	// count occurrences
 	Occurrence *occurrence = new Occurrence;
@@ -427,15 +444,15 @@ int createModels(LocatingArray *locatingArray, VectorXf *response, CSMatrix *csM
 
 	cout << endl;
 	cout << "Final Models Ranking: " << endl;
-	for (int model_i = 0; model_i < models_n; model_i++) {
-		if (topModels[model_i] != NULL) {
-			cout << "Model " << (model_i + 1) << " (" << topModels[model_i]->getRSquared() << "):" << endl;
-			topModels[model_i]->printModelFactors();
+	for (int model_i = 0; model_i < search->models_n; model_i++) {
+		if (search->topModels[model_i] != NULL) {
+			cout << "Model " << (model_i + 1) << " (" << search->topModels[model_i]->getRSquared() << "):" << endl;
+			search->topModels[model_i]->printModelFactors();
 			cout << endl;
 
-			topModels[model_i]->countOccurrences(occurrence);
-			delete topModels[model_i];
-			topModels[model_i] = NULL;
+			search->topModels[model_i]->countOccurrences(occurrence);
+			delete search->topModels[model_i];
+			search->topModels[model_i] = NULL;
 		} else {
 			break;
 		}
@@ -488,15 +505,140 @@ int createModels(LocatingArray *locatingArray, VectorXf *response, CSMatrix *csM
 	delete occurrence;
 
 	delete[] occurrenceLists;
-	//delete[] topModels;
-	delete[] nextTopModels;
 
-  return 0;
+	for (int model_i = 0; model_i < search->models_n; model_i++) {
+		delete[] search->products[model_i];
+	}
+	delete[] search->products;
+	delete[] search->children;
+	delete[] search->topModels;
+	delete[] search->nextTopModels;
+}
+
+/*
+	Run a batch of searches over the same cs matrix in lockstep. Every iteration, the residuals
+	of the top models of all active searches are scored against the columns in a single pass
+	over the column data, then all top models of all searches are expanded on the thread pool.
+	Each search then merges its own new models, so every search gives the same results it
+	would give when run on its own.
+*/
+int runSearches(LocatingArray *locatingArray, CSMatrix *csMatrix, int searches_n, ModelSearch *searches, int threads) {
+	cout << "Creating Models..." << endl;
+
+	// the models read the sparse columns from the index on every thread
+	csMatrix->buildIndex();
+
+	int totalModels_n = 0;
+	for (int search_i = 0; search_i < searches_n; search_i++) {
+		startSearch(&searches[search_i], csMatrix);
+		totalModels_n += searches[search_i].models_n;
+	}
+
+	threads = resolveThreads(threads);
+	if (threads > totalModels_n) threads = totalModels_n;
+	if (threads > 1) cout << "Expanding models on " << threads << " threads" << endl;
+
+	// allocate memory for top columns (one buffer per thread)
+	ColDetails **colDetails = new ColDetails*[threads];
+	for (int thread_i = 0; thread_i < threads; thread_i++) {
+		colDetails[thread_i] = new ColDetails[csMatrix->getCols()];
+	}
+
+	// residuals of every top model being expanded, the products to fill and who owns them
+	float **residuals = new float*[totalModels_n];
+	float **products = new float*[totalModels_n];
+	int *residualSearch = new int[totalModels_n];
+	int *residualModel = new int[totalModels_n];
+
+	while (true) {
+		// LOOP HERE
+
+		// grab the top models of all searches that are still going
+		int residuals_n = 0;
+		for (int search_i = 0; search_i < searches_n; search_i++) {
+			ModelSearch *search = &searches[search_i];
+
+			search->active_n = 0;
+			if (!searchActive(search)) continue;
+
+			while (search->active_n < search->models_n && search->topModels[search->active_n] != NULL) {
+				residuals[residuals_n] = search->topModels[search->active_n]->getResiVec();
+				products[residuals_n] = search->products[search->active_n];
+				residualSearch[residuals_n] = search_i;
+				residualModel[residuals_n] = search->active_n;
+				residuals_n++;
+				search->active_n++;
+			}
+		}
+		if (residuals_n == 0) break;
+
+		// grab the distances to columns in cs matrix for all top models in one pass
+		csMatrix->getProductsWithCols(residuals_n, residuals, products);
+
+		// expand every top model (in parallel when there are threads to spare)
+		parallelFor(residuals_n, threads, [&](int residual_i, int thread_i) {
+			ModelSearch *search = &searches[residualSearch[residual_i]];
+			int model_i = residualModel[residual_i];
+
+			expandModel(search->topModels[model_i], csMatrix, products[residual_i], colDetails[thread_i],
+				search->newModels_n, search->logit, &search->children[model_i * search->newModels_n]);
+		});
+
+		for (int search_i = 0; search_i < searches_n; search_i++) {
+			ModelSearch *search = &searches[search_i];
+			if (search->active_n == 0) continue;
+
+			mergeSearch(search);
+
+			// find the top model
+			if (searches_n > 1) cout << "Search " << (search_i + 1) << " ";
+			if (search->topModels[0] != NULL) {
+				cout << "Top Model (" << search->topModels[0]->getRSquared() << "):" << endl;
+				search->topModels[0]->printModelFactors();
+			} else {
+				cout << "No Model" << endl;
+			}
+		}
+
+	}
+
+	for (int thread_i = 0; thread_i < threads; thread_i++) {
+		delete[] colDetails[thread_i];
+	}
+	delete[] colDetails;
+	delete[] residuals;
+	delete[] products;
+	delete[] residualSearch;
+	delete[] residualModel;
+
+	for (int search_i = 0; search_i < searches_n; search_i++) {
+		if (searches_n > 1) {
+			cout << endl;
+			cout << "Search " << (search_i + 1) << " (" << searches[search_i].maxTerms << " terms, " <<
+				searches[search_i].models_n << " models, " << searches[search_i].newModels_n << " new models):" << endl;
+		}
+		finishSearch(&searches[search_i], locatingArray);
+	}
+
+	return 0;
+}
+
+int createModels(LocatingArray *locatingArray, VectorXf *response, CSMatrix *csMatrix,
+					int maxTerms, int models_n, int newModels_n, bool logit, int logitSolver, int threads) {
+
+	ModelSearch search;
+	search.response = response;
+	search.maxTerms = maxTerms;
+	search.models_n = models_n;
+	search.newModels_n = newModels_n;
+	search.logit = logit;
+	search.logitSolver = logitSolver;
 
+	return runSearches(locatingArray, csMatrix, 1, &search, threads);
 }
 
 //[[Rcpp::export]]
-RcppExport SEXP createModels_wrapper(SEXP la_, SEXP response_, SEXP csMatrix_, SEXP maxTerms_, SEXP models_n_, SEXP newModels_n_, SEXP logit_){
+RcppExport SEXP createModels_wrapper(SEXP la_, SEXP response_, SEXP csMatrix_, SEXP maxTerms_, SEXP models_n_, SEXP newModels_n_, SEXP logit_, SEXP logitSolver_, SEXP threads_){
   
   //grab the objects as XPtrs to make la, response, and csMatrix
   Rcpp::XPtr<LocatingArray> la_ptr(la_);
@@ -508,15 +650,122 @@ RcppExport SEXP createModels_wrapper(SEXP la_, SEXP response_, SEXP csMatrix_, S
   int models_n = as<int>(models_n_);
   int newModels_n = as<int>(newModels_n_);
   bool logit = as<bool>(logit_);
+  int logitSolver = as<int>(logitSolver_);
+  int threads = as<int>(threads_);
   
   int models;
   
   //invoke the function
-  models <- createModels(la_ptr, response_ptr, cs_ptr, maxTerms, models_n, newModels_n, logit);
+  models = createModels(la_ptr, response_ptr, cs_ptr, maxTerms, models_n, newModels_n, logit, logitSolver, threads);
   
   return wrap(models);
 }
 
+//build the locating array, cs matrix and response vector once, create the models, and free everything again
+// [[Rcpp::export]]
+int buildModels_wrapper(std::string la_path, std::string factor_data_path, std::string response_dir, std::string response_column,
+                        bool log_data, int maxTerms, int models_n, int newModels_n, bool logit, int logitSolver, int threads,
+                        std::string cache_file, int t, double memlimit){
+  
+  LocatingArray *la = new LocatingArray(la_path, factor_data_path, t);
+  bool virtualCols = false;
+  if (!CSMatrix::fitMemory(la, true, memlimit * 1048576, &virtualCols)) {
+    delete la;
+    Rcpp::stop("CS Matrix would exceed the memory limit");
+  }
+  CSMatrix *csMatrix = new CSMatrix(la, true, cache_file, virtualCols);
+  
+  VectorXf *response = new VectorXf(la->getTests());
+  response->loadResponse(response_dir, response_column, log_data);
+  
+  int models = createModels(la, response, csMatrix, maxTerms, models_n, newModels_n, logit, logitSolver, threads);
+  
+  //the cs matrix refers to the locating array, so delete it first
+  delete response;
+  delete csMatrix;
+  delete la;
+  
+  return models;
+}
+
+// a locating array and its cs matrix kept alive between calls from R
+struct Analysis {
+	LocatingArray *locatingArray;
+	CSMatrix *csMatrix;
+
+	~Analysis() {
+		// the cs matrix refers to the locating array, so delete it first
+		delete csMatrix;
+		delete locatingArray;
+	}
+};
+
+//build the locating array and cs matrix once and hand them to R to run any number of searches against
+// [[Rcpp::export]]
+SEXP loadAnalysis_wrapper(std::string la_path, std::string factor_data_path, std::string cache_file, int t, double memlimit){
+  LocatingArray *la = new LocatingArray(la_path, factor_data_path, t);
+  bool virtualCols = false;
+  if (!CSMatrix::fitMemory(la, true, memlimit * 1048576, &virtualCols)) {
+    delete la;
+    Rcpp::stop("CS Matrix would exceed the memory limit");
+  }
+  
+  Analysis *analysis = new Analysis;
+  analysis->locatingArray = la;
+  analysis->csMatrix = new CSMatrix(la, true, cache_file, virtualCols);
+  
+  Rcpp::XPtr<Analysis> ptr(analysis);
+  return ptr;
+}
+
+//run a batch of searches (one per element of the parameter vectors) against a loaded analysis
+// [[Rcpp::export]]
+int buildModelsBatch_wrapper(SEXP analysis_, std::string response_dir, std::vector<std::string> response_column,
+                             std::vector<bool> log_data, std::vector<int> maxTerms, std::vector<int> models_n,
+                             std::vector<int> newModels_n, std::vector<bool> logit, std::vector<int> logitSolver, int threads){
+  
+  Rcpp::XPtr<Analysis> analysis(analysis_);
+  LocatingArray *la = analysis->locatingArray;
+  
+  int searches_n = response_column.size();
+  ModelSearch *searches = new ModelSearch[searches_n];
+  bool *ownsResponse = new bool[searches_n];
+  
+  for (int search_i = 0; search_i < searches_n; search_i++) {
+    ModelSearch *search = &searches[search_i];
+    search->maxTerms = maxTerms[search_i];
+    search->models_n = models_n[search_i];
+    search->newModels_n = newModels_n[search_i];
+    search->logit = logit[search_i];
+    search->logitSolver = logitSolver[search_i];
+    
+    //searches on the same response share the response vector
+    search->response = NULL;
+    ownsResponse[search_i] = false;
+    for (int prev_i = 0; prev_i < search_i; prev_i++) {
+      if (response_column[prev_i] == response_column[search_i] && log_data[prev_i] == log_data[search_i]) {
+        search->response = searches[prev_i].response;
+        break;
+      }
+    }
+    if (search->response == NULL) {
+      search->response = new VectorXf(la->getTests());
+      search->response->loadResponse(response_dir, response_column[search_i], log_data[search_i]);
+      ownsResponse[search_i] = true;
+    }
+  }
+  
+  int models = runSearches(la, analysis->csMatrix, searches_n, searches, threads);
+  
+  for (int search_i = 0; search_i < searches_n; search_i++) {
+    if (ownsResponse[search_i]) delete searches[search_i].response;
+  }
+  delete[] ownsResponse;
+  delete[] searches;
+  
+  return models;
+}
+
 void reorderrows_la(LocatingArray *locatingArray, VectorXf *response, CSMatrix *csMatrix, int k, int c, string newla_path, string response_col, string response_dir){
 
 	//set to zero as this can be done later in the model building step
@@ -543,21 +792,72 @@ int main(int argc, char **argv) {
 
 	// ./Search LA_LARGE.tsv Factors_LARGE.tsv analysis responses_LARGE Throughput 1 13 50 50
 
-	long long int seed = time(NULL);
-	cout << "Seed:\t" << seed << endl;
-	srand(seed);
-
 	if (argc < 3) {
-		cout << "Usage: " << argv[0] << " [LocatingArray.tsv] ([FactorData.tsv]) ..." << endl;
+		cout << "Usage: " << argv[0] << " [LocatingArray.tsv] ([FactorData.tsv]) ([options]) ..." << endl;
+		cout << "   or: " << argv[0] << " [LocatingArray] [FactorData.tsv] convert [OutputLA] [tsv/bin]" << endl;
+		cout << "options: t [strength], cache [file], virtual, memlimit [MB], seed [seed], threads [count]" << endl;
+		return 0;
+	}
+
+	// convert between the TSV and binary locating array formats without building a CS matrix
+	if (argc == 6 && strcmp(argv[3], "convert") == 0) {
+		LocatingArray *array = new LocatingArray(argv[1], argv[2]);
+		array->writeToFile(argv[4], strcmp(argv[5], "bin") == 0);
+		cout << endl;
+		delete array;
 		return 0;
 	}
 
 	Noise *noise = NULL;
-	LocatingArray *array = new LocatingArray(argv[1], argv[2]);
+	int threads = 1;
+	bool logit = false;
+	int logitSolver = LOGIT_IRLS;
+
+	/* the options that shape the locating array and CS matrix come before the 1st command:
+	the interaction strength ("t [strength]"), a CS matrix cache file ("cache [file]"), computing
+	the interaction columns from the main effects as needed ("virtual"), a bound on the CS matrix
+	memory above which the columns are made virtual ("memlimit [MB]"), a seed to repeat a run
+	("seed [seed]") and the threads to build the CS matrix on ("threads [count]") */
+	long long int seed = time(NULL);
+	int t = 2;
+	string cacheFile = "";
+	bool virtualCols = false;
+	double memLimit = 0;
+	int firstCommand = 3;
+	for (; firstCommand < argc; firstCommand++) {
+		if (strcmp(argv[firstCommand], "virtual") == 0) {
+			virtualCols = true;
+		} else if (firstCommand + 1 >= argc) {
+			break;
+		} else if (strcmp(argv[firstCommand], "t") == 0) {
+			t = atoi(argv[++firstCommand]);
+		} else if (strcmp(argv[firstCommand], "cache") == 0) {
+			cacheFile = argv[++firstCommand];
+		} else if (strcmp(argv[firstCommand], "memlimit") == 0) {
+			memLimit = atof(argv[++firstCommand]) * 1048576;
+		} else if (strcmp(argv[firstCommand], "seed") == 0) {
+			seed = atoll(argv[++firstCommand]);
+		} else if (strcmp(argv[firstCommand], "threads") == 0) {
+			threads = atoi(argv[++firstCommand]);
+		} else {
+			break;
+		}
+	}
+	cout << "Seed:\t" << seed << endl;
 
-	CSMatrix *matrix = new CSMatrix(array);
+	LocatingArray *array = new LocatingArray(argv[1], argv[2], t);
+
+	if (!CSMatrix::fitMemory(array, true, memLimit, &virtualCols)) {
+		cout << "Exiting" << endl;
+		delete array;
+		return 1;
+	}
 
-	for (int arg_i = 3; arg_i < argc; arg_i++) {
+	CSMatrix *matrix = new CSMatrix(array, true, cacheFile, virtualCols, threads);
+	matrix->setSeed(seed);
+	matrix->setThreads(threads);
+
+	for (int arg_i = firstCommand; arg_i < argc; arg_i++) {
 		if (strcmp(argv[arg_i], "memchk") == 0) {
 			int exit;
 			cout << "Check memory and press ENTER" << endl;
@@ -573,7 +873,7 @@ int main(int argc, char **argv) {
 				loadResponseVector(response, argv[arg_i + 1], argv[arg_i + 2], performLog);
 				cout << "Response range: " << response->getData()[0] << " to " << response->getData()[response->getLength() - 1] << endl;
 
-				createModels(array, response, matrix, terms_n, models_n, newModels_n, false);
+				createModels(array, response, matrix, terms_n, models_n, newModels_n, logit, logitSolver, threads);
 				delete response;
 
 				arg_i += 6;
@@ -683,11 +983,84 @@ int main(int argc, char **argv) {
 				cout << " [k Separation] [c Minimum Count]" << endl;
 				arg_i = argc;
 			}
+		} else if (strcmp(argv[arg_i], "virtual") == 0) {
+			cout << argv[arg_i] << " has to come before the 1st command, ignoring it" << endl;
+		} else if (strcmp(argv[arg_i], "t") == 0 || strcmp(argv[arg_i], "cache") == 0 ||
+				strcmp(argv[arg_i], "memlimit") == 0 || strcmp(argv[arg_i], "seed") == 0) {
+			cout << argv[arg_i] << " has to come before the 1st command, ignoring it" << endl;
+			arg_i += 1;
+		} else if (strcmp(argv[arg_i], "anneal") == 0) {
+			if (arg_i + 2 < argc) {
+				matrix->getMoveScheduler()->setAnnealing(atof(argv[arg_i + 1]), atof(argv[arg_i + 2]));
+
+				arg_i += 2;
+			} else {
+				cout << "Usage: ... " << argv[arg_i];
+				cout << " [Start Temperature] [Cooling (temperature factor per move)]" << endl;
+				arg_i = argc;
+			}
+		} else if (strcmp(argv[arg_i], "moves") == 0) {
+			if (arg_i + 4 < argc) {
+				matrix->getMoveScheduler()->setMoveWeights(atoi(argv[arg_i + 1]), atoi(argv[arg_i + 2]),
+					atoi(argv[arg_i + 3]), atoi(argv[arg_i + 4]));
+
+				arg_i += 4;
+			} else {
+				cout << "Usage: ... " << argv[arg_i];
+				cout << " [Column Weight] [Block Weight] [Cell Weight] [Block Rows]" << endl;
+				arg_i = argc;
+			}
+		} else if (strcmp(argv[arg_i], "tabu") == 0) {
+			if (arg_i + 1 < argc) {
+				matrix->getMoveScheduler()->setTabu(atoi(argv[arg_i + 1]));
+
+				arg_i += 1;
+			} else {
+				cout << "Usage: ... " << argv[arg_i];
+				cout << " [Tenure (moves a factor stays tabu after a rejected move)]" << endl;
+				arg_i = argc;
+			}
+		} else if (strcmp(argv[arg_i], "logit") == 0) {
+			if (arg_i + 1 < argc) {
+				logit = true;
+				if (strcmp(argv[arg_i + 1], "gradient") == 0) {
+					logitSolver = LOGIT_GRADIENT;
+				} else {
+					logitSolver = LOGIT_IRLS;
+				}
+
+				arg_i += 1;
+			} else {
+				cout << "Usage: ... " << argv[arg_i];
+				cout << " [irls/gradient]" << endl;
+				arg_i = argc;
+			}
+		} else if (strcmp(argv[arg_i], "threads") == 0) {
+			if (arg_i + 1 < argc) {
+				threads = atoi(argv[arg_i + 1]);
+				matrix->setThreads(threads);
+
+				arg_i += 1;
+			} else {
+				cout << "Usage: ... " << argv[arg_i];
+				cout << " [threads (0 for all cores)]" << endl;
+				arg_i = argc;
+			}
+		} else if (strcmp(argv[arg_i], "starts") == 0) {
+			if (arg_i + 1 < argc) {
+				matrix->setStarts(atoi(argv[arg_i + 1]));
+
+				arg_i += 1;
+			} else {
+				cout << "Usage: ... " << argv[arg_i];
+				cout << " [restarts run at once by mtfixla and autofind]" << endl;
+				arg_i = argc;
+			}
 		} else if (strcmp(argv[arg_i], "noise") == 0) {
 			if (arg_i + 1 < argc) {
 				float ratio = atof(argv[arg_i + 1]);
 
-				noise = new Noise(ratio);
+				noise = new Noise(ratio, seed);
 
 				arg_i += 1;
 			} else {